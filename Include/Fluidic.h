@@ -24,6 +24,8 @@ THE SOFTWARE.
 
 #include "../Source/Fluidic/Fluid2D.h"
 #include "../Source/Fluidic/Fluid3D.h"
+#include "../Source/Fluidic/FluidCPU2D.h"
+#include "../Source/Fluidic/FluidCPU3D.h"
 #include "../Source/Fluidic/IVelocityPoller.h"
 
 #endif
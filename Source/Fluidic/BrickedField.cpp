@@ -0,0 +1,477 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "BrickedField.h"
+
+#include <algorithm>
+
+#include "CPUKernels.h"
+
+using namespace std;
+using namespace Fluidic;
+
+namespace
+{
+	/// Spreads the low 10 bits of v out to every third bit, for Morton codes
+	inline unsigned int SpreadBits(unsigned int v)
+	{
+		v &= 0x3ff;
+		v = (v | (v << 16)) & 0x030000ff;
+		v = (v | (v << 8)) & 0x0300f00f;
+		v = (v | (v << 4)) & 0x030c30c3;
+		v = (v | (v << 2)) & 0x09249249;
+		return v;
+	}
+
+	inline unsigned int Morton(int x, int y, int z)
+	{
+		return SpreadBits(x) | (SpreadBits(y) << 1) | (SpreadBits(z) << 2);
+	}
+
+	/// Orders brick numbers by the Morton codes of their coordinates
+	struct MortonLess
+	{
+		int bricksX, bricksY;
+
+		MortonLess(int x, int y) : bricksX(x), bricksY(y) {}
+
+		unsigned int Code(int brick) const
+		{
+			return Morton(brick % bricksX, (brick / bricksX) % bricksY, brick / (bricksX * bricksY));
+		}
+
+		bool operator()(int a, int b) const { return Code(a) < Code(b); }
+	};
+
+	/// x + 1 along a register of 4 cells, with 'next' the cell after them
+	inline __m128 F4ShiftLeft(__m128 a, __m128 next)
+	{
+		__m128 t = _mm_shuffle_ps(a, next, _MM_SHUFFLE(0, 0, 3, 3)); //a3 a3 n0 n0
+		return _mm_shuffle_ps(a, t, _MM_SHUFFLE(2, 0, 2, 1)); //a1 a2 a3 n0
+	}
+
+	/// x - 1 along a register of 4 cells, with 'previous' the cell before them
+	inline __m128 F4ShiftRight(__m128 a, __m128 previous)
+	{
+		return _mm_move_ss(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 1, 0, 0)), previous); //p a0 a1 a2
+	}
+
+	/// One jacobi iteration of a 1 component row, clamping at its ends - for the benchmark's linear layouts
+	inline void JacobiRow(const float *row, const float *up, const float *down, const float *front, const float *back,
+						  const float *b, float *out, int width, float alpha, float invBeta)
+	{
+		const __m128 alpha4 = _mm_set1_ps(alpha);
+		const __m128 invBeta4 = _mm_set1_ps(invBeta);
+
+		out[0] = (row[0] + row[width > 1 ? 1 : 0] + up[0] + down[0] + front[0] + back[0] + alpha*b[0]) * invBeta;
+
+		int c = 1;
+		for (; c + 4 < width; c += 4)
+		{
+			__m128 sum = _mm_add_ps(
+				_mm_add_ps(_mm_loadu_ps(row + c-1), _mm_loadu_ps(row + c+1)),
+				_mm_add_ps(_mm_loadu_ps(up + c), _mm_loadu_ps(down + c)));
+			sum = _mm_add_ps(sum, _mm_add_ps(_mm_loadu_ps(front + c), _mm_loadu_ps(back + c)));
+			sum = _mm_add_ps(sum, _mm_mul_ps(alpha4, _mm_loadu_ps(b + c)));
+			_mm_storeu_ps(out + c, _mm_mul_ps(sum, invBeta4));
+		}
+		for (; c < width; c++)
+		{
+			float right = row[c < width-1 ? c+1 : c];
+			out[c] = (row[c-1] + right + up[c] + down[c] + front[c] + back[c] + alpha*b[c]) * invBeta;
+		}
+	}
+
+	/// x fastest, then y, then z
+	struct LinearLayout
+	{
+		int width, height, depth;
+
+		LinearLayout(int w, int h, int d) : width(w), height(h), depth(d) {}
+
+		inline int Index(int x, int y, int z) const { return x + width * (y + height * z); }
+	};
+
+	/// The slices tiled 8 to a row of a 2d atlas, as Fluid3D::Index
+	struct SlabLayout
+	{
+		static const int SlicesPerRow = 8;
+		int width, height, depth;
+
+		SlabLayout(int w, int h, int d) : width(w), height(h), depth(d) {}
+
+		inline int Index(int x, int y, int z) const
+		{
+			return x + SlicesPerRow * width * y + (z % SlicesPerRow) * width + (z / SlicesPerRow) * SlicesPerRow * width * height;
+		}
+	};
+
+	/// Where the benchmarks sample each cell from - a vortex around z, drifting down it
+	inline void BenchmarkTrace(int x, int y, int z, int resolution, float &sx, float &sy, float &sz)
+	{
+		const float half = 0.5f * resolution;
+		sx = x + 0.5f + 4.f * (y + 0.5f - half) / resolution;
+		sy = y + 0.5f - 4.f * (x + 0.5f - half) / resolution;
+		sz = z + 0.5f - 0.7f;
+	}
+
+	template <class Layout>
+	double LayoutJacobi(const Layout &layout, const float *x, const float *b, float *out, float alpha, float invBeta)
+	{
+		const int height = layout.height;
+		const int depth = layout.depth;
+		const int rows = height * depth;
+		double change = 0;
+
+		#pragma omp parallel for reduction(+:change)
+		for (int r = 0; r < rows; r++)
+		{
+			int y = r % height, z = r / height;
+			const int row = layout.Index(0, y, z);
+			const float *up = x + layout.Index(0, y < height-1 ? y+1 : y, z);
+			const float *down = x + layout.Index(0, y > 0 ? y-1 : y, z);
+			const float *front = x + layout.Index(0, y, z < depth-1 ? z+1 : z);
+			const float *back = x + layout.Index(0, y, z > 0 ? z-1 : z);
+
+			JacobiRow(x + row, up, down, front, back, b + row, out + row, layout.width, alpha, invBeta);
+			change += SquaredChange(x + row, out + row, layout.width);
+		}
+		return change;
+	}
+
+	template <class Layout>
+	inline float LayoutTrilerp(const Layout &layout, const float *data, float sx, float sy, float sz)
+	{
+		sx -= 0.5f; sy -= 0.5f; sz -= 0.5f;
+		int x = BrickedField::Floor(sx), y = BrickedField::Floor(sy), z = BrickedField::Floor(sz);
+		float tx = sx - x, ty = sy - y, tz = sz - z;
+		int x0 = CPUField::Clamp(x, layout.width), x1 = CPUField::Clamp(x+1, layout.width);
+		int y0 = CPUField::Clamp(y, layout.height), y1 = CPUField::Clamp(y+1, layout.height);
+		int z0 = CPUField::Clamp(z, layout.depth), z1 = CPUField::Clamp(z+1, layout.depth);
+
+		const int base = layout.Index(x0, y0, z0);
+		const float *c = data + base;
+		const int dx = x1 - x0;
+		const int dy = layout.Index(x0, y1, z0) - base;
+		const int dz = layout.Index(x0, y0, z1) - base;
+
+		float c00 = c[0] + (c[dz] - c[0]) * tz;
+		float c01 = c[dy] + (c[dy + dz] - c[dy]) * tz;
+		float c10 = c[dx] + (c[dx + dz] - c[dx]) * tz;
+		float c11 = c[dx + dy] + (c[dx + dy + dz] - c[dx + dy]) * tz;
+		float c0 = c00 + (c10 - c00) * tx;
+		float c1 = c01 + (c11 - c01) * tx;
+		return c0 + (c1 - c0) * ty;
+	}
+
+	template <class Layout>
+	void LayoutSample(const Layout &layout, const float *data, float *out)
+	{
+		const int height = layout.height;
+		const int rows = height * layout.depth;
+
+		#pragma omp parallel for
+		for (int r = 0; r < rows; r++)
+		{
+			int y = r % height, z = r / height;
+			float *row = out + layout.Index(0, y, z);
+			for (int x = 0; x < layout.width; x++)
+			{
+				float sx, sy, sz;
+				BenchmarkTrace(x, y, z, layout.width, sx, sy, sz);
+				row[x] = LayoutTrilerp(layout, data, sx, sy, sz);
+			}
+		}
+	}
+
+	/// Times 'iterations' jacobi iterations and samplings of a layout, returning cells per second of each
+	template <class Layout>
+	void BenchmarkLayout(const Layout &layout, int iterations, double &jacobi, double &sampling)
+	{
+		const int size = layout.width * layout.height * layout.depth;
+		float *x = (float*)_mm_malloc(sizeof(float) * size, 16);
+		float *b = (float*)_mm_malloc(sizeof(float) * size, 16);
+		float *out = (float*)_mm_malloc(sizeof(float) * size, 16);
+		for (int i = 0; i < size; i++)
+		{
+			x[i] = 0;
+			b[i] = (float)((i * 7919) % 1000) / 1000.f - 0.5f;
+		}
+
+		double start = Seconds();
+		for (int i = 0; i < iterations; i++)
+		{
+			LayoutJacobi(layout, x, b, out, -1.f, 1.f / 6.f);
+			swap(x, out);
+		}
+		double elapsed = Seconds() - start;
+		jacobi = elapsed > 0 ? (double)iterations * size / elapsed : 0;
+
+		start = Seconds();
+		for (int i = 0; i < iterations; i++)
+		{
+			LayoutSample(layout, x, out);
+			swap(x, out);
+		}
+		elapsed = Seconds() - start;
+		sampling = elapsed > 0 ? (double)iterations * size / elapsed : 0;
+
+		_mm_free(x);
+		_mm_free(b);
+		_mm_free(out);
+	}
+}
+
+BrickedField::BrickedField() :
+mData(0), mWidth(0), mHeight(0), mDepth(0), mBricksX(0), mBricksY(0), mBricksZ(0)
+{
+}
+
+BrickedField::~BrickedField()
+{
+	Free();
+}
+
+void BrickedField::Free()
+{
+	if (mData) _mm_free(mData);
+	mData = 0;
+}
+
+void BrickedField::Resize(int width, int height, int depth)
+{
+	Free();
+	mWidth = width;
+	mHeight = height;
+	mDepth = depth;
+	mBricksX = width >> BrickShift;
+	mBricksY = height >> BrickShift;
+	mBricksZ = depth >> BrickShift;
+
+	//Morton order, skipping the codes outside the grid when it isn't a power of 2 cube
+	const int bricks = mBricksX * mBricksY * mBricksZ;
+	mBrickOrder.resize(bricks);
+	for (int i = 0; i < bricks; i++) mBrickOrder[i] = i;
+	sort(mBrickOrder.begin(), mBrickOrder.end(), MortonLess(mBricksX, mBricksY));
+
+	mBrickStart.resize(bricks);
+	for (int i = 0; i < bricks; i++) mBrickStart[mBrickOrder[i]] = i * BrickCells;
+
+	mData = (float*)_mm_malloc(sizeof(float) * Size(), 16);
+	Zero();
+}
+
+void BrickedField::Zero()
+{
+	if (mData) memset(mData, 0, sizeof(float) * Size());
+}
+
+void BrickedField::CopyFrom(const CPUField &field)
+{
+	const int rows = mHeight * mDepth;
+
+	#pragma omp parallel for
+	for (int r = 0; r < rows; r++)
+	{
+		int y = r % mHeight, z = r / mHeight;
+		const float *from = field.Cell(0, y, z);
+		const int pitch = field.CellPitch();
+
+		//a brick's worth of the row at a time
+		for (int x = 0; x < mWidth; x += BrickSize)
+		{
+			float *to = Cell(x, y, z);
+			for (int i = 0; i < BrickSize; i++) to[i] = from[(x + i) * pitch];
+		}
+	}
+}
+
+void BrickedField::CopyTo(CPUField &field) const
+{
+	const int rows = mHeight * mDepth;
+
+	#pragma omp parallel for
+	for (int r = 0; r < rows; r++)
+	{
+		int y = r % mHeight, z = r / mHeight;
+		float *to = field.Cell(0, y, z);
+		const int pitch = field.CellPitch();
+
+		for (int x = 0; x < mWidth; x += BrickSize)
+		{
+			const float *from = Cell(x, y, z);
+			for (int i = 0; i < BrickSize; i++) to[(x + i) * pitch] = from[i];
+		}
+	}
+}
+
+void BrickedField::Swap(BrickedField &other)
+{
+	swap(mData, other.mData);
+	swap(mWidth, other.mWidth);
+	swap(mHeight, other.mHeight);
+	swap(mDepth, other.mDepth);
+	swap(mBricksX, other.mBricksX);
+	swap(mBricksY, other.mBricksY);
+	swap(mBricksZ, other.mBricksZ);
+	mBrickStart.swap(other.mBrickStart);
+	mBrickOrder.swap(other.mBrickOrder);
+}
+
+double BrickedField::Jacobi(const BrickedField &x, const BrickedField &b, float alpha, float beta)
+{
+	const int bricks = x.Bricks();
+	const int row = BrickSize;
+	const int slice = BrickSize * BrickSize;
+	const float invBeta = 1.f / beta;
+	const __m128 alpha4 = _mm_set1_ps(alpha);
+	const __m128 invBeta4 = _mm_set1_ps(invBeta);
+	double change = 0;
+
+	#pragma omp parallel for reduction(+:change)
+	for (int i = 0; i < bricks; i++)
+	{
+		const int brick = x.mBrickOrder[i];
+		const int bx = brick % x.mBricksX;
+		const int by = (brick / x.mBricksX) % x.mBricksY;
+		const int bz = brick / (x.mBricksX * x.mBricksY);
+		const int stepY = x.mBricksX, stepZ = x.mBricksX * x.mBricksY;
+
+		const float *in = x.Brick(i);
+		const float *rhs = b.Brick(i);
+		float *out = Brick(i);
+		__m128 squares = _mm_setzero_ps();
+
+		//where the cells past each face of the brick start - in the brick next to it, or at the faces
+		//of the grid the brick's own edge cells, as they clamp to themselves. Cell r's neighbour
+		//across the left face is left[r], across the front face front[r % slice], and so on.
+		const float *data = x.mData;
+		const float *left = bx > 0 ? data + x.mBrickStart[brick - 1] + BrickSize-1 : in;
+		const float *right = bx < x.mBricksX-1 ? data + x.mBrickStart[brick + 1] : in + BrickSize-1;
+		const float *down = by > 0 ? data + x.mBrickStart[brick - stepY] + (BrickSize-1) * row : in;
+		const float *up = by < x.mBricksY-1 ? data + x.mBrickStart[brick + stepY] : in + (BrickSize-1) * row;
+		const float *back = bz > 0 ? data + x.mBrickStart[brick - stepZ] + (BrickSize-1) * slice : in;
+		const float *front = bz < x.mBricksZ-1 ? data + x.mBrickStart[brick + stepZ] : in + (BrickSize-1) * slice;
+
+		for (int z = 0; z < BrickSize; z++)
+		{
+			for (int y = 0; y < BrickSize; y++)
+			{
+				const int r = z * slice + y * row;
+				const float *cells = in + r;
+				const float *rowUp = y < BrickSize-1 ? cells + row : up + z * slice;
+				const float *rowDown = y > 0 ? cells - row : down + z * slice;
+				const float *rowFront = z < BrickSize-1 ? cells + slice : front + y * row;
+				const float *rowBack = z > 0 ? cells - slice : back + y * row;
+
+				//the row is 2 registers, with the cells past its ends from the bricks either side
+				__m128 a = _mm_load_ps(cells), c = _mm_load_ps(cells + 4);
+				__m128 previous = _mm_set_ss(left[r]);
+				__m128 next = _mm_set_ss(right[r]);
+
+				__m128 sumA = _mm_add_ps(F4ShiftRight(a, previous), F4ShiftLeft(a, c));
+				__m128 sumC = _mm_add_ps(F4ShiftRight(c, _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 3, 3))), F4ShiftLeft(c, next));
+
+				sumA = _mm_add_ps(sumA, _mm_add_ps(_mm_load_ps(rowUp), _mm_load_ps(rowDown)));
+				sumC = _mm_add_ps(sumC, _mm_add_ps(_mm_load_ps(rowUp + 4), _mm_load_ps(rowDown + 4)));
+				sumA = _mm_add_ps(sumA, _mm_add_ps(_mm_load_ps(rowFront), _mm_load_ps(rowBack)));
+				sumC = _mm_add_ps(sumC, _mm_add_ps(_mm_load_ps(rowFront + 4), _mm_load_ps(rowBack + 4)));
+				sumA = _mm_add_ps(sumA, _mm_mul_ps(alpha4, _mm_load_ps(rhs + r)));
+				sumC = _mm_add_ps(sumC, _mm_mul_ps(alpha4, _mm_load_ps(rhs + r + 4)));
+
+				sumA = _mm_mul_ps(sumA, invBeta4);
+				sumC = _mm_mul_ps(sumC, invBeta4);
+				_mm_store_ps(out + r, sumA);
+				_mm_store_ps(out + r + 4, sumC);
+
+				a = _mm_sub_ps(sumA, a);
+				c = _mm_sub_ps(sumC, c);
+				squares = _mm_add_ps(squares, _mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(c, c)));
+			}
+		}
+
+		change += F4Sum(squares);
+	}
+
+	return change;
+}
+
+void BrickedField::BenchmarkLayouts(int resolution, int iterations, double jacobi[3], double sampling[3])
+{
+	BenchmarkLayout(LinearLayout(resolution, resolution, resolution), iterations, jacobi[0], sampling[0]);
+	BenchmarkLayout(SlabLayout(resolution, resolution, resolution), iterations, jacobi[1], sampling[1]);
+
+	BrickedField x, b, out;
+	x.Resize(resolution, resolution, resolution);
+	b.Resize(resolution, resolution, resolution);
+	out.Resize(resolution, resolution, resolution);
+
+	//the same right hand side as the other layouts, cell for cell
+	LinearLayout linear(resolution, resolution, resolution);
+	for (int z = 0; z < resolution; z++)
+	{
+		for (int y = 0; y < resolution; y++)
+		{
+			for (int i = 0; i < resolution; i++)
+			{
+				*b.Cell(i, y, z) = (float)((linear.Index(i, y, z) * 7919) % 1000) / 1000.f - 0.5f;
+			}
+		}
+	}
+
+	const int size = x.Size();
+	double start = Seconds();
+	for (int i = 0; i < iterations; i++)
+	{
+		out.Jacobi(x, b, -1.f, 6.f);
+		x.Swap(out);
+	}
+	double elapsed = Seconds() - start;
+	jacobi[2] = elapsed > 0 ? (double)iterations * size / elapsed : 0;
+
+	//the samples are written in the bricks' order, as an advection pass would
+	const int bricks = x.Bricks();
+	start = Seconds();
+	for (int i = 0; i < iterations; i++)
+	{
+		#pragma omp parallel for
+		for (int n = 0; n < bricks; n++)
+		{
+			const int brick = x.mBrickOrder[n];
+			const int bx = (brick % x.mBricksX) << BrickShift;
+			const int by = ((brick / x.mBricksX) % x.mBricksY) << BrickShift;
+			const int bz = (brick / (x.mBricksX * x.mBricksY)) << BrickShift;
+			float *cells = out.Brick(n);
+
+			for (int c = 0; c < BrickCells; c++)
+			{
+				float sx, sy, sz;
+				BenchmarkTrace(bx + (c & (BrickSize-1)), by + ((c >> BrickShift) & (BrickSize-1)), bz + (c >> (2*BrickShift)),
+					resolution, sx, sy, sz);
+				cells[c] = x.Trilerp(sx, sy, sz);
+			}
+		}
+		x.Swap(out);
+	}
+	elapsed = Seconds() - start;
+	sampling[2] = elapsed > 0 ? (double)iterations * size / elapsed : 0;
+}
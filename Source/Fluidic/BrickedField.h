@@ -0,0 +1,195 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "CPUField.h"
+
+namespace Fluidic
+{
+	/**
+	 * \brief A 1 component 3d field stored in 8x8x8 bricks, for stencils that reach across slices.
+	 *
+	 * In a CPUField (and in the slab atlas of Fluid3D) the z neighbours of a cell are a whole slice
+	 * away, so a 7 point stencil touches 3 slices' worth of memory at once. Here each brick is 512
+	 * contiguous floats (2KB, x fastest), and the bricks follow each other in Morton order, so the
+	 * neighbours are nearly always in the same brick, and the bricks next to it are mostly close by
+	 * in memory as well.
+	 *
+	 * The dimensions must be multiples of 8 (see Fits). Lookups past the faces clamp to the edge,
+	 * like CPUField::ClampedCell.
+	 */
+	class BrickedField
+	{
+	public:
+		static const int BrickShift = 3;
+		static const int BrickSize = 1 << BrickShift;
+		static const int BrickCells = BrickSize * BrickSize * BrickSize;
+
+		BrickedField();
+		~BrickedField();
+
+		/// True if a grid can be bricked - every dimension a multiple of BrickSize
+		static bool Fits(int width, int height, int depth)
+		{
+			return width > 0 && height > 0 && depth > 0 &&
+				width % BrickSize == 0 && height % BrickSize == 0 && depth % BrickSize == 0;
+		}
+
+		/// Reallocates the field (which has to Fit) and orders the bricks. The contents are zeroed.
+		void Resize(int width, int height, int depth);
+
+		/// Sets every cell to 0
+		void Zero();
+
+		/// Copies the first component of a field with the same dimensions, ghost cells aside
+		void CopyFrom(const CPUField &field);
+
+		/// Copies the cells into the first component of a field with the same dimensions
+		void CopyTo(CPUField &field) const;
+
+		/// Swaps storage with another field
+		void Swap(BrickedField &other);
+
+		/**
+		 * \brief One jacobi iteration of (x[left] + x[right] + ... + alpha*b) / beta into this field.
+		 *
+		 * The bricks are done in parallel, each with the faces of the bricks next to it, and the rows
+		 * of a brick 4 cells at a time.
+		 * @return the sum of the squared changes from x
+		 */
+		double Jacobi(const BrickedField &x, const BrickedField &b, float alpha, float beta);
+
+		/**
+		 * \brief Trilinear interpolation at texture coordinates s (cell centres at +0.5), as F4Trilerp
+		 *
+		 * When the 8 corners share a brick (most of the time) they're a cell, a row and a slice of it
+		 * apart. Otherwise each corner finds its own brick, with the coordinates clamped first.
+		 */
+		inline float Trilerp(float sx, float sy, float sz) const
+		{
+			sx -= 0.5f; sy -= 0.5f; sz -= 0.5f;
+			int x = Floor(sx), y = Floor(sy), z = Floor(sz);
+			float tx = sx - x, ty = sy - y, tz = sz - z;
+
+			const int mask = BrickSize - 1;
+			const int dy = BrickSize, dz = BrickSize * BrickSize;
+			float c[8];
+			if ((unsigned)x < (unsigned)mWidth && (unsigned)y < (unsigned)mHeight && (unsigned)z < (unsigned)mDepth &&
+				(x & mask) != mask && (y & mask) != mask && (z & mask) != mask)
+			{
+				const float *base = Cell(x, y, z);
+				c[0] = base[0]; c[1] = base[1]; c[2] = base[dy]; c[3] = base[dy + 1];
+				c[4] = base[dz]; c[5] = base[dz + 1]; c[6] = base[dz + dy]; c[7] = base[dz + dy + 1];
+			}
+			else
+			{
+				//the brick and the offset in it along each axis, for both corners
+				int x0 = CPUField::Clamp(x, mWidth), x1 = CPUField::Clamp(x+1, mWidth);
+				int y0 = CPUField::Clamp(y, mHeight), y1 = CPUField::Clamp(y+1, mHeight);
+				int z0 = CPUField::Clamp(z, mDepth), z1 = CPUField::Clamp(z+1, mDepth);
+				int bx[2] = { x0 >> BrickShift, x1 >> BrickShift };
+				int by[2] = { mBricksX * (y0 >> BrickShift), mBricksX * (y1 >> BrickShift) };
+				int bz[2] = { mBricksX * mBricksY * (z0 >> BrickShift), mBricksX * mBricksY * (z1 >> BrickShift) };
+				int ox[2] = { x0 & mask, x1 & mask };
+				int oy[2] = { dy * (y0 & mask), dy * (y1 & mask) };
+				int oz[2] = { dz * (z0 & mask), dz * (z1 & mask) };
+
+				for (int i = 0; i < 8; i++)
+				{
+					int cx = i & 1, cy = (i >> 1) & 1, cz = i >> 2;
+					c[i] = mData[mBrickStart[bx[cx] + by[cy] + bz[cz]] + oz[cz] + oy[cy] + ox[cx]];
+				}
+			}
+
+			float c00 = c[0] + (c[4] - c[0]) * tz;
+			float c01 = c[2] + (c[6] - c[2]) * tz;
+			float c10 = c[1] + (c[5] - c[1]) * tz;
+			float c11 = c[3] + (c[7] - c[3]) * tz;
+			float c0 = c00 + (c10 - c00) * tx;
+			float c1 = c01 + (c11 - c01) * tx;
+			return c0 + (c1 - c0) * ty;
+		}
+
+		/**
+		 * \brief Times the 3d layouts on a resolution^3 grid (a multiple of 8), for comparing them.
+		 *
+		 * Runs 'iterations' jacobi iterations and trilinear samplings of every cell on a linear
+		 * CPUField, Fluid3D's slab atlas and a BrickedField, as cells per second.
+		 * @param jacobi results for the linear, slab atlas and bricked layouts, in that order
+		 * @param sampling as jacobi
+		 */
+		static void BenchmarkLayouts(int resolution, int iterations, double jacobi[3], double sampling[3]);
+
+		/// floorf, as an int - the conversion is much cheaper than the library call
+		static inline int Floor(float f)
+		{
+			int i = (int)f;
+			return f < i ? i - 1 : i;
+		}
+
+		/// Index of a cell inside the grid
+		inline int Index(int x, int y, int z) const
+		{
+			int brick = (x >> BrickShift) + mBricksX * ((y >> BrickShift) + mBricksY * (z >> BrickShift));
+			int mask = BrickSize - 1;
+			return mBrickStart[brick] + (((z & mask) << BrickShift | (y & mask)) << BrickShift | (x & mask));
+		}
+
+		inline float *Cell(int x, int y, int z) { return mData + Index(x, y, z); }
+		inline const float *Cell(int x, int y, int z) const { return mData + Index(x, y, z); }
+
+		inline const float *ClampedCell(int x, int y, int z) const
+		{
+			return Cell(CPUField::Clamp(x, mWidth), CPUField::Clamp(y, mHeight), CPUField::Clamp(z, mDepth));
+		}
+
+		/// The first cell of the i'th brick in memory
+		inline float *Brick(int i) { return mData + i * BrickCells; }
+		inline const float *Brick(int i) const { return mData + i * BrickCells; }
+
+		inline float *Data() { return mData; }
+		inline const float *Data() const { return mData; }
+
+		inline int Width() const { return mWidth; }
+		inline int Height() const { return mHeight; }
+		inline int Depth() const { return mDepth; }
+		inline int Bricks() const { return (int)mBrickOrder.size(); }
+
+		/// Number of floats in the field
+		inline int Size() const { return Bricks() * BrickCells; }
+
+	private:
+		BrickedField(const BrickedField &);
+		BrickedField &operator=(const BrickedField &);
+
+		void Free();
+
+		float *mData;
+		int mWidth, mHeight, mDepth;
+		int mBricksX, mBricksY, mBricksZ;
+		std::vector<int> mBrickStart; ///< first float of each brick, by its brick coordinates
+		std::vector<int> mBrickOrder; ///< brick coordinates (as for mBrickStart) of each brick in memory
+	};
+}
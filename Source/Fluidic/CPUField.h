@@ -0,0 +1,341 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <xmmintrin.h>
+#include <string.h>
+#include <algorithm>
+
+#include "FluidOptions.h"
+#include "HalfFloat.h"
+
+namespace Fluidic
+{
+	/**
+	 * \brief A grid of float cells used by the CPU solvers - the CPU equivalent of a solver texture.
+	 *
+	 * Components are interleaved per cell like the GPU textures (so a 4 component cell is one RGBA
+	 * texel) and rows are contiguous in x. The memory is 16 byte aligned, so a 4 component cell can be
+	 * loaded straight into an SSE register.
+	 *
+	 * A FL_PLANAR field keeps each component in a plane of its own instead, so a pass over one
+	 * component only streams that plane, and a row of it is 4 cells to a register. Cell points at
+	 * the first component then, and component c is ComponentPitch() * c floats on.
+	 *
+	 * A field can be padded with ghost cells around its edges (in z too for 3d fields). Cell takes
+	 * coordinates from -Ghost() to size+Ghost()-1 then, and once FillGhosts has run the ghosts hold
+	 * what ClampedCell would give, so stencils can read past the edge without clamping.
+	 *
+	 * An FP_HALF field stores each float as a half, to save memory and bandwidth. It has no Data()
+	 * or Cell() pointers - the kernels read and write it by Index, through F4Load and F4Store, which
+	 * convert to and from floats so the arithmetic stays fp32. CopyFrom converts between the two.
+	 */
+	class CPUField
+	{
+	public:
+		CPUField() : mData(0), mHalfData(0), mWidth(0), mHeight(0), mDepth(0), mComponents(0), mGhost(0), mLayout(FL_INTERLEAVED),
+			mPrecision(FP_SINGLE), mCellPitch(0), mRowPitch(0), mSlicePitch(0), mPlaneSize(0), mComponentPitch(0), mOrigin(0) {}
+		~CPUField() { Free(); }
+
+		/**
+		 * \brief Reallocates the field. The contents are zeroed.
+		 *
+		 * @param width cells in x
+		 * @param height cells in y
+		 * @param depth cells in z (1 for 2d fields)
+		 * @param components floats per cell (1 to 4)
+		 * @param ghost layers of ghost cells around the edges
+		 * @param layout whether the components are interleaved or in planes
+		 * @param precision FP_HALF for halves (without ghost cells), otherwise floats
+		 */
+		void Resize(int width, int height, int depth, int components, int ghost = 0, FieldLayout layout = FL_INTERLEAVED,
+					FieldPrecision precision = FP_SINGLE)
+		{
+			Free();
+			mWidth = width;
+			mHeight = height;
+			mDepth = depth;
+			mComponents = components;
+			mGhost = ghost;
+			mLayout = layout;
+			mPrecision = precision == FP_HALF ? FP_HALF : FP_SINGLE;
+			mCellPitch = layout == FL_PLANAR ? 1 : components;
+			mRowPitch = mCellPitch * (width + 2*ghost);
+			mSlicePitch = mRowPitch * (height + 2*ghost);
+			mPlaneSize = mSlicePitch * (depth > 1 ? depth + 2*ghost : depth);
+			if (layout == FL_PLANAR) mPlaneSize = (mPlaneSize + 3) & ~3; //so every plane is 16 byte aligned
+			mComponentPitch = layout == FL_PLANAR ? mPlaneSize : 1;
+			mOrigin = ghost * (mCellPitch + mRowPitch + (depth > 1 ? mSlicePitch : 0));
+			if (Half()) mHalfData = (unsigned short*)_mm_malloc(sizeof(unsigned short) * Size(), 16);
+			else mData = (float*)_mm_malloc(sizeof(float) * Size(), 16);
+			Zero();
+		}
+
+		/// Sets every cell to 0
+		void Zero()
+		{
+			if (mData) memset(mData, 0, sizeof(float) * Size());
+			if (mHalfData) memset(mHalfData, 0, sizeof(unsigned short) * Size());
+		}
+
+		/// Reallocates the field with the dimensions, components, ghost cells and layout of another, as floats
+		void ResizeLike(const CPUField &other)
+		{
+			Resize(other.mWidth, other.mHeight, other.mDepth, other.mComponents, other.mGhost, other.mLayout);
+		}
+
+		/// True if the field has the dimensions, components and layout of another (ghost cells and precision aside)
+		bool SameShape(const CPUField &other) const
+		{
+			return mWidth == other.mWidth && mHeight == other.mHeight && mDepth == other.mDepth &&
+				mComponents == other.mComponents && mLayout == other.mLayout;
+		}
+
+		/**
+		 * \brief Copies the contents of a field with the same dimensions. If only one has ghost cells,
+		 * they're left alone. The layouts can differ, but that's a component at a time, and only
+		 * the components both fields have. Halves are converted to and from floats a row at a time.
+		 */
+		void CopyFrom(const CPUField &other)
+		{
+			if (other.mGhost == mGhost && other.mLayout == mLayout && other.mPrecision == mPrecision)
+			{
+				if (Half()) memcpy(mHalfData, other.mHalfData, sizeof(unsigned short) * Size());
+				else memcpy(mData, other.mData, sizeof(float) * Size());
+				return;
+			}
+
+			if (other.mLayout == mLayout && (Half() || other.Half()))
+			{
+				const int count = mCellPitch * mWidth;
+				for (int p = 0; p < Planes(); p++)
+				{
+					for (int z = 0; z < mDepth; z++)
+					{
+						for (int y = 0; y < mHeight; y++)
+						{
+							const int to = Index(0, y, z) + p * mComponentPitch;
+							const int from = other.Index(0, y, z) + p * other.mComponentPitch;
+							if (!Half()) HalfToFloats(other.mHalfData + from, mData + to, count);
+							else if (!other.Half()) FloatsToHalves(other.mData + from, mHalfData + to, count);
+							else memcpy(mHalfData + to, other.mHalfData + from, sizeof(unsigned short) * count);
+						}
+					}
+				}
+				return;
+			}
+
+			if (other.mLayout == mLayout)
+			{
+				for (int p = 0; p < Planes(); p++)
+				{
+					for (int z = 0; z < mDepth; z++)
+					{
+						for (int y = 0; y < mHeight; y++)
+						{
+							memcpy(Cell(0, y, z) + p * mComponentPitch, other.Cell(0, y, z) + p * other.mComponentPitch,
+								   sizeof(float) * mCellPitch * mWidth);
+						}
+					}
+				}
+				return;
+			}
+
+			const int components = std::min(mComponents, other.mComponents);
+			for (int z = 0; z < mDepth; z++)
+			{
+				for (int y = 0; y < mHeight; y++)
+				{
+					for (int x = 0; x < mWidth; x++)
+					{
+						const int to = Index(x, y, z);
+						const int from = other.Index(x, y, z);
+						for (int c = 0; c < components; c++) SetValue(to + c * mComponentPitch, other.Value(from + c * other.mComponentPitch));
+					}
+				}
+			}
+		}
+
+		/**
+		 * \brief Sets the ghost cells to the edge cells they're next to.
+		 *
+		 * This is the halo update for padded fields, so only the edges are visited. The x ghosts of each
+		 * row go first, then whole padded rows are copied out in y (which fills the corners), then
+		 * whole padded slices in z. Planar fields do each plane in turn. (Half fields have no ghosts.)
+		 */
+		void FillGhosts()
+		{
+			if (!mGhost) return;
+
+			const int c = mCellPitch;
+			for (int p = 0; p < Planes(); p++)
+			{
+				float *plane = mData + p * mComponentPitch;
+				for (int z = 0; z < mDepth; z++)
+				{
+					for (int y = 0; y < mHeight; y++)
+					{
+						float *first = plane + Index(0, y, z);
+						float *last = plane + Index(mWidth-1, y, z);
+						for (int g = 1; g <= mGhost; g++)
+						{
+							memcpy(first - g*c, first, sizeof(float) * c);
+							memcpy(last + g*c, last, sizeof(float) * c);
+						}
+					}
+
+					for (int g = 1; g <= mGhost; g++)
+					{
+						memcpy(plane + Index(-mGhost, -g, z), plane + Index(-mGhost, 0, z), sizeof(float) * mRowPitch);
+						memcpy(plane + Index(-mGhost, mHeight-1+g, z), plane + Index(-mGhost, mHeight-1, z), sizeof(float) * mRowPitch);
+					}
+				}
+
+				if (mDepth > 1)
+				{
+					for (int g = 1; g <= mGhost; g++)
+					{
+						memcpy(plane + Index(-mGhost, -mGhost, -g), plane + Index(-mGhost, -mGhost, 0), sizeof(float) * mSlicePitch);
+						memcpy(plane + Index(-mGhost, -mGhost, mDepth-1+g), plane + Index(-mGhost, -mGhost, mDepth-1), sizeof(float) * mSlicePitch);
+					}
+				}
+			}
+		}
+
+		/// Swaps storage with another field - the CPU version of swapping textures after a pass
+		void Swap(CPUField &other)
+		{
+			std::swap(mData, other.mData);
+			std::swap(mHalfData, other.mHalfData);
+			std::swap(mWidth, other.mWidth);
+			std::swap(mHeight, other.mHeight);
+			std::swap(mDepth, other.mDepth);
+			std::swap(mComponents, other.mComponents);
+			std::swap(mGhost, other.mGhost);
+			std::swap(mLayout, other.mLayout);
+			std::swap(mPrecision, other.mPrecision);
+			std::swap(mCellPitch, other.mCellPitch);
+			std::swap(mRowPitch, other.mRowPitch);
+			std::swap(mSlicePitch, other.mSlicePitch);
+			std::swap(mPlaneSize, other.mPlaneSize);
+			std::swap(mComponentPitch, other.mComponentPitch);
+			std::swap(mOrigin, other.mOrigin);
+		}
+
+		inline int Index(int x, int y) const { return mOrigin + mCellPitch * x + mRowPitch * y; }
+		inline int Index(int x, int y, int z) const { return mOrigin + mCellPitch * x + mRowPitch * y + mSlicePitch * z; }
+
+		/// Index of the cell numbered x + Width() * (y + Height() * z), as an unpadded field numbers them
+		inline int CellIndex(int cell) const
+		{
+			if (!mGhost) return mCellPitch * cell;
+
+			const int yz = cell / mWidth;
+			return Index(cell - yz * mWidth, yz % mHeight, yz / mHeight);
+		}
+
+		inline float *Cell(int x, int y) { return mData + Index(x, y); }
+		inline const float *Cell(int x, int y) const { return mData + Index(x, y); }
+		inline float *Cell(int x, int y, int z) { return mData + Index(x, y, z); }
+		inline const float *Cell(int x, int y, int z) const { return mData + Index(x, y, z); }
+
+		inline int ClampedIndex(int x, int y) const { return Index(Clamp(x, mWidth), Clamp(y, mHeight)); }
+		inline int ClampedIndex(int x, int y, int z) const { return Index(Clamp(x, mWidth), Clamp(y, mHeight), Clamp(z, mDepth)); }
+
+		/// Returns the cell at the given coordinates, clamped to the edge (like GL_CLAMP texture lookups)
+		inline const float *ClampedCell(int x, int y) const
+		{
+			return Cell(Clamp(x, mWidth), Clamp(y, mHeight));
+		}
+		inline const float *ClampedCell(int x, int y, int z) const
+		{
+			return Cell(Clamp(x, mWidth), Clamp(y, mHeight), Clamp(z, mDepth));
+		}
+
+		/// The floats of the field - with ghost cells, from the first ghost rather than from cell (0, 0, 0). 0 for FP_HALF
+		inline float *Data() { return mData; }
+		inline const float *Data() const { return mData; }
+
+		/// The halves of an FP_HALF field, laid out as Data() would be. 0 for FP_SINGLE
+		inline unsigned short *HalfData() { return mHalfData; }
+		inline const unsigned short *HalfData() const { return mHalfData; }
+
+		/// One float of the field by its index, whatever the precision - for the odd value, not whole passes
+		inline float Value(int index) const { return Half() ? HalfToFloat(mHalfData[index]) : mData[index]; }
+		inline void SetValue(int index, float value)
+		{
+			if (Half()) mHalfData[index] = FloatToHalf(value);
+			else mData[index] = value;
+		}
+
+		inline int Width() const { return mWidth; }
+		inline int Height() const { return mHeight; }
+		inline int Depth() const { return mDepth; }
+		inline int Components() const { return mComponents; }
+		inline int Ghost() const { return mGhost; }
+		inline FieldLayout Layout() const { return mLayout; }
+		inline bool Planar() const { return mLayout == FL_PLANAR; }
+		inline FieldPrecision Precision() const { return mPrecision; }
+		inline bool Half() const { return mPrecision == FP_HALF; }
+
+		/// Floats from one cell to the next in x
+		inline int CellPitch() const { return mCellPitch; }
+		/// Floats from one component of a cell to the next - 1, or a whole plane for FL_PLANAR
+		inline int ComponentPitch() const { return mComponentPitch; }
+		/// Interleaved fields are one plane of every component, planar ones a plane per component
+		inline int Planes() const { return mLayout == FL_PLANAR ? mComponents : 1; }
+
+		/// Floats from one row to the next
+		inline int RowPitch() const { return mRowPitch; }
+		/// Floats from one slice to the next
+		inline int SlicePitch() const { return mSlicePitch; }
+
+		/// Number of floats (or halves) in the field, ghost cells included
+		inline int Size() const { return mPlaneSize * Planes(); }
+
+		static inline int Clamp(int v, int res) { return v < 0 ? 0 : (v >= res ? res-1 : v); }
+
+	private:
+		CPUField(const CPUField &);
+		CPUField &operator=(const CPUField &);
+
+		void Free()
+		{
+			if (mData) _mm_free(mData);
+			if (mHalfData) _mm_free(mHalfData);
+			mData = 0;
+			mHalfData = 0;
+		}
+
+		float *mData;
+		unsigned short *mHalfData; ///< in place of mData for FP_HALF
+		int mWidth, mHeight, mDepth;
+		int mComponents;
+		int mGhost;
+		FieldLayout mLayout;
+		FieldPrecision mPrecision; ///< FP_SINGLE or FP_HALF
+		int mCellPitch, mRowPitch, mSlicePitch; ///< in floats
+		int mPlaneSize, mComponentPitch; ///< in floats
+		int mOrigin; ///< index of cell (0, 0, 0)
+	};
+}
@@ -0,0 +1,303 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <math.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+#include "CPUField.h"
+
+#ifdef _OPENMP
+	#include <omp.h>
+#else
+	#include <time.h>
+#endif
+
+namespace Fluidic
+{
+	/// Seconds from some fixed point, for timing the kernels
+	inline double Seconds()
+	{
+#ifdef _OPENMP
+		return omp_get_wtime();
+#else
+		return (double)clock() / CLOCKS_PER_SEC;
+#endif
+	}
+
+	/// Adds the 4 floats together
+	inline float F4Sum(__m128 a)
+	{
+		float f[4];
+		_mm_storeu_ps(f, a);
+		return f[0] + f[1] + f[2] + f[3];
+	}
+
+	/// Sum of the squares of every float in a field, leaving out any ghost cells
+	inline double SumOfSquares(const CPUField &field)
+	{
+		double sum = 0;
+
+		if (field.Ghost())
+		{
+			const int height = field.Height();
+			const int rows = height * field.Depth();
+			const int count = field.Width() * field.CellPitch();
+
+			for (int p = 0; p < field.Planes(); p++)
+			{
+				const float *plane = field.Data() + p * field.ComponentPitch();
+
+				#pragma omp parallel for reduction(+:sum)
+				for (int r = 0; r < rows; r++)
+				{
+					const float *row = plane + field.Index(0, r % height, r / height);
+					for (int i = 0; i < count; i++)
+					{
+						sum += row[i] * row[i];
+					}
+				}
+			}
+			return sum;
+		}
+
+		const int count = field.Size();
+		const float *data = field.Data();
+
+		#pragma omp parallel for reduction(+:sum)
+		for (int i = 0; i < count; i++)
+		{
+			sum += data[i] * data[i];
+		}
+		return sum;
+	}
+
+	/// Sum of (after - before)^2 over count floats
+	inline double SquaredChange(const float *before, const float *after, int count)
+	{
+		__m128 sum = _mm_setzero_ps();
+		int i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 d = _mm_sub_ps(_mm_loadu_ps(after + i), _mm_loadu_ps(before + i));
+			sum = _mm_add_ps(sum, _mm_mul_ps(d, d));
+		}
+
+		double total = F4Sum(sum);
+		for (; i < count; i++)
+		{
+			float d = after[i] - before[i];
+			total += d * d;
+		}
+		return total;
+	}
+
+	/**
+	 * Loads the components of a cell into a register. Planar fields gather them from the planes,
+	 * with any components the field doesn't have as 0.
+	 */
+	inline __m128 F4Load(const CPUField &field, const float *cell)
+	{
+		if (!field.Planar()) return _mm_load_ps(cell);
+
+		const int p = field.ComponentPitch();
+		const int c = field.Components();
+		return _mm_setr_ps(cell[0], c > 1 ? cell[p] : 0, c > 2 ? cell[2*p] : 0, c > 3 ? cell[3*p] : 0);
+	}
+
+	/// Stores a register to a cell, as F4Load loads it. Planar fields only take the components they have.
+	inline void F4Store(CPUField &field, float *cell, __m128 value)
+	{
+		if (!field.Planar())
+		{
+			_mm_store_ps(cell, value);
+			return;
+		}
+
+		float f[4];
+		_mm_storeu_ps(f, value);
+		const int p = field.ComponentPitch();
+		for (int c = 0; c < field.Components(); c++) cell[c*p] = f[c];
+	}
+
+	/**
+	 * F4Load for a cell given by its Index, which also reads FP_HALF fields. The kernels that work
+	 * on the ink load and store it this way, as it can be stored as halves.
+	 */
+	inline __m128 F4Load(const CPUField &field, int index)
+	{
+		if (!field.Half()) return F4Load(field, field.Data() + index);
+
+		const unsigned short *cell = field.HalfData() + index;
+		if (!field.Planar() && field.Components() == 4) return F4LoadHalf(cell);
+
+		const int p = field.ComponentPitch();
+		const int c = field.Components();
+		return _mm_setr_ps(HalfToFloat(cell[0]), c > 1 ? HalfToFloat(cell[p]) : 0, c > 2 ? HalfToFloat(cell[2*p]) : 0,
+						   c > 3 ? HalfToFloat(cell[3*p]) : 0);
+	}
+
+	/// F4Store for a cell given by its Index, as F4Load
+	inline void F4Store(CPUField &field, int index, __m128 value)
+	{
+		if (!field.Half())
+		{
+			F4Store(field, field.Data() + index, value);
+			return;
+		}
+
+		unsigned short *cell = field.HalfData() + index;
+		if (!field.Planar() && field.Components() == 4)
+		{
+			F4StoreHalf(cell, value);
+			return;
+		}
+
+		float f[4];
+		_mm_storeu_ps(f, value);
+		const int p = field.ComponentPitch();
+		for (int c = 0; c < field.Components(); c++) cell[c*p] = FloatToHalf(f[c]);
+	}
+
+	/// Linear interpolation of 4 floats: a + (b-a)*t
+	inline __m128 F4Lerp(__m128 a, __m128 b, __m128 t)
+	{
+		return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+	}
+
+	/// Rounds 4 floats down to whole numbers (there's no floor instruction before SSE4.1)
+	inline __m128 F4Floor(__m128 a)
+	{
+		__m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+		return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), _mm_set1_ps(1.f)));
+	}
+
+	/**
+	 * Finds the lower corner cell and the weights F4Bilerp/F4Trilerp use along one axis, for 4
+	 * positions at once. The corners aren't clamped to the field - the lookups do that.
+	 */
+	inline void F4LerpSetup(__m128 s, int *cell, float *t)
+	{
+		__m128 p = _mm_sub_ps(s, _mm_set1_ps(0.5f));
+		__m128 f = F4Floor(p);
+		_mm_storeu_si128((__m128i*)cell, _mm_cvttps_epi32(f));
+		_mm_storeu_ps(t, _mm_sub_ps(p, f));
+	}
+
+	/// F4Bilerp with the lower corner (x, y) and weights (tx, ty) already worked out
+	inline __m128 F4Bilerp(const CPUField &field, int x, int y, float tx, float ty)
+	{
+		__m128 tx4 = _mm_set1_ps(tx);
+		__m128 ty4 = _mm_set1_ps(ty);
+
+		int x0 = CPUField::Clamp(x, field.Width()), x1 = CPUField::Clamp(x+1, field.Width());
+		int y0 = CPUField::Clamp(y, field.Height()), y1 = CPUField::Clamp(y+1, field.Height());
+
+		__m128 tex11 = F4Load(field, field.Index(x0, y0));
+		__m128 tex21 = F4Load(field, field.Index(x1, y0));
+		__m128 tex12 = F4Load(field, field.Index(x0, y1));
+		__m128 tex22 = F4Load(field, field.Index(x1, y1));
+
+		return F4Lerp(F4Lerp(tex11, tex21, tx4), F4Lerp(tex12, tex22, tx4), ty4);
+	}
+
+	/**
+	 * Bilinear interpolation of a 4 component field at texture coordinates s (cell centres at +0.5).
+	 * Same as F4Bilerp in Utils.cg, with lookups clamped to the edge.
+	 */
+	inline __m128 F4Bilerp(const CPUField &field, float sx, float sy)
+	{
+		float fx = floorf(sx - 0.5f);
+		float fy = floorf(sy - 0.5f);
+		return F4Bilerp(field, (int)fx, (int)fy, sx - 0.5f - fx, sy - 0.5f - fy);
+	}
+
+	/// F4Trilerp with the lower corner (x, y, z) and weights (tx, ty, tz) already worked out
+	inline __m128 F4Trilerp(const CPUField &field, int x, int y, int z, float tx, float ty, float tz)
+	{
+		__m128 tx4 = _mm_set1_ps(tx);
+		__m128 ty4 = _mm_set1_ps(ty);
+		__m128 tz4 = _mm_set1_ps(tz);
+
+		//clamp each axis once, then step between the corners
+		int x0 = CPUField::Clamp(x, field.Width()), x1 = CPUField::Clamp(x+1, field.Width());
+		int y0 = CPUField::Clamp(y, field.Height()), y1 = CPUField::Clamp(y+1, field.Height());
+		int z0 = CPUField::Clamp(z, field.Depth()), z1 = CPUField::Clamp(z+1, field.Depth());
+
+		const int base = field.Index(x0, y0, z0);
+		const int dx = field.CellPitch() * (x1 - x0);
+		const int dy = field.RowPitch() * (y1 - y0);
+		const int dz = field.SlicePitch() * (z1 - z0);
+
+		__m128 tex11 = F4Lerp(F4Load(field, base), F4Load(field, base + dz), tz4);
+		__m128 tex12 = F4Lerp(F4Load(field, base + dy), F4Load(field, base + dy + dz), tz4);
+		__m128 tex21 = F4Lerp(F4Load(field, base + dx), F4Load(field, base + dx + dz), tz4);
+		__m128 tex22 = F4Lerp(F4Load(field, base + dx + dy), F4Load(field, base + dx + dy + dz), tz4);
+
+		return F4Lerp(F4Lerp(tex11, tex21, tx4), F4Lerp(tex12, tex22, tx4), ty4);
+	}
+
+	/**
+	 * Trilinear interpolation of a 4 component 3d field at texture coordinates s (cell centres at +0.5).
+	 * Same as F4Trilerp in Utils.cg, but the z neighbours are a slice apart instead of a slab.
+	 */
+	inline __m128 F4Trilerp(const CPUField &field, float sx, float sy, float sz)
+	{
+		float fx = floorf(sx - 0.5f);
+		float fy = floorf(sy - 0.5f);
+		float fz = floorf(sz - 0.5f);
+		return F4Trilerp(field, (int)fx, (int)fy, (int)fz, sx - 0.5f - fx, sy - 0.5f - fy, sz - 0.5f - fz);
+	}
+
+	/// Smallest and largest of the 4 cells F4Bilerp interpolates between at s, per component
+	inline void F4Bounds(const CPUField &field, float sx, float sy, __m128 &low, __m128 &high)
+	{
+		int x = (int)floorf(sx - 0.5f);
+		int y = (int)floorf(sy - 0.5f);
+
+		__m128 tex11 = F4Load(field, field.ClampedIndex(x, y));
+		__m128 tex21 = F4Load(field, field.ClampedIndex(x+1, y));
+		__m128 tex12 = F4Load(field, field.ClampedIndex(x, y+1));
+		__m128 tex22 = F4Load(field, field.ClampedIndex(x+1, y+1));
+
+		low = _mm_min_ps(_mm_min_ps(tex11, tex21), _mm_min_ps(tex12, tex22));
+		high = _mm_max_ps(_mm_max_ps(tex11, tex21), _mm_max_ps(tex12, tex22));
+	}
+
+	/// Smallest and largest of the 8 cells F4Trilerp interpolates between at s, per component
+	inline void F4Bounds(const CPUField &field, float sx, float sy, float sz, __m128 &low, __m128 &high)
+	{
+		int x = (int)floorf(sx - 0.5f);
+		int y = (int)floorf(sy - 0.5f);
+		int z = (int)floorf(sz - 0.5f);
+
+		low = high = F4Load(field, field.ClampedIndex(x, y, z));
+		for (int i = 1; i < 8; i++)
+		{
+			__m128 tex = F4Load(field, field.ClampedIndex(x + (i & 1), y + ((i >> 1) & 1), z + (i >> 2)));
+			low = _mm_min_ps(low, tex);
+			high = _mm_max_ps(high, tex);
+		}
+	}
+}
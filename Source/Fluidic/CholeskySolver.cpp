@@ -0,0 +1,356 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <math.h>
+
+#include "CholeskySolver.h"
+
+using namespace std;
+using namespace Fluidic;
+
+namespace
+{
+	/// Boxes of this many cells or fewer are ordered row by row rather than dissected further
+	const int LeafCells = 64;
+}
+
+bool CholeskySolver::Init(const CPUField &boundaries, int maxCells)
+{
+	if (IsReady() && SameFluid(boundaries)) return true;
+
+	mColumnStart.clear();
+	mGrid.Init(boundaries);
+
+	const int count = boundaries.Width() * boundaries.Height() * boundaries.Depth();
+	int fluidCells = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (mGrid.Fluid().Data()[i] != 0) fluidCells++;
+	}
+	if (fluidCells > maxCells) return false;
+
+	mRightHandSide.Resize(boundaries.Width(), boundaries.Height(), boundaries.Depth(), 1);
+
+	Order();
+	Factorise();
+	return true;
+}
+
+bool CholeskySolver::SameFluid(const CPUField &boundaries) const
+{
+	if (boundaries.Width() != mGrid.Width() || boundaries.Height() != mGrid.Height() ||
+		boundaries.Depth() != mGrid.Depth()) return false;
+
+	const int count = boundaries.Width() * boundaries.Height() * boundaries.Depth();
+	const float *fluid = mGrid.Fluid().Data();
+	for (int i = 0; i < count; i++)
+	{
+		if ((boundaries.Data()[i] == 0) != (fluid[i] != 0)) return false;
+	}
+	return true;
+}
+
+void CholeskySolver::Order()
+{
+	const int width = mGrid.Width();
+	const int height = mGrid.Height();
+	const int depth = mGrid.Depth();
+	const int count = width * height * depth;
+	const float *fluid = mGrid.Fluid().Data();
+
+	//hold the first cell of each body of fluid at 0, finding the bodies with a flood fill
+	vector<bool> pinned(count, false);
+	vector<bool> visited(count, false);
+	vector<int> queue;
+
+	for (int start = 0; start < count; start++)
+	{
+		if (fluid[start] == 0 || visited[start]) continue;
+
+		pinned[start] = true;
+		visited[start] = true;
+		queue.assign(1, start);
+
+		while (!queue.empty())
+		{
+			const int cell = queue.back();
+			queue.pop_back();
+
+			const int x = cell % width;
+			const int y = (cell / width) % height;
+			const int z = cell / (width * height);
+			const int neighbours[6] = {
+				x > 0 ? cell-1 : -1, x < width-1 ? cell+1 : -1,
+				y > 0 ? cell-width : -1, y < height-1 ? cell+width : -1,
+				z > 0 ? cell-width*height : -1, z < depth-1 ? cell+width*height : -1 };
+
+			for (int i = 0; i < 6; i++)
+			{
+				const int n = neighbours[i];
+				if (n < 0 || fluid[n] == 0 || visited[n]) continue;
+
+				visited[n] = true;
+				queue.push_back(n);
+			}
+		}
+	}
+
+	mCells.clear();
+	Dissect(0, 0, 0, width, height, depth, pinned);
+
+	mUnknowns.assign(count, -1);
+	for (int i = 0; i < (int)mCells.size(); i++)
+	{
+		mUnknowns[mCells[i]] = i;
+	}
+}
+
+void CholeskySolver::Dissect(int x0, int y0, int z0, int x1, int y1, int z1, vector<bool> &pinned)
+{
+	const int sizeX = x1 - x0, sizeY = y1 - y0, sizeZ = z1 - z0;
+	if (sizeX <= 0 || sizeY <= 0 || sizeZ <= 0) return;
+
+	const int width = mGrid.Width();
+	const int height = mGrid.Height();
+
+	if (sizeX * sizeY * sizeZ <= LeafCells)
+	{
+		for (int z = z0; z < z1; z++)
+		{
+			for (int y = y0; y < y1; y++)
+			{
+				for (int x = x0; x < x1; x++)
+				{
+					const int cell = x + width * (y + height * z);
+					if (*mGrid.Fluid().Cell(x, y, z) != 0 && !pinned[cell]) mCells.push_back(cell);
+				}
+			}
+		}
+		return;
+	}
+
+	//cut across the longest side; the plane of cells in the middle separates the 2 halves, so they
+	//don't fill each other in, and goes last
+	if (sizeX >= sizeY && sizeX >= sizeZ)
+	{
+		const int m = (x0 + x1) / 2;
+		Dissect(x0, y0, z0, m, y1, z1, pinned);
+		Dissect(m+1, y0, z0, x1, y1, z1, pinned);
+		Dissect(m, y0, z0, m+1, y1, z1, pinned);
+	}
+	else if (sizeY >= sizeZ)
+	{
+		const int m = (y0 + y1) / 2;
+		Dissect(x0, y0, z0, x1, m, z1, pinned);
+		Dissect(x0, m+1, z0, x1, y1, z1, pinned);
+		Dissect(x0, m, z0, x1, m+1, z1, pinned);
+	}
+	else
+	{
+		const int m = (z0 + z1) / 2;
+		Dissect(x0, y0, z0, x1, y1, m, pinned);
+		Dissect(x0, y0, m+1, x1, y1, z1, pinned);
+		Dissect(x0, y0, m, x1, y1, m+1, pinned);
+	}
+}
+
+int CholeskySolver::Neighbours(int unknown, int *neighbours) const
+{
+	const int width = mGrid.Width();
+	const int height = mGrid.Height();
+	const int depth = mGrid.Depth();
+	const int cell = mCells[unknown];
+
+	const int x = cell % width;
+	const int y = (cell / width) % height;
+	const int z = cell / (width * height);
+
+	int count = 0;
+	if (x > 0 && mUnknowns[cell-1] >= 0) neighbours[count++] = mUnknowns[cell-1];
+	if (x < width-1 && mUnknowns[cell+1] >= 0) neighbours[count++] = mUnknowns[cell+1];
+	if (y > 0 && mUnknowns[cell-width] >= 0) neighbours[count++] = mUnknowns[cell-width];
+	if (y < height-1 && mUnknowns[cell+width] >= 0) neighbours[count++] = mUnknowns[cell+width];
+	if (z > 0 && mUnknowns[cell-width*height] >= 0) neighbours[count++] = mUnknowns[cell-width*height];
+	if (z < depth-1 && mUnknowns[cell+width*height] >= 0) neighbours[count++] = mUnknowns[cell+width*height];
+	return count;
+}
+
+int CholeskySolver::RowPattern(int k)
+{
+	//walk up the elimination tree from each entry of column k above the diagonal, stopping at
+	//columns already visited. Each walk is pushed onto the top of the stack in reverse, so the
+	//stack ends up in an order where every column comes before its parents.
+	const int n = (int)mCells.size();
+	int top = n;
+	int neighbours[6];
+	const int count = Neighbours(k, neighbours);
+
+	mMark[k] = k;
+	for (int i = 0; i < count; i++)
+	{
+		int j = neighbours[i];
+		if (j > k) continue;
+
+		int length = 0;
+		for (; mMark[j] != k; j = mParent[j])
+		{
+			mStack[length++] = j;
+			mMark[j] = k;
+		}
+		while (length > 0) mStack[--top] = mStack[--length];
+	}
+	return top;
+}
+
+void CholeskySolver::Factorise()
+{
+	const int n = (int)mCells.size();
+	int neighbours[6];
+
+	mParent.assign(n, -1);
+	mMark.assign(n, -1);
+	mStack.assign(n, 0);
+	mWork.assign(n, 0.0);
+
+	//elimination tree, with path compression through ancestor
+	vector<int> ancestor(n, -1);
+	for (int k = 0; k < n; k++)
+	{
+		const int count = Neighbours(k, neighbours);
+		for (int i = 0; i < count; i++)
+		{
+			int j = neighbours[i];
+			while (j != -1 && j < k)
+			{
+				const int next = ancestor[j];
+				ancestor[j] = k;
+				if (next == -1) mParent[j] = k;
+				j = next;
+			}
+		}
+	}
+
+	//count the entries of each column from the pattern of each row
+	vector<int> columnCount(n, 1);
+	for (int k = 0; k < n; k++)
+	{
+		for (int top = RowPattern(k); top < n; top++) columnCount[mStack[top]]++;
+	}
+
+	mColumnStart.resize(n+1);
+	mColumnStart[0] = 0;
+	for (int j = 0; j < n; j++) mColumnStart[j+1] = mColumnStart[j] + columnCount[j];
+
+	mRows.resize(mColumnStart[n]);
+	mValues.resize(mColumnStart[n]);
+	vector<int> next(mColumnStart.begin(), mColumnStart.end() - 1);
+
+	//row by row (up-looking): row k of the factor comes from a triangular solve with the rows above
+	mMark.assign(n, -1);
+	const float *fluidCount = mGrid.Count().Data();
+	for (int k = 0; k < n; k++)
+	{
+		const int top = RowPattern(k);
+
+		//-A is the number of fluid neighbours on the diagonal, -1 for each fluid neighbour
+		const int count = Neighbours(k, neighbours);
+		for (int i = 0; i < count; i++)
+		{
+			if (neighbours[i] < k) mWork[neighbours[i]] = -1;
+		}
+		double diagonal = fluidCount[mCells[k]];
+
+		for (int t = top; t < n; t++)
+		{
+			const int j = mStack[t];
+			const double lkj = mWork[j] / mValues[mColumnStart[j]];
+			mWork[j] = 0;
+
+			for (int p = mColumnStart[j] + 1; p < next[j]; p++)
+			{
+				mWork[mRows[p]] -= mValues[p] * lkj;
+			}
+			diagonal -= lkj * lkj;
+
+			const int p = ++next[j];
+			mRows[p - 1] = k;
+			mValues[p - 1] = lkj;
+		}
+
+		mRows[next[k]] = k;
+		mValues[next[k]] = sqrt(diagonal);
+		next[k]++;
+	}
+}
+
+void CholeskySolver::Solve(CPUField &x, const CPUField &div, float cellArea)
+{
+	if (!IsReady()) return;
+
+	const int n = (int)mCells.size();
+
+	//-A x = -dx*dy*div, as for the conjugate gradient solver
+	CPUField &b = mRightHandSide;
+	const int count = b.Size();
+	#pragma omp parallel for
+	for (int i = 0; i < count; i++)
+	{
+		b.Data()[i] = -cellArea * div.Data()[i];
+	}
+	mGrid.RemoveMean(b);
+
+	for (int k = 0; k < n; k++)
+	{
+		mWork[k] = b.Data()[mCells[k]];
+	}
+
+	//L y = b
+	for (int j = 0; j < n; j++)
+	{
+		mWork[j] /= mValues[mColumnStart[j]];
+		const double y = mWork[j];
+		for (int p = mColumnStart[j] + 1; p < mColumnStart[j+1]; p++)
+		{
+			mWork[mRows[p]] -= mValues[p] * y;
+		}
+	}
+
+	//L^T x = y
+	for (int j = n-1; j >= 0; j--)
+	{
+		double sum = mWork[j];
+		for (int p = mColumnStart[j] + 1; p < mColumnStart[j+1]; p++)
+		{
+			sum -= mValues[p] * mWork[mRows[p]];
+		}
+		mWork[j] = sum / mValues[mColumnStart[j]];
+	}
+
+	//solid and held cells are 0
+	x.Zero();
+	for (int k = 0; k < n; k++)
+	{
+		x.Data()[mCells[k]] = (float)mWork[k];
+	}
+
+	//as for the iterative solvers, keep the pressure from drifting away from the solid cells
+	mGrid.RemoveMean(x);
+}
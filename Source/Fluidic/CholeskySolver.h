@@ -0,0 +1,107 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#pragma once
+
+#include <vector>
+
+#include "CPUField.h"
+#include "PoissonGrid.h"
+
+namespace Fluidic
+{
+	/**
+	 * \brief Direct pressure solver for obstacles that rarely change, using a cached sparse cholesky factor.
+	 *
+	 * The pressure equation (see PoissonGrid) over the fluid cells is factorised once, in nested
+	 * dissection order to keep the fill-in down, and each solve is then a forward and back
+	 * substitution. The pressure is only known up to a constant in each separate body of fluid, so
+	 * one cell of each is held at 0 to make the matrix definite. The factor takes O(n log n) memory
+	 * in 2d but grows much faster in 3d, so is only built for grids up to a given size.
+	 */
+	class CholeskySolver
+	{
+	public:
+		CholeskySolver() {}
+
+		/**
+		 * \brief Factorises the pressure equation for a boundary field.
+		 *
+		 * Does nothing if the solid cells are the same as the last call, so can be called whenever
+		 * the boundaries might have changed.
+		 *
+		 * @param boundaries cells with a boundary value of 0 are fluid
+		 * @param maxCells the most fluid cells to factorise
+		 * @return false if there were too many fluid cells, leaving the solver unready
+		 */
+		bool Init(const CPUField &boundaries, int maxCells);
+
+		/**
+		 * \brief Solves for the pressure, the same equation as the pressure jacobi iterations.
+		 *
+		 * @param x the pressure
+		 * @param div the divergence of the velocity
+		 * @param cellArea dx*dy of a solver cell
+		 */
+		void Solve(CPUField &x, const CPUField &div, float cellArea);
+
+		/// True once a factor has been built
+		bool IsReady() const { return !mColumnStart.empty(); }
+
+	private:
+		CholeskySolver(const CholeskySolver &);
+		CholeskySolver &operator=(const CholeskySolver &);
+
+		/// True if the fluid cells of boundaries are the same as the current grid's
+		bool SameFluid(const CPUField &boundaries) const;
+
+		/// Numbers the unknowns: nested dissection order, leaving out 1 cell of each body of fluid
+		void Order();
+
+		/// Appends the fluid cells of a box to the order, separators after the halves they separate
+		void Dissect(int x0, int y0, int z0, int x1, int y1, int z1, std::vector<bool> &pinned);
+
+		/// Grid cells next to an unknown that are unknowns themselves
+		int Neighbours(int unknown, int *neighbours) const;
+
+		void Factorise();
+
+		/// Nonzero columns of row k of the factor, in the order they need eliminating, from mStack[top]
+		int RowPattern(int k);
+
+		PoissonGrid mGrid;
+		CPUField mRightHandSide;
+
+		std::vector<int> mCells; ///< grid cell of each unknown, in elimination order
+		std::vector<int> mUnknowns; ///< unknown of each grid cell, or -1 for solid or held cells
+
+		// Lower triangular factor by columns, the diagonal first in each
+		std::vector<int> mColumnStart;
+		std::vector<int> mRows;
+		std::vector<double> mValues;
+
+		// Scratch for the factorisation and solves
+		std::vector<int> mParent; ///< elimination tree
+		std::vector<int> mMark;
+		std::vector<int> mStack;
+		std::vector<double> mWork;
+	};
+}
@@ -0,0 +1,259 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <math.h>
+
+#include "ConjugateGradientSolver.h"
+
+using namespace std;
+using namespace Fluidic;
+
+namespace
+{
+	/// Modified incomplete cholesky tuning: how much of the dropped fill-in goes on the diagonal
+	const float MICTuning = 0.97f;
+
+	/// Falls back to the plain diagonal when the factored diagonal gets this small relative to it
+	const float MICSafety = 0.25f;
+
+	/// y += a*x
+	void AddScaled(CPUField &y, const CPUField &x, float a)
+	{
+		const int count = y.Size();
+		float *dataY = y.Data();
+		const float *dataX = x.Data();
+
+		#pragma omp parallel for
+		for (int i = 0; i < count; i++)
+		{
+			dataY[i] += a * dataX[i];
+		}
+	}
+
+	/// y = x + a*y
+	void ScaleAndAdd(CPUField &y, const CPUField &x, float a)
+	{
+		const int count = y.Size();
+		float *dataY = y.Data();
+		const float *dataX = x.Data();
+
+		#pragma omp parallel for
+		for (int i = 0; i < count; i++)
+		{
+			dataY[i] = dataX[i] + a * dataY[i];
+		}
+	}
+}
+
+ConjugateGradientSolver::ConjugateGradientSolver() :
+mPreconditioner(PC_INCOMPLETE_CHOLESKY)
+{
+}
+
+void ConjugateGradientSolver::Init(const CPUField &boundaries, PreconditionerType preconditioner)
+{
+	const int w = boundaries.Width(), h = boundaries.Height(), d = boundaries.Depth();
+
+	mGrid.Init(boundaries);
+	mPreconditioner = preconditioner;
+
+	mResidual.Resize(w, h, d, 1);
+	mSearch.Resize(w, h, d, 1);
+	mPreconditioned.Resize(w, h, d, 1);
+	mProduct.Resize(w, h, d, 1);
+
+	if (mPreconditioner == PC_MULTIGRID)
+	{
+		mMultigrid.Init(boundaries);
+	}
+	else
+	{
+		mPrecon.Resize(w, h, d, 1);
+		BuildIncompleteCholesky();
+	}
+}
+
+int ConjugateGradientSolver::Solve(CPUField &x, const CPUField &div, float cellArea, float tolerance, int maxIterations)
+{
+	if (!IsReady()) return 0;
+
+	//Work with -A, which is positive (semi) definite: -A x = -dx*dy*div. The product field holds the
+	//right hand side until the iterations start.
+	CPUField &b = mProduct;
+	const int count = b.Size();
+	#pragma omp parallel for
+	for (int i = 0; i < count; i++)
+	{
+		b.Data()[i] = -cellArea * div.Data()[i];
+	}
+	mGrid.RemoveMean(b);
+
+	const double target = tolerance * tolerance * mGrid.Dot(b, b);
+
+	//r = b - (-A x)
+	mGrid.Apply(x, mResidual);
+	AddScaled(mResidual, b, 1.f);
+
+	double residual = mGrid.Dot(mResidual, mResidual);
+	if (residual <= target) return 0;
+
+	Precondition(mResidual, mPreconditioned);
+	mSearch.CopyFrom(mPreconditioned);
+	double sigma = mGrid.Dot(mPreconditioned, mResidual);
+
+	int iterations = 0;
+	while (iterations < maxIterations)
+	{
+		iterations++;
+
+		//product = A search, so -A search is -product
+		mGrid.Apply(mSearch, mProduct);
+		double curvature = -mGrid.Dot(mSearch, mProduct);
+		if (curvature <= 0) break;
+
+		float alpha = (float)(sigma / curvature);
+		AddScaled(x, mSearch, alpha);
+		AddScaled(mResidual, mProduct, alpha);
+
+		residual = mGrid.Dot(mResidual, mResidual);
+		if (residual <= target) break;
+
+		Precondition(mResidual, mPreconditioned);
+		double sigmaNew = mGrid.Dot(mPreconditioned, mResidual);
+
+		ScaleAndAdd(mSearch, mPreconditioned, (float)(sigmaNew / sigma));
+		sigma = sigmaNew;
+	}
+
+	//the pressure is only known up to a constant, so keep it from drifting away from the solid cells
+	mGrid.RemoveMean(x);
+
+	return iterations;
+}
+
+void ConjugateGradientSolver::Precondition(const CPUField &r, CPUField &z)
+{
+	if (mPreconditioner == PC_MULTIGRID) mMultigrid.Precondition(r, z);
+	else ApplyIncompleteCholesky(r, z);
+
+	//keep the search directions away from the constant pressure, which makes no difference
+	mGrid.RemoveMean(z);
+}
+
+void ConjugateGradientSolver::BuildIncompleteCholesky()
+{
+	const int width = mGrid.Width();
+	const int height = mGrid.Height();
+	const int depth = mGrid.Depth();
+	const CPUField &fluid = mGrid.Fluid();
+
+	mPrecon.Zero();
+
+	for (int z = 0; z < depth; z++)
+	{
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				if (*fluid.Cell(x, y, z) == 0) continue;
+
+				float diag = *mGrid.Count().Cell(x, y, z);
+				float e = diag;
+
+				//the already factored neighbours at -x, -y and -z, and their other +ve neighbours
+				if (x > 0 && *fluid.Cell(x-1, y, z) != 0)
+				{
+					float p = *mPrecon.Cell(x-1, y, z);
+					float fill = (y < height-1 ? *fluid.Cell(x-1, y+1, z) : 0) + (z < depth-1 ? *fluid.Cell(x-1, y, z+1) : 0);
+					e -= p*p * (1 + MICTuning * fill);
+				}
+				if (y > 0 && *fluid.Cell(x, y-1, z) != 0)
+				{
+					float p = *mPrecon.Cell(x, y-1, z);
+					float fill = (x < width-1 ? *fluid.Cell(x+1, y-1, z) : 0) + (z < depth-1 ? *fluid.Cell(x, y-1, z+1) : 0);
+					e -= p*p * (1 + MICTuning * fill);
+				}
+				if (z > 0 && *fluid.Cell(x, y, z-1) != 0)
+				{
+					float p = *mPrecon.Cell(x, y, z-1);
+					float fill = (x < width-1 ? *fluid.Cell(x+1, y, z-1) : 0) + (y < height-1 ? *fluid.Cell(x, y+1, z-1) : 0);
+					e -= p*p * (1 + MICTuning * fill);
+				}
+
+				if (e < MICSafety * diag) e = diag;
+				if (e > 0) *mPrecon.Cell(x, y, z) = 1.f / sqrtf(e);
+			}
+		}
+	}
+}
+
+void ConjugateGradientSolver::ApplyIncompleteCholesky(const CPUField &r, CPUField &z)
+{
+	const int width = mGrid.Width();
+	const int height = mGrid.Height();
+	const int depth = mGrid.Depth();
+	const CPUField &fluid = mGrid.Fluid();
+
+	//solve L q = r, storing q in z. Off diagonals of L are -precon of the lower neighbour.
+	for (int k = 0; k < depth; k++)
+	{
+		for (int j = 0; j < height; j++)
+		{
+			for (int i = 0; i < width; i++)
+			{
+				float p = *mPrecon.Cell(i, j, k);
+				if (p == 0)
+				{
+					*z.Cell(i, j, k) = 0;
+					continue;
+				}
+
+				float t = *r.Cell(i, j, k);
+				if (i > 0 && *fluid.Cell(i-1, j, k) != 0) t += *mPrecon.Cell(i-1, j, k) * *z.Cell(i-1, j, k);
+				if (j > 0 && *fluid.Cell(i, j-1, k) != 0) t += *mPrecon.Cell(i, j-1, k) * *z.Cell(i, j-1, k);
+				if (k > 0 && *fluid.Cell(i, j, k-1) != 0) t += *mPrecon.Cell(i, j, k-1) * *z.Cell(i, j, k-1);
+
+				*z.Cell(i, j, k) = t * p;
+			}
+		}
+	}
+
+	//solve L^T z = q in place
+	for (int k = depth-1; k >= 0; k--)
+	{
+		for (int j = height-1; j >= 0; j--)
+		{
+			for (int i = width-1; i >= 0; i--)
+			{
+				float p = *mPrecon.Cell(i, j, k);
+				if (p == 0) continue;
+
+				float t = *z.Cell(i, j, k);
+				float s = 0;
+				if (i < width-1 && *fluid.Cell(i+1, j, k) != 0) s += *z.Cell(i+1, j, k);
+				if (j < height-1 && *fluid.Cell(i, j+1, k) != 0) s += *z.Cell(i, j+1, k);
+				if (k < depth-1 && *fluid.Cell(i, j, k+1) != 0) s += *z.Cell(i, j, k+1);
+
+				*z.Cell(i, j, k) = (t + p * s) * p;
+			}
+		}
+	}
+}
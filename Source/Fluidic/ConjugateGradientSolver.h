@@ -0,0 +1,83 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#pragma once
+
+#include "CPUField.h"
+#include "FluidOptions.h"
+#include "MultigridSolver.h"
+#include "PoissonGrid.h"
+
+namespace Fluidic
+{
+	/**
+	 * \brief Preconditioned conjugate gradient solver for the pressure on the CPU.
+	 *
+	 * Solves the same equation as MultigridSolver, but iterates until the residual has dropped by a
+	 * given factor rather than for a fixed count. The stencil is applied matrix free by PoissonGrid,
+	 * and it and the dot products are spread across threads. The incomplete cholesky preconditioner
+	 * is sequential; the multigrid one is threaded.
+	 */
+	class ConjugateGradientSolver
+	{
+	public:
+		ConjugateGradientSolver();
+
+		/// Sets up for a boundary field. Needs calling again when the boundaries change.
+		void Init(const CPUField &boundaries, PreconditionerType preconditioner);
+
+		/**
+		 * \brief Solves for the pressure, the same equation as the pressure jacobi iterations.
+		 *
+		 * @param x the pressure; its current value is the starting guess
+		 * @param div the divergence of the velocity
+		 * @param cellArea dx*dy of a solver cell
+		 * @param tolerance stop once the residual is this fraction of the right hand side
+		 * @param maxIterations stop after this many iterations regardless
+		 * @return the number of iterations used
+		 */
+		int Solve(CPUField &x, const CPUField &div, float cellArea, float tolerance, int maxIterations);
+
+		/// True once Init has been called
+		bool IsReady() const { return mGrid.Width() > 0; }
+
+	private:
+		ConjugateGradientSolver(const ConjugateGradientSolver &);
+		ConjugateGradientSolver &operator=(const ConjugateGradientSolver &);
+
+		/// z = M^-1 r
+		void Precondition(const CPUField &r, CPUField &z);
+
+		/// Builds the modified incomplete cholesky factor, MIC(0)
+		void BuildIncompleteCholesky();
+		void ApplyIncompleteCholesky(const CPUField &r, CPUField &z);
+
+		PoissonGrid mGrid;
+		PreconditionerType mPreconditioner;
+		MultigridSolver mMultigrid;
+
+		CPUField mResidual;
+		CPUField mSearch;
+		CPUField mPreconditioned; ///< preconditioned residual, also A*search
+		CPUField mProduct;
+		CPUField mPrecon; ///< 1/diagonal of the incomplete cholesky factor
+	};
+}
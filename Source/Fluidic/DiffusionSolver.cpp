@@ -0,0 +1,229 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include "DiffusionSolver.h"
+
+using namespace Fluidic;
+
+namespace
+{
+	/// a / b for each component, or 0 where b is 0 or less
+	inline __m128 F4SafeDivide(__m128 a, __m128 b)
+	{
+		__m128 positive = _mm_cmpgt_ps(b, _mm_setzero_ps());
+		return _mm_and_ps(positive, _mm_div_ps(a, _mm_or_ps(b, _mm_andnot_ps(positive, _mm_set1_ps(1)))));
+	}
+
+	/// True if every component of a is at most b
+	inline bool F4AllLessEqual(__m128 a, __m128 b)
+	{
+		return _mm_movemask_ps(_mm_cmple_ps(a, b)) == 0xf;
+	}
+
+	/// y += a*x, per component
+	void AddScaled(CPUField &y, const CPUField &x, __m128 a)
+	{
+		const int cells = y.Size() / 4;
+		float *dataY = y.Data();
+		const float *dataX = x.Data();
+
+		#pragma omp parallel for
+		for (int i = 0; i < cells; i++)
+		{
+			_mm_store_ps(dataY + 4*i, _mm_add_ps(_mm_load_ps(dataY + 4*i), _mm_mul_ps(a, _mm_load_ps(dataX + 4*i))));
+		}
+	}
+
+	/// y = x + a*y, per component
+	void ScaleAndAdd(CPUField &y, const CPUField &x, __m128 a)
+	{
+		const int cells = y.Size() / 4;
+		float *dataY = y.Data();
+		const float *dataX = x.Data();
+
+		#pragma omp parallel for
+		for (int i = 0; i < cells; i++)
+		{
+			_mm_store_ps(dataY + 4*i, _mm_add_ps(_mm_load_ps(dataX + 4*i), _mm_mul_ps(a, _mm_load_ps(dataY + 4*i))));
+		}
+	}
+}
+
+int DiffusionSolver::Solve(CPUField &x, const CPUField &b, float alpha, float tolerance, int maxIterations)
+{
+	const int w = x.Width(), h = x.Height(), d = x.Depth();
+
+	//the solve works on whole cells, so planar fields go through interleaved copies
+	if (x.Planar())
+	{
+		if (mInterleaved.Width() != w || mInterleaved.Height() != h || mInterleaved.Depth() != d)
+		{
+			mInterleaved.Resize(w, h, d, 4);
+			mInterleavedSource.Resize(w, h, d, 4);
+		}
+		mInterleaved.CopyFrom(x);
+		mInterleavedSource.CopyFrom(b);
+		int iterations = Solve(mInterleaved, mInterleavedSource, alpha, tolerance, maxIterations);
+		x.CopyFrom(mInterleaved);
+		return iterations;
+	}
+	if (mResidual.Width() != w || mResidual.Height() != h || mResidual.Depth() != d)
+	{
+		mResidual.Resize(w, h, d, 4);
+		mSearch.Resize(w, h, d, 4);
+		mPreconditioned.Resize(w, h, d, 4);
+		mProduct.Resize(w, h, d, 4);
+	}
+
+	const __m128 alpha4 = _mm_set1_ps(alpha);
+
+	//r = alpha b - A x
+	Apply(x, mProduct, alpha);
+	mResidual.CopyFrom(b);
+	{
+		const int cells = mResidual.Size() / 4;
+		float *r = mResidual.Data();
+		const float *product = mProduct.Data();
+
+		#pragma omp parallel for
+		for (int i = 0; i < cells; i++)
+		{
+			_mm_store_ps(r + 4*i, _mm_sub_ps(_mm_mul_ps(alpha4, _mm_load_ps(r + 4*i)), _mm_load_ps(product + 4*i)));
+		}
+	}
+
+	const float tolerance2 = tolerance * tolerance * alpha * alpha;
+	const __m128 target = _mm_mul_ps(_mm_set1_ps(tolerance2), Dot(b, b));
+
+	__m128 residual = Dot(mResidual, mResidual);
+	if (F4AllLessEqual(residual, target)) return 0;
+
+	Precondition(mResidual, mPreconditioned, alpha);
+	mSearch.CopyFrom(mPreconditioned);
+	__m128 sigma = Dot(mPreconditioned, mResidual);
+
+	int iterations = 0;
+	while (iterations < maxIterations)
+	{
+		iterations++;
+
+		Apply(mSearch, mProduct, alpha);
+		__m128 step = F4SafeDivide(sigma, Dot(mSearch, mProduct));
+
+		AddScaled(x, mSearch, step);
+		AddScaled(mResidual, mProduct, _mm_sub_ps(_mm_setzero_ps(), step));
+
+		residual = Dot(mResidual, mResidual);
+		if (F4AllLessEqual(residual, target)) break;
+
+		Precondition(mResidual, mPreconditioned, alpha);
+		__m128 sigmaNew = Dot(mPreconditioned, mResidual);
+
+		ScaleAndAdd(mSearch, mPreconditioned, F4SafeDivide(sigmaNew, sigma));
+		sigma = sigmaNew;
+	}
+
+	return iterations;
+}
+
+void DiffusionSolver::Apply(const CPUField &x, CPUField &out, float alpha) const
+{
+	const int width = x.Width();
+	const int height = x.Height();
+	const int depth = x.Depth();
+	const int rows = height * depth;
+	//alpha x - (sum - 6x), with the missing neighbours counted as x
+	const __m128 diagonal = _mm_set1_ps(alpha + 6);
+
+	#pragma omp parallel for
+	for (int r = 0; r < rows; r++)
+	{
+		const int y = r % height;
+		const int z = r / height;
+
+		//neighbours outside the grid are the cell itself, so drop out
+		const float *row = x.Cell(0, y, z);
+		const float *up = x.Cell(0, y < height-1 ? y+1 : y, z);
+		const float *down = x.Cell(0, y > 0 ? y-1 : y, z);
+		const float *front = x.Cell(0, y, z < depth-1 ? z+1 : z);
+		const float *back = x.Cell(0, y, z > 0 ? z-1 : z);
+		float *result = out.Cell(0, y, z);
+
+		for (int c = 0; c < width; c++)
+		{
+			const int left = 4 * (c > 0 ? c-1 : c);
+			const int right = 4 * (c < width-1 ? c+1 : c);
+
+			__m128 centre = _mm_load_ps(row + 4*c);
+			__m128 sum = _mm_add_ps(
+				_mm_add_ps(_mm_load_ps(row + left), _mm_load_ps(row + right)),
+				_mm_add_ps(_mm_load_ps(up + 4*c), _mm_load_ps(down + 4*c)));
+			sum = _mm_add_ps(sum, _mm_add_ps(_mm_load_ps(front + 4*c), _mm_load_ps(back + 4*c)));
+
+			_mm_store_ps(result + 4*c, _mm_sub_ps(_mm_mul_ps(diagonal, centre), sum));
+		}
+	}
+}
+
+void DiffusionSolver::Precondition(const CPUField &r, CPUField &z, float alpha) const
+{
+	const int width = r.Width();
+	const int height = r.Height();
+	const int depth = r.Depth();
+	const int rows = height * depth;
+
+	#pragma omp parallel for
+	for (int row = 0; row < rows; row++)
+	{
+		const int y = row % height;
+		const int zi = row / height;
+
+		//neighbours inside the grid
+		const int outer = (y > 0) + (y < height-1) + (zi > 0) + (zi < depth-1);
+		const float *in = r.Cell(0, y, zi);
+		float *out = z.Cell(0, y, zi);
+
+		for (int c = 0; c < width; c++)
+		{
+			const int count = outer + (c > 0) + (c < width-1);
+			_mm_store_ps(out + 4*c, _mm_div_ps(_mm_load_ps(in + 4*c), _mm_set1_ps(alpha + count)));
+		}
+	}
+}
+
+__m128 DiffusionSolver::Dot(const CPUField &a, const CPUField &b)
+{
+	const int cells = a.Size() / 4;
+	const float *dataA = a.Data();
+	const float *dataB = b.Data();
+	double sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+
+	#pragma omp parallel for reduction(+:sum0,sum1,sum2,sum3)
+	for (int i = 0; i < cells; i++)
+	{
+		sum0 += dataA[4*i] * dataB[4*i];
+		sum1 += dataA[4*i+1] * dataB[4*i+1];
+		sum2 += dataA[4*i+2] * dataB[4*i+2];
+		sum3 += dataA[4*i+3] * dataB[4*i+3];
+	}
+
+	return _mm_setr_ps((float)sum0, (float)sum1, (float)sum2, (float)sum3);
+}
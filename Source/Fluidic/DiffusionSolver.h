@@ -0,0 +1,76 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#pragma once
+
+#include <xmmintrin.h>
+
+#include "CPUField.h"
+
+namespace Fluidic
+{
+	/**
+	 * \brief Conjugate gradient solver for the implicit viscosity of a 4 component CPU field.
+	 *
+	 * Solves the same equation as the diffusion jacobi iterations,
+	 * alpha x - sum over the neighbours n of (x[n] - x) = alpha b, with cells outside the grid
+	 * dropping out. With thick fluids alpha is tiny, and jacobi hardly moves; this converges in
+	 * about the square root of the iterations. The 4 components are separate systems, solved
+	 * side by side in SSE registers, with a diagonal preconditioner. 2d fields have a depth of 1.
+	 */
+	class DiffusionSolver
+	{
+	public:
+		DiffusionSolver() {}
+
+		/**
+		 * \brief Diffuses a field.
+		 *
+		 * @param x the field; its current value is the starting guess
+		 * @param b the field before diffusing. Must not be x.
+		 * @param alpha dx*dy / (time * viscosity)
+		 * @param tolerance stop once the residual of every component is this fraction of alpha*b
+		 * @param maxIterations stop after this many iterations regardless
+		 * @return the number of iterations used
+		 */
+		int Solve(CPUField &x, const CPUField &b, float alpha, float tolerance, int maxIterations);
+
+	private:
+		DiffusionSolver(const DiffusionSolver &);
+		DiffusionSolver &operator=(const DiffusionSolver &);
+
+		/// out = alpha x - sum over the neighbours of (x[n] - x)
+		void Apply(const CPUField &x, CPUField &out, float alpha) const;
+
+		/// z = r / the diagonal
+		void Precondition(const CPUField &r, CPUField &z, float alpha) const;
+
+		/// Dot product of each component
+		static __m128 Dot(const CPUField &a, const CPUField &b);
+
+		CPUField mResidual;
+		CPUField mSearch;
+		CPUField mPreconditioned;
+		CPUField mProduct;
+		CPUField mInterleaved; ///< FL_PLANAR fields are solved in these
+		CPUField mInterleavedSource;
+	};
+}
@@ -0,0 +1,164 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <math.h>
+
+#include "FFT.h"
+
+using namespace std;
+using namespace Fluidic;
+
+namespace
+{
+	const double Pi = 3.14159265358979323846;
+}
+
+void FFT::Init(int size)
+{
+	mSize = size;
+	mLargestFactor = 1;
+	mFactors.clear();
+
+	mTwiddles.resize(size);
+	for (int i = 0; i < size; i++)
+	{
+		double phase = -2 * Pi * i / size;
+		mTwiddles[i] = Complex(cos(phase), sin(phase));
+	}
+
+	//twos first, then the odd primes
+	int n = size;
+	int p = 2;
+	while (n > 1)
+	{
+		while (n % p != 0)
+		{
+			p = (p == 2) ? 3 : p + 2;
+			if (p * p > n) p = n;
+		}
+		n /= p;
+		mFactors.push_back(p);
+		mFactors.push_back(n);
+		if (p > mLargestFactor) mLargestFactor = p;
+	}
+}
+
+void FFT::Forward(const Complex *in, Complex *out, vector<Complex> &scratch) const
+{
+	if (mSize == 1)
+	{
+		out[0] = in[0];
+		return;
+	}
+
+	if ((int)scratch.size() < mLargestFactor) scratch.resize(mLargestFactor);
+	Work(out, in, 1, &mFactors[0], &scratch[0]);
+}
+
+// Decimation in time: transform the p interleaved sub-sequences of length m, then combine them
+void FFT::Work(Complex *out, const Complex *in, int fstride, const int *factors, Complex *scratch) const
+{
+	const int p = factors[0];
+	const int m = factors[1];
+
+	if (m == 1)
+	{
+		for (int i = 0; i < p; i++) out[i] = in[i * fstride];
+	}
+	else
+	{
+		for (int i = 0; i < p; i++) Work(out + i*m, in + i*fstride, fstride * p, factors + 2, scratch);
+	}
+
+	if (p == 2)
+	{
+		for (int u = 0; u < m; u++)
+		{
+			Complex t = out[u+m] * mTwiddles[u * fstride];
+			out[u+m] = out[u] - t;
+			out[u] += t;
+		}
+		return;
+	}
+
+	for (int u = 0; u < m; u++)
+	{
+		for (int q = 0, k = u; q < p; q++, k += m) scratch[q] = out[k];
+
+		for (int q1 = 0, k = u; q1 < p; q1++, k += m)
+		{
+			int twiddle = 0;
+			out[k] = scratch[0];
+			for (int q = 1; q < p; q++)
+			{
+				twiddle += fstride * k;
+				if (twiddle >= mSize) twiddle -= mSize;
+				out[k] += scratch[q] * mTwiddles[twiddle];
+			}
+		}
+	}
+}
+
+void CosineTransform::Init(int size)
+{
+	mFFT.Init(size);
+
+	mShift.resize(size);
+	for (int k = 0; k < size; k++)
+	{
+		double phase = -Pi * k / (2.0 * size);
+		mShift[k] = Complex(cos(phase), sin(phase));
+	}
+}
+
+// Makhoul's method: reorder to evens then reversed odds, FFT, and rotate each term
+void CosineTransform::Forward(double *data, Scratch &scratch) const
+{
+	const int n = Size();
+	scratch.a.resize(n);
+	scratch.b.resize(n);
+
+	for (int i = 0; i < (n+1)/2; i++) scratch.a[i] = data[2*i];
+	for (int i = 0; i < n/2; i++) scratch.a[n-1-i] = data[2*i+1];
+
+	mFFT.Forward(&scratch.a[0], &scratch.b[0], scratch.fft);
+
+	for (int k = 0; k < n; k++) data[k] = (scratch.b[k] * mShift[k]).real();
+}
+
+void CosineTransform::Inverse(double *data, Scratch &scratch) const
+{
+	const int n = Size();
+	scratch.a.resize(n);
+	scratch.b.resize(n);
+
+	//rebuild the FFT of the reordered data (conjugated, so a forward FFT does the inverse)
+	for (int k = 0; k < n; k++)
+	{
+		Complex v = conj(mShift[k]) * Complex(data[k], k > 0 ? -data[n-k] : 0.0);
+		scratch.a[k] = conj(v);
+	}
+
+	mFFT.Forward(&scratch.a[0], &scratch.b[0], scratch.fft);
+
+	for (int i = 0; i < (n+1)/2; i++) data[2*i] = scratch.b[i].real() / n;
+	for (int i = 0; i < n/2; i++) data[2*i+1] = scratch.b[n-1-i].real() / n;
+}
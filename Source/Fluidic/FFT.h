@@ -0,0 +1,89 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#pragma once
+
+#include <complex>
+#include <vector>
+
+namespace Fluidic
+{
+	/**
+	 * \brief Mixed radix complex FFT for any length.
+	 *
+	 * The length is split into prime factors; factors of 2 get a dedicated butterfly, the others a
+	 * generic one. Init is not thread safe, but once set up a transform can be run from many threads
+	 * at once, each with its own scratch.
+	 */
+	class FFT
+	{
+	public:
+		typedef std::complex<double> Complex;
+
+		FFT() : mSize(0) {}
+
+		void Init(int size);
+
+		/// out = the unnormalised forward transform of in. scratch is resized as needed.
+		void Forward(const Complex *in, Complex *out, std::vector<Complex> &scratch) const;
+
+		inline int Size() const { return mSize; }
+
+	private:
+		void Work(Complex *out, const Complex *in, int fstride, const int *factors, Complex *scratch) const;
+
+		int mSize;
+		int mLargestFactor;
+		std::vector<int> mFactors; ///< pairs of (radix, remaining length)
+		std::vector<Complex> mTwiddles;
+	};
+
+	/**
+	 * \brief Cosine transforms (DCT-II and its inverse) of real data, built on an FFT of the same length.
+	 *
+	 * These diagonalise the pressure equation with zero gradient walls on a cell centred grid.
+	 */
+	class CosineTransform
+	{
+	public:
+		typedef FFT::Complex Complex;
+
+		/// Scratch space for one thread
+		struct Scratch
+		{
+			std::vector<Complex> a, b, fft;
+		};
+
+		void Init(int size);
+
+		/// data[k] = sum over n of data[n] * cos(pi*(n+1/2)*k/size)
+		void Forward(double *data, Scratch &scratch) const;
+
+		/// Undoes Forward
+		void Inverse(double *data, Scratch &scratch) const;
+
+		inline int Size() const { return mFFT.Size(); }
+
+	private:
+		FFT mFFT;
+		std::vector<Complex> mShift; ///< exp(-i*pi*k/(2*size))
+	};
+}
@@ -20,6 +20,9 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+#include <algorithm>
+#include <math.h>
+
 #include "Fluid.h"
 #include "Debug.h"
 #include "GPUProgram.h"
@@ -42,7 +45,7 @@ using namespace Fluidic;
 
 Fluid::Fluid(std::string cgHomeDir) :
 mFramebufferId(0), mRenderbufferId(0), mCurrentBoundTexture(-1), mFluidCallListId(0), 
-mPollFrame(0), mCgHomeDir(cgHomeDir), mNextBoundaryTexture(0)
+mPollFrame(0), mCgHomeDir(cgHomeDir), mNextBoundaryTexture(0), mPressureIterations(0), mViscosityIterations(0)
 {
 	mCgContext = cgCreateContext();
 	if (cgGLIsProfileSupported(CG_PROFILE_GPU_FP)) mCgFragmentProfile = CG_PROFILE_GPU_FP;
@@ -50,14 +53,23 @@ mPollFrame(0), mCgHomeDir(cgHomeDir), mNextBoundaryTexture(0)
 	ready = 0;
 }
 
+Fluid::Fluid() :
+mPollFrame(0), mFluidCallListId(0), mCgContext(0), mRenderbufferId(0), mRenderbufferDataId(0), mFramebufferId(0), 
+mCurrentBoundTexture(-1), mNextBoundaryTexture(0), mTextures(0), mPressureIterations(0), mViscosityIterations(0)
+{
+	ready = 0;
+}
+
 Fluid::~Fluid(void)
 {
+	if (!mCgContext) return; // never touched the GPU
+
 	DestroyBuffers();
 	cgDestroyContext(mCgContext);
 }
 
 /** Initialization Stuff */
-void Fluid::Init(const FluidOptions &options, bool reloadPrograms)
+void Fluid::SetOptions(const FluidOptions &options)
 {
 	mOptions = options;
 
@@ -67,6 +79,11 @@ void Fluid::Init(const FluidOptions &options, bool reloadPrograms)
 	mOptions.RenderDeltaInv = mOptions.RenderResolution / mOptions.Size;
 	mOptions.SolverDeltaInv = mOptions.SolverResolution / mOptions.Size;
 	mOptions.SolverToRenderScale = mOptions.SolverResolution / mOptions.RenderResolution;
+}
+
+void Fluid::Init(const FluidOptions &options, bool reloadPrograms)
+{
+	SetOptions(options);
 
 	if (reloadPrograms && ready) DeletePrograms();
 	if (reloadPrograms || !ready) InitPrograms(mCgHomeDir);
@@ -98,7 +115,7 @@ void Fluid::DestroyBuffers()
   mRenderbufferId = mFramebufferId = 0;
 }
 
-void Fluid::SetupTexture(GLuint texId, GLuint internalFormat, Vector resolution, int components, char *initialData)
+void Fluid::SetupTexture(GLuint texId, GLuint internalFormat, Vector resolution, int components, char *initialData, GLenum type)
 {
 	// Set up OpenGL Formats
 	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, texId);
@@ -117,7 +134,15 @@ void Fluid::SetupTexture(GLuint texId, GLuint internalFormat, Vector resolution,
 
 	if (format == 0) return;
 
-	glTexImage2D(GL_TEXTURE_RECTANGLE_ARB, 0, internalFormat, resolution.xi(), resolution.yi(), 0, format, GL_FLOAT, &initialData[0]);
+	glTexImage2D(GL_TEXTURE_RECTANGLE_ARB, 0, internalFormat, resolution.xi(), resolution.yi(), 0, format, type, &initialData[0]);
+}
+
+GLuint Fluid::TextureFormat(FieldPrecision precision, int components) const
+{
+	//there are no fp64 textures, so FP_DOUBLE is fp32
+	bool half = mOptions.GetPrecision(precision, true) == FP_HALF;
+	if (components == 1) return half ? GL_LUMINANCE16F_ARB : GL_LUMINANCE32F_ARB;
+	return half ? GL_RGBA16F_ARB : GL_RGBA32F_ARB;
 }
 
 void Fluid::DrawSolverQuad(const Fluidic::Vector &textureSize, const Vector &quadSize, float z)
@@ -158,6 +183,34 @@ void Fluid::Perturb(const Vector &position, const Vector &velocity, float size)
 	mPerturbers.push_back(perturber);
 }
 
+void Fluid::Inject(const Vec3Array &positions, float r, float g, float b, float size, bool overwrite)
+{
+	//with the dimension of the fluid, as the Vector overload is given
+	const int dim = mOptions.Size.dim;
+	for (int i = 0; i < positions.Size(); i++)
+	{
+		Injector injector;
+		injector.color = Vector(r, g, b);
+		injector.position = Vector(positions.X()[i], positions.Y()[i], positions.Z()[i], dim);
+		injector.size = size;
+		injector.overwrite = overwrite;
+		mInjectors.push_back(injector);
+	}
+}
+
+void Fluid::Perturb(const Vec3Array &positions, const Vec3Array &velocities, float size)
+{
+	const int dim = mOptions.Size.dim;
+	for (int i = 0; i < positions.Size(); i++)
+	{
+		Perturber perturber;
+		perturber.velocity = Vector(velocities.X()[i], velocities.Y()[i], velocities.Z()[i], dim);
+		perturber.position = Vector(positions.X()[i], positions.Y()[i], positions.Z()[i], dim);
+		perturber.size = size;
+		mPerturbers.push_back(perturber);
+	}
+}
+
 void Fluid::AddArbitraryBoundary(const Vector &position, float size) 
 {
 	Boundary boundary;
@@ -224,6 +277,13 @@ void Fluid::DoCalculationSolver1D(int &textureIndex)
 	glCallList(mFluidCallListId + SolverCallListOffset);
 	std::swap(outputSolver1d, textureIndex);
 }
+void Fluid::DoCalculationSolver1D(int &textureIndex, int &previousIndex)
+{
+	SetOutputTexture(outputSolver1d);
+	glCallList(mFluidCallListId + SolverCallListOffset);
+	std::swap(outputSolver1d, textureIndex);
+	std::swap(outputSolver1d, previousIndex);
+}
 void Fluid::DoCalculationData(int &textureIndex)
 {
 	SetOutputTexture(outputRender);
@@ -231,6 +291,60 @@ void Fluid::DoCalculationData(int &textureIndex)
 	std::swap(outputRender, textureIndex);
 }
 
+void Fluid::DoCalculationSolver(int &first, int &second)
+{
+	static const GLenum buffers[] = { GL_COLOR_ATTACHMENT0_EXT, GL_COLOR_ATTACHMENT1_EXT };
+
+	SetOutputTexture(outputSolver);
+	glFramebufferTexture2DEXT( GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT1_EXT, GL_TEXTURE_RECTANGLE_ARB,  mTextures[advected], 0 );
+	glDrawBuffers(2, buffers);
+
+	glCallList(mFluidCallListId + SolverCallListOffset);
+
+	glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT);
+	glFramebufferTexture2DEXT( GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT1_EXT, GL_TEXTURE_RECTANGLE_ARB,  0, 0 );
+	std::swap(outputSolver, first);
+	std::swap(advected, second);
+}
+
+bool Fluid::FuseAdvection(bool inkAtSolverResolution) const
+{
+	return inkAtSolverResolution && mOptions.Advection == AD_SEMI_LAGRANGIAN &&
+		mOptions.GetOption(RS_FUSED_ADVECTION) &&
+		mOptions.GetOption(RS_ADVECT_VELOCITY) && mOptions.GetOption(RS_ADVECT_DATA);
+}
+
+bool Fluid::FuseProjection() const
+{
+	return mOptions.GetOption(RS_FUSED_PROJECTION) && !mOptions.GetOption(RS_ZCULL) &&
+		mOptions.PressureSolver != PS_RED_BLACK_SOR && mOptions.PressureSolver != PS_CHEBYSHEV_JACOBI &&
+		mOptions.GetPressureMaxIterations() > 0;
+}
+
+float Fluid::ChebyshevWeight(int iteration, float spectralRadius, float lastWeight)
+{
+	float rho2 = spectralRadius * spectralRadius;
+
+	if (iteration == 0) return 1;
+	if (iteration == 1) return 2 / (2 - rho2);
+	return 1 / (1 - 0.25f * rho2 * lastWeight);
+}
+
+float Fluid::PressureSpectralRadius(int dimensions) const
+{
+	const float pi = 3.14159265f;
+	const float resolution[3] = { mOptions.SolverResolution.x, mOptions.SolverResolution.y, mOptions.SolverResolution.z };
+
+	//the slowest mode after the constant (which doesn't matter) is the longest cosine along one axis,
+	//constant along the others, so it's (cos(pi/N) + dimensions-1) / dimensions for the longest axis
+	float radius = 0;
+	for (int i = 0; i < dimensions; i++)
+	{
+		radius = max(radius, (cosf(pi / resolution[i]) + dimensions - 1) / dimensions);
+	}
+	return radius;
+}
+
 /** Accessors and Mutators */
 Vector Fluid::GetSize()
 {
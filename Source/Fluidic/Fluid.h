@@ -29,6 +29,7 @@ THE SOFTWARE.
 #include <string>
 
 #include "FluidOptions.h"
+#include "Vec.h"
 #include "Vector.h"
 
 namespace Fluidic
@@ -50,12 +51,12 @@ namespace Fluidic
 		 * @param cgHomeDir the directory to load the render programs from (TODO: Move into internal resource file)
 		 */
 		Fluid(std::string cgHomeDir);
-		~Fluid(void);
+		virtual ~Fluid(void);
 
 		/**
 		 * \brief Sets up the fluid with the given options. Can be called at any time. Will reset the fluid
 		 */
-		void Init(const FluidOptions &options, bool reloadPrograms=false);
+		virtual void Init(const FluidOptions &options, bool reloadPrograms=false);
 
 		/// Returns the size of the fluid
 		Vector GetSize();
@@ -81,6 +82,11 @@ namespace Fluidic
 		 * @param overwrite true to overwrite value, false to blend
 		 */
 		void Inject(const Vector &position, float r, float g, float b, float size, bool overwrite);
+		void Inject(const Vec2f &position, float r, float g, float b, float size, bool overwrite) { Inject(position.ToVector(), r, g, b, size, overwrite); }
+		void Inject(const Vec3f &position, float r, float g, float b, float size, bool overwrite) { Inject(position.ToVector(), r, g, b, size, overwrite); }
+
+		/// Inject at each of many positions (z is ignored by 2d fluids)
+		void Inject(const Vec3Array &positions, float r, float g, float b, float size, bool overwrite);
 
 		/**
 		 * \brief Perturbs a fluid at a position/radius
@@ -90,6 +96,11 @@ namespace Fluidic
 		 * @param size the radius of the circle
 		 */		
 		void Perturb(const Vector &position, const Vector &velocity, float size);
+		void Perturb(const Vec2f &position, const Vec2f &velocity, float size) { Perturb(position.ToVector(), velocity.ToVector(), size); }
+		void Perturb(const Vec3f &position, const Vec3f &velocity, float size) { Perturb(position.ToVector(), velocity.ToVector(), size); }
+
+		/// Perturb at each of many positions, each with the velocity of the same index (z is ignored by 2d fluids)
+		void Perturb(const Vec3Array &positions, const Vec3Array &velocities, float size);
 
 		/**
 		 * \brief Adds a square boundary of size at a location
@@ -137,12 +148,25 @@ namespace Fluidic
 
 		int GetSolveCount() { return mLastSolveCount; }
 
+		/// Iterations (or V-cycles) used by the pressure solve in the last solver step
+		int GetPressureIterations() { return mPressureIterations; }
+
+		/// Jacobi iterations used by the velocity and ink diffusion in the last solver step, together
+		int GetViscosityIterations() { return mViscosityIterations; }
+
 	protected:
 		static const int SolverCallListOffset = 0;
 		static const int RenderDataCallListOffset = 1;
 		static const int RenderCallListOffset = 2;
 
+		/**
+		 * \brief Constructor for fluids that are not solved on the GPU. No cg context is created,
+		 * so no GL calls are made until the fluid is rendered.
+		 */
+		Fluid();
+
 		// Methods
+		void SetOptions(const FluidOptions &options);
 		virtual void InitCallLists() = 0;
 		virtual void InitPrograms(const std::string &cgHomeDir) = 0;
 		virtual void InitTextures() = 0;
@@ -151,17 +175,55 @@ namespace Fluidic
 		void DestroyBuffers();
 		void DrawSolverQuad(const Vector &textureSize, const Vector &quadSize, float z);
 		
-		void SetupTexture(GLuint texId, GLuint internalFormat, Vector resolution, int components, char *initialData);
+		void SetupTexture(GLuint texId, GLuint internalFormat, Vector resolution, int components, char *initialData, GLenum type = GL_FLOAT);
+		/// Internal format of a 1 or 4 component texture stored at a precision (see FluidOptions::VelocityPrecision)
+		GLuint TextureFormat(FieldPrecision precision, int components) const;
 
 		virtual void UpdateStep(float time) {time=time;/*shush compiler noship*/ }
 
 		void SetOutputTexture(const int textureIndex);
 		void DoCalculationSolver(int &textureIndex);
 		void DoCalculationSolver1D(int &textureIndex);
+		/// As DoCalculationSolver1D, keeping the texture being replaced as previousIndex
+		void DoCalculationSolver1D(int &textureIndex, int &previousIndex);
 		void DoCalculationData(int &textureIndex);
+		/// Renders into both outputSolver and 'advected' at once, then swaps them with first and second
+		void DoCalculationSolver(int &first, int &second);
+
+		/**
+		 * \brief True when the ink should be advected along with the velocity this step
+		 *
+		 * The velocity is then advected at the end of the step, by the projected velocity the ink
+		 * uses. Needs RS_FUSED_ADVECTION with both advection steps, semi-lagrangian advection
+		 * (MacCormack has its own passes), and the ink at the solver resolution so the traces line up.
+		 * @param inkAtSolverResolution whether the ink has the same cells as the velocity
+		 */
+		bool FuseAdvection(bool inkAtSolverResolution) const;
+
+		/**
+		 * \brief True when the boundary passes are folded into the projection this step
+		 *
+		 * The divergence reads the velocity with its boundaries set, the last jacobi iteration sets the
+		 * pressure boundaries and the gradient subtraction the velocity's. Needs RS_FUSED_PROJECTION, the
+		 * plain jacobi pressure solver with at least 1 iteration, and no RS_ZCULL (the culled cells
+		 * would miss the boundaries).
+		 */
+		bool FuseProjection() const;
 
 		void SetBoundaryTextureStep();
 
+		/**
+		 * \brief Weight of a chebyshev accelerated jacobi iteration
+		 *
+		 * @param iteration the iteration, from 0
+		 * @param spectralRadius bound on the size of the jacobi iteration's eigenvalues (leaving out the constant)
+		 * @param lastWeight the weight of the last iteration
+		 */
+		static float ChebyshevWeight(int iteration, float spectralRadius, float lastWeight);
+
+		/// Spectral radius of the pressure jacobi iteration for the solver resolution, leaving out the constant
+		float PressureSpectralRadius(int dimensions) const;
+
 		static void CopyFromCPUtoGPU(GLuint textureTarget, GLuint texId, int texSizeX, int texSizeY, float *cpuData);
 
 		FluidOptions mOptions;
@@ -211,15 +273,23 @@ namespace Fluidic
 
 		// Simulation Programs
 		GPUProgram *mAdvect;
+		GPUProgram *mSimpleAdvect;
+		GPUProgram *mMacCormackAdvect;
+		GPUProgram *mFusedAdvect;
 		GPUProgram *mVorticity;
 		GPUProgram *mInject;
 		GPUProgram *mF1Boundary;
 		GPUProgram *mF4Boundary;
 		GPUProgram *mF1Jacobi;
+		GPUProgram *mF1JacobiBoundary; ///< the last pressure iteration with RS_FUSED_PROJECTION
 		GPUProgram *mF4Jacobi;
+		GPUProgram *mF1RedBlack;
+		GPUProgram *mF1ChebyshevJacobi;
 		GPUProgram *mDivField;
+		GPUProgram *mDivFieldBoundary;
 		GPUProgram *mRender;
 		GPUProgram *mSubtractPressureGradient;
+		GPUProgram *mSubtractPressureGradientBoundary;
 		GPUProgram *mOffset;
 		GPUProgram *mPerturb;
 		GPUProgram *mZCull;
@@ -231,7 +301,9 @@ namespace Fluidic
 		GLuint *mTextures;
 		int outputSolver;
 		int outputSolver1d;
+		int previousSolver1d; ///< the iteration before last, for PS_CHEBYSHEV_JACOBI
 		int outputRender;
+		int advected; ///< the first pass of AD_MACCORMACK, at the solver resolution
 
 		// Solver (3-component)
 		int velocity;
@@ -248,5 +320,7 @@ namespace Fluidic
 		// Timing
 		float mTimeDelta;
 		int mLastSolveCount;
+		int mPressureIterations;
+		int mViscosityIterations;
 	};
 }
\ No newline at end of file
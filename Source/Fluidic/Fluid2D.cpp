@@ -55,15 +55,23 @@ Fluid2D::~Fluid2D(void)
 void Fluid2D::DeletePrograms(void)
 {
 	delete mAdvect;
+	delete mSimpleAdvect;
+	delete mMacCormackAdvect;
+	delete mFusedAdvect;
 	delete mVorticity;
 	delete mInject;
 	delete mF1Boundary;
 	delete mF4Boundary;
 	delete mF1Jacobi;
+	delete mF1JacobiBoundary;
 	delete mF4Jacobi;
+	delete mF1RedBlack;
+	delete mF1ChebyshevJacobi;
 	delete mDivField;
+	delete mDivFieldBoundary;
 	delete mRender;
 	delete mSubtractPressureGradient;
+	delete mSubtractPressureGradientBoundary;
 	delete mOffset;
 	delete mPerturb;
 	delete mZCull;
@@ -82,11 +90,11 @@ FluidOptions Fluid2D::DefaultOptions()
 	return options;
 }
 void Fluid2D::InitTextures() {
-	mTextures = new GLuint[9];
+	mTextures = new GLuint[12];
 
 	//initialise and set up textures
-	glDeleteTextures(9, &mTextures[0]);
-	glGenTextures(9, &mTextures[0]);
+	glDeleteTextures(12, &mTextures[0]);
+	glGenTextures(12, &mTextures[0]);
 
 	//initial values for read and write textures
 	outputSolver = 0;
@@ -100,33 +108,43 @@ void Fluid2D::InitTextures() {
 	data = 7;
 	outputRender = 8;
 
-	bool doublePrecision = mOptions.GetOption(RS_DOUBLE_PRECISION);
-	int bits = doublePrecision ? 8 : 4;
+	previousSolver1d = 9;
+	advected = 10;
+	advectedRender = 11;
 
-	//4-component textures (RGBA) GL_RGBA16F_ARB | GL_RGBA16F_ARB
-	GLuint rgbaFormat = doublePrecision ? GL_RGBA32F_ARB : GL_RGBA16F_ARB;
+	//the zeroes are uploaded as GL_FLOAT, whatever the texture stores
+	int bits = sizeof(float);
+
+	//4-component textures (RGBA) GL_RGBA16F_ARB | GL_RGBA32F_ARB, each set swapping among themselves
+	GLuint velocityFormat = TextureFormat(mOptions.VelocityPrecision, 4);
+	GLuint inkFormat = TextureFormat(mOptions.InkPrecision, 4);
+	//fused advection swaps 'advected' into the ink, rather than using it for the velocity
+	const bool fuseAdvection = FuseAdvection(mOptions.RenderResolution.xi() == mOptions.SolverResolution.xi() &&
+											 mOptions.RenderResolution.yi() == mOptions.SolverResolution.yi());
 
 	int size = 4*bits*mOptions.SolverResolution.xi()*mOptions.SolverResolution.yi();
 	char *zeroData = new char[size];
 	memset(zeroData, 0, sizeof(char) * size);
 
 	//output
-	SetupTexture(mTextures[outputSolver], rgbaFormat, mOptions.SolverResolution, 4, zeroData);
-	SetupTexture(mTextures[velocity], rgbaFormat, mOptions.SolverResolution, 4, zeroData);
-	SetupTexture(mTextures[boundaries], rgbaFormat, mOptions.SolverResolution, 4, zeroData);
-	SetupTexture(mTextures[offset], rgbaFormat, mOptions.SolverResolution, 4, zeroData);
+	SetupTexture(mTextures[outputSolver], velocityFormat, mOptions.SolverResolution, 4, zeroData);
+	SetupTexture(mTextures[velocity], velocityFormat, mOptions.SolverResolution, 4, zeroData);
+	SetupTexture(mTextures[boundaries], velocityFormat, mOptions.SolverResolution, 4, zeroData);
+	SetupTexture(mTextures[offset], velocityFormat, mOptions.SolverResolution, 4, zeroData);
+	SetupTexture(mTextures[advected], fuseAdvection ? inkFormat : velocityFormat, mOptions.SolverResolution, 4, zeroData);
 	delete []zeroData;
 
 	size = 4*bits*mOptions.RenderResolution.xi()*mOptions.RenderResolution.yi();
 	zeroData = new char[size];
 	memset(zeroData, 0, sizeof(char) * size);
 	
-	SetupTexture(mTextures[data], rgbaFormat, mOptions.RenderResolution, 4, zeroData);
-	SetupTexture(mTextures[outputRender], rgbaFormat, mOptions.RenderResolution, 4, zeroData);
+	SetupTexture(mTextures[data], inkFormat, mOptions.RenderResolution, 4, zeroData);
+	SetupTexture(mTextures[outputRender], inkFormat, mOptions.RenderResolution, 4, zeroData);
+	SetupTexture(mTextures[advectedRender], inkFormat, mOptions.RenderResolution, 4, zeroData);
 	delete []zeroData;
 
 	//1-component textures (LUMINANCE) GL_LUMINANCE16F_ARB | GL_LUMINANCE32F_ARB
-	GLuint lumFormat = doublePrecision ? GL_LUMINANCE32F_ARB : GL_LUMINANCE16F_ARB;
+	GLuint lumFormat = TextureFormat(mOptions.PressurePrecision, 1);
 
 	size = bits*mOptions.SolverResolution.xi()*mOptions.SolverResolution.yi();
 	zeroData = new char[size];
@@ -135,6 +153,7 @@ void Fluid2D::InitTextures() {
 	SetupTexture(mTextures[pressure], lumFormat, mOptions.SolverResolution, 1, zeroData);
 	SetupTexture(mTextures[divField], lumFormat, mOptions.SolverResolution, 1, zeroData);
 	SetupTexture(mTextures[outputSolver1d], lumFormat, mOptions.SolverResolution, 1, zeroData);
+	SetupTexture(mTextures[previousSolver1d], lumFormat, mOptions.SolverResolution, 1, zeroData);
 	delete []zeroData;
 }
 
@@ -190,6 +209,9 @@ void Fluid2D::InitPrograms(const std::string &cgHomeDir)
 	GPUProgramLoader2D loader(cgHomeDir, mCgContext, mCgFragmentProfile);
 
 	mAdvect = loader.Advect();
+	mSimpleAdvect = loader.SimpleAdvect();
+	mMacCormackAdvect = loader.MacCormackAdvect();
+	mFusedAdvect = loader.FusedAdvect();
 	mVorticity = loader.Vorticity();
 	mInject = loader.Inject();
 	mPerturb = loader.Perturb();
@@ -197,9 +219,14 @@ void Fluid2D::InitPrograms(const std::string &cgHomeDir)
 	mF4Boundary = loader.F4Boundary();
 	mOffset = loader.Offset();
 	mF1Jacobi = loader.F1Jacobi();
+	mF1JacobiBoundary = loader.F1JacobiBoundary();
 	mF4Jacobi = loader.F4Jacobi();
+	mF1RedBlack = loader.F1RedBlack();
+	mF1ChebyshevJacobi = loader.F1ChebyshevJacobi();
 	mDivField = loader.DivField();
+	mDivFieldBoundary = loader.DivFieldBoundary();
 	mSubtractPressureGradient = loader.SubtractPressureGradient();
+	mSubtractPressureGradientBoundary = loader.SubtractPressureGradientBoundary();
 	mZCull = loader.ZCull();
 	mRender = loader.Render(mOptions);
 }
@@ -250,11 +277,16 @@ void Fluid2D::Update(float time)
 
 void Fluid2D::UpdateStep(float time) 
 {
+	mViscosityIterations = 0;
 	glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, mRenderbufferId);
 	PerturbDensityStep(time);
 
-	BoundaryVelocityStep();
-	if (mOptions.GetOption(RS_ADVECT_VELOCITY)) AdvectVelocityStep(time);
+	//fused, the divergence and gradient passes set the boundaries instead
+	const bool fuseProjection = FuseProjection();
+	if (!fuseProjection) BoundaryVelocityStep();
+	const bool fuseAdvection = FuseAdvection(mOptions.RenderResolution.xi() == mOptions.SolverResolution.xi() &&
+											 mOptions.RenderResolution.yi() == mOptions.SolverResolution.yi());
+	if (mOptions.GetOption(RS_ADVECT_VELOCITY) && !fuseAdvection) AdvectVelocityStep(time);
 	if (mOptions.GetOption(RS_VORTICITY_CONFINEMENT)) VorticityConfinementStep(time);
 	if (mOptions.GetOption(RS_ZCULL)) 
 	{
@@ -266,13 +298,15 @@ void Fluid2D::UpdateStep(float time)
 	UpdatePressureStep(time);
 
 	if (mOptions.GetOption(RS_ZCULL)) glDisable(GL_DEPTH_TEST);
-	BoundaryPressureStep();
+	if (!fuseProjection) BoundaryPressureStep();
 	SubtractPressureGradientStep(time);
 	
 	Poll(time);
 
 	glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, mRenderbufferDataId);
-	if (mOptions.GetOption(RS_ADVECT_DATA)) AdvectDataStep(time);
+	//fused, the velocity is advected here too, by the projected velocity the ink uses
+	if (fuseAdvection) AdvectVelocityAndDataStep(time);
+	else if (mOptions.GetOption(RS_ADVECT_DATA)) AdvectDataStep(time);
 	if (mOptions.GetOption(RS_DIFFUSE_DATA)) DiffuseDataStep(time);
 }
 
@@ -385,6 +419,28 @@ void Fluid2D::AdvectDataStep(float time)
 {
 	if (!ready) return;
 
+	if (mOptions.Advection == AD_MACCORMACK)
+	{
+		//a plain step back, then the correction
+		mSimpleAdvect->Bind();
+		mSimpleAdvect->SetParamTex("velocity", mTextures[velocity]);
+		mSimpleAdvect->SetParamTex("data", mTextures[data]);
+		mSimpleAdvect->SetParamTex("boundary", mTextures[boundaries]);
+		mSimpleAdvect->SetParam("d", mOptions.SolverDelta.x, mOptions.SolverDelta.y, 0, time);
+		mSimpleAdvect->SetParam("scale", mOptions.SolverToRenderScale.x, mOptions.SolverToRenderScale.y);
+		DoCalculationData(advectedRender);
+
+		mMacCormackAdvect->Bind();
+		mMacCormackAdvect->SetParamTex("velocity", mTextures[velocity]);
+		mMacCormackAdvect->SetParamTex("data", mTextures[data]);
+		mMacCormackAdvect->SetParamTex("advected", mTextures[advectedRender]);
+		mMacCormackAdvect->SetParamTex("boundary", mTextures[boundaries]);
+		mMacCormackAdvect->SetParam("d", mOptions.SolverDelta.x, mOptions.SolverDelta.y, 0, time);
+		mMacCormackAdvect->SetParam("scale", mOptions.SolverToRenderScale.x, mOptions.SolverToRenderScale.y);
+		DoCalculationData(data);
+		return;
+	}
+
 	mAdvect->Bind();
 
 	//params
@@ -401,6 +457,27 @@ void Fluid2D::AdvectVelocityStep(float time)
 {
 	if (!ready) return;
 
+	if (mOptions.Advection == AD_MACCORMACK)
+	{
+		mSimpleAdvect->Bind();
+		mSimpleAdvect->SetParamTex("velocity", mTextures[velocity]);
+		mSimpleAdvect->SetParamTex("data", mTextures[velocity]);
+		mSimpleAdvect->SetParamTex("boundary", mTextures[boundaries]);
+		mSimpleAdvect->SetParam("d", mOptions.SolverDelta.x, mOptions.SolverDelta.y, 0, time);
+		mSimpleAdvect->SetParam("scale", 1, 1);
+		DoCalculationSolver(advected);
+
+		mMacCormackAdvect->Bind();
+		mMacCormackAdvect->SetParamTex("velocity", mTextures[velocity]);
+		mMacCormackAdvect->SetParamTex("data", mTextures[velocity]);
+		mMacCormackAdvect->SetParamTex("advected", mTextures[advected]);
+		mMacCormackAdvect->SetParamTex("boundary", mTextures[boundaries]);
+		mMacCormackAdvect->SetParam("d", mOptions.SolverDelta.x, mOptions.SolverDelta.y, 0, time);
+		mMacCormackAdvect->SetParam("scale", 1, 1);
+		DoCalculationSolver(velocity);
+		return;
+	}
+
 	//params
 	mAdvect->Bind();
 	mAdvect->SetParamTex("velocity", mTextures[velocity]);
@@ -412,6 +489,20 @@ void Fluid2D::AdvectVelocityStep(float time)
 	DoCalculationSolver(velocity);
 }
 
+void Fluid2D::AdvectVelocityAndDataStep(float time)
+{
+	if (!ready) return;
+
+	//the ink is at the solver resolution, so both fit the solver's render targets
+	mFusedAdvect->Bind();
+	mFusedAdvect->SetParamTex("velocity", mTextures[velocity]);
+	mFusedAdvect->SetParamTex("data", mTextures[data]);
+	mFusedAdvect->SetParamTex("boundary", mTextures[boundaries]);
+	mFusedAdvect->SetParam("d", mOptions.SolverDelta.x, mOptions.SolverDelta.y, 0, time);
+
+	DoCalculationSolver(velocity, data);
+}
+
 void Fluid2D::VorticityConfinementStep(float time)
 {
 	if (!ready) return;
@@ -437,7 +528,7 @@ void Fluid2D::DiffuseDataStep(float time)
 	mF4Jacobi->SetParam("alpha", alpha);
 	mF4Jacobi->SetParam("beta", beta);
 
-	for (int i=0;i<mOptions.DiffuseSteps;i++)
+	for (int i=0;i<mOptions.GetViscosityMaxIterations();i++)
 	{
 		//if (i != 0) fbo->AttachTexture(GL_TEXTURE_RECTANGLE_ARB, mTextures[output]);
 		mF4Jacobi->SetParamTex("x", mTextures[data]);
@@ -446,6 +537,7 @@ void Fluid2D::DiffuseDataStep(float time)
 		glTranslatef(0, 0, -0.025f);
 		DoCalculationData(data);
 	}
+	mViscosityIterations += mOptions.GetViscosityMaxIterations();
 	glLoadIdentity();
 }
 
@@ -463,7 +555,7 @@ void Fluid2D::DiffuseVelocityStep(float time)
 	mF4Jacobi->SetParam("alpha", alpha);
 	mF4Jacobi->SetParam("beta", beta);
 
-	for (int i=0; i<mOptions.DiffuseSteps; i++)
+	for (int i=0; i<mOptions.GetViscosityMaxIterations(); i++)
 	{
 		mF4Jacobi->SetParamTex("x", mTextures[velocity]);
 		mF4Jacobi->SetParamTex("b", mTextures[velocity]);
@@ -472,6 +564,7 @@ void Fluid2D::DiffuseVelocityStep(float time)
 		DoCalculationSolver(velocity);
 	}
 
+	mViscosityIterations += mOptions.GetViscosityMaxIterations();
 	glLoadIdentity(); //restore matrix Z to 0 for z cull
 }
 
@@ -479,28 +572,85 @@ void Fluid2D::UpdatePressureStep(float time)
 {
 	if (!ready) return;
 
-	// Calculate Divergence Field 
-	mDivField->Bind();
+	// Calculate Divergence Field, setting the velocity boundaries on the way when they're fused
+	const bool fuseProjection = FuseProjection();
+	GPUProgram *divProgram = fuseProjection ? mDivFieldBoundary : mDivField;
+	divProgram->Bind();
 
-	mDivField->SetParamTex("velocity", mTextures[velocity]);
-	mDivField->SetParam("d", mOptions.SolverDelta.x, mOptions.SolverDelta.y, 0, time);
+	divProgram->SetParamTex("velocity", mTextures[velocity]);
+	if (fuseProjection)
+	{
+		divProgram->SetParamTex("offset", mTextures[offset]);
+		divProgram->SetParamTex("boundaries", mTextures[boundaries]);
+	}
+	divProgram->SetParam("d", mOptions.SolverDelta.x, mOptions.SolverDelta.y, 0, time);
 
 	DoCalculationSolver1D(divField);
 
-	// Find pressure using jacobi iterations
-	for (int i=0;i<mOptions.DiffuseSteps;i++)
+	if (mOptions.PressureSolver == PS_RED_BLACK_SOR)
 	{
-		mF1Jacobi->Bind();
-		mF1Jacobi->SetParam("alpha", -(mOptions.SolverDelta.x * mOptions.SolverDelta.y));
-		mF1Jacobi->SetParam("beta", 4.0);
-		mF1Jacobi->SetParamTex("b", mTextures[divField]);
-		mF1Jacobi->SetParamTex("x", mTextures[pressure]);
-		
-		glTranslatef(0, 0, -0.025f);
-		DoCalculationSolver1D(pressure);
+		// Find pressure using red-black SOR - each iteration is 2 half passes, the second
+		// reading the cells updated by the first
+		for (int i=0;i<mOptions.GetPressureMaxIterations();i++)
+		{
+			for (int parity=0;parity<2;parity++)
+			{
+				mF1RedBlack->Bind();
+				mF1RedBlack->SetParam("alpha", -(mOptions.SolverDelta.x * mOptions.SolverDelta.y));
+				mF1RedBlack->SetParam("beta", 4.0);
+				mF1RedBlack->SetParam("omega", mOptions.RelaxationFactor);
+				mF1RedBlack->SetParam("parity", (float)parity);
+				mF1RedBlack->SetParamTex("b", mTextures[divField]);
+				mF1RedBlack->SetParamTex("x", mTextures[pressure]);
+
+				glTranslatef(0, 0, -0.025f);
+				DoCalculationSolver1D(pressure);
+			}
+		}
+	}
+	else if (mOptions.PressureSolver == PS_CHEBYSHEV_JACOBI)
+	{
+		// Find pressure using jacobi iterations, each extrapolated from the one before last
+		const float spectralRadius = PressureSpectralRadius(2);
+		float omega = 1;
 
-		//bcPressure();
+		for (int i=0;i<mOptions.GetPressureMaxIterations();i++)
+		{
+			omega = ChebyshevWeight(i, spectralRadius, omega);
+
+			mF1ChebyshevJacobi->Bind();
+			mF1ChebyshevJacobi->SetParam("alpha", -(mOptions.SolverDelta.x * mOptions.SolverDelta.y));
+			mF1ChebyshevJacobi->SetParam("beta", 4.0);
+			mF1ChebyshevJacobi->SetParam("omega", omega);
+			mF1ChebyshevJacobi->SetParamTex("b", mTextures[divField]);
+			mF1ChebyshevJacobi->SetParamTex("x", mTextures[pressure]);
+			mF1ChebyshevJacobi->SetParamTex("previous", mTextures[i == 0 ? pressure : previousSolver1d]);
+
+			glTranslatef(0, 0, -0.025f);
+			DoCalculationSolver1D(pressure, previousSolver1d);
+		}
 	}
+	else
+	{
+		// Find pressure using jacobi iterations, the last setting the pressure boundaries when fused
+		for (int i=0;i<mOptions.GetPressureMaxIterations();i++)
+		{
+			const bool last = fuseProjection && i == mOptions.GetPressureMaxIterations() - 1;
+			GPUProgram *jacobi = last ? mF1JacobiBoundary : mF1Jacobi;
+			jacobi->Bind();
+			jacobi->SetParam("alpha", -(mOptions.SolverDelta.x * mOptions.SolverDelta.y));
+			jacobi->SetParam("beta", 4.0);
+			jacobi->SetParamTex("b", mTextures[divField]);
+			jacobi->SetParamTex("x", mTextures[pressure]);
+			if (last) jacobi->SetParamTex("offset", mTextures[offset]);
+			
+			glTranslatef(0, 0, -0.025f);
+			DoCalculationSolver1D(pressure);
+
+			//bcPressure();
+		}
+	}
+	mPressureIterations = mOptions.GetPressureMaxIterations();
 	glLoadIdentity();
 
 }
@@ -509,13 +659,20 @@ void Fluid2D::SubtractPressureGradientStep(float time)
 {
 	if (!ready) return;
 
-	//Subtract the pressure gradient
-	mSubtractPressureGradient->Bind();
+	//Subtract the pressure gradient, setting the velocity boundaries on the way when they're fused
+	const bool fuseProjection = FuseProjection();
+	GPUProgram *gradProgram = fuseProjection ? mSubtractPressureGradientBoundary : mSubtractPressureGradient;
+	gradProgram->Bind();
 
-	mSubtractPressureGradient->SetParamTex("velocity", mTextures[velocity]);
-	mSubtractPressureGradient->SetParamTex("pressure", mTextures[pressure]);
+	gradProgram->SetParamTex("velocity", mTextures[velocity]);
+	gradProgram->SetParamTex("pressure", mTextures[pressure]);
+	if (fuseProjection)
+	{
+		gradProgram->SetParamTex("offset", mTextures[offset]);
+		gradProgram->SetParamTex("boundaries", mTextures[boundaries]);
+	}
 
-	mSubtractPressureGradient->SetParam("d", mOptions.SolverDelta.x, mOptions.SolverDelta.y, 0, time);
+	gradProgram->SetParam("d", mOptions.SolverDelta.x, mOptions.SolverDelta.y, 0, time);
 
 	DoCalculationSolver(velocity);
 }
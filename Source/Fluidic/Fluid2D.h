@@ -60,6 +60,8 @@ namespace Fluidic
 
 		void AdvectDataStep(float time);
 		void AdvectVelocityStep(float time);
+		/// Both advection steps in one pass, for RS_FUSED_ADVECTION
+		void AdvectVelocityAndDataStep(float time);
 
 		void VorticityConfinementStep(float time);
 
@@ -88,5 +90,8 @@ namespace Fluidic
 			return 4 * (x + mOptions.RenderResolution.xi() * y);
 		}
 
+		/// The first pass of AD_MACCORMACK for the ink, at the render resolution
+		int advectedRender;
+
 	};
 }
\ No newline at end of file
@@ -55,15 +55,23 @@ Fluid3D::~Fluid3D(void)
 void Fluid3D::DeletePrograms(void)
 {
 	delete mAdvect;
+	delete mSimpleAdvect;
+	delete mMacCormackAdvect;
+	delete mFusedAdvect;
 	delete mVorticity;
 	delete mInject;
 	delete mF1Boundary;
 	delete mF4Boundary;
 	delete mF1Jacobi;
+	delete mF1JacobiBoundary;
 	delete mF4Jacobi;
+	delete mF1RedBlack;
+	delete mF1ChebyshevJacobi;
 	delete mDivField;
+	delete mDivFieldBoundary;
 	delete mRender;
 	delete mSubtractPressureGradient;
+	delete mSubtractPressureGradientBoundary;
 	delete mOffset;
 	delete mPerturb;
 	delete mZCull;
@@ -82,11 +90,11 @@ FluidOptions Fluid3D::DefaultOptions()
 }
 void Fluid3D::InitTextures() {
 
-	mTextures = new GLuint[11];
+	mTextures = new GLuint[12];
 
 	//initialise and set up textures
-	glDeleteTextures(10, &mTextures[0]);
-	glGenTextures(10, &mTextures[0]);
+	glDeleteTextures(12, &mTextures[0]);
+	glGenTextures(12, &mTextures[0]);
 
 	//initial values for read and write textures
 	outputSolver = 0;
@@ -102,12 +110,19 @@ void Fluid3D::InitTextures() {
 
 	backface = 9;
 
-	bool doublePrecision = mOptions.GetOption(RS_DOUBLE_PRECISION);
-	int bits = doublePrecision ? 8 : 4;
+	previousSolver1d = 10;
+	advected = 11;
+
+	//the zeroes are uploaded as GL_FLOAT, whatever the texture stores
+	int bits = sizeof(float);
 
 	// SOLVER TEXTURES
-	//4-component textures (RGBA) GL_RGBA16F_ARB | GL_RGBA32F_ARB
-	GLuint rgbaFormat = doublePrecision ? GL_RGBA32F_ARB : GL_RGBA16F_ARB;
+	//4-component textures (RGBA) GL_RGBA16F_ARB | GL_RGBA32F_ARB. The ink swaps with the velocity's
+	//output, so they share the finer of the two precisions
+	FieldPrecision solverPrecision = mOptions.GetPrecision(mOptions.VelocityPrecision, true) == FP_HALF ?
+		mOptions.InkPrecision : mOptions.VelocityPrecision;
+	GLuint rgbaFormat = TextureFormat(solverPrecision, 4);
+	GLuint inkFormat = TextureFormat(mOptions.InkPrecision, 4);
 
 	Vector solverTextureSize(Vector(mOptions.SolverResolution.x * mSlabs.xi(), mOptions.SolverResolution.y * mSlabs.yi()));
 	int size = 4*bits*solverTextureSize.xi()*solverTextureSize.yi();
@@ -121,10 +136,11 @@ void Fluid3D::InitTextures() {
 	SetupTexture(mTextures[divField], rgbaFormat, solverTextureSize, 4, zeroData);
 	SetupTexture(mTextures[boundaries], rgbaFormat, solverTextureSize, 4, zeroData);
 	SetupTexture(mTextures[offset], rgbaFormat, solverTextureSize, 4, zeroData);
+	SetupTexture(mTextures[advected], rgbaFormat, solverTextureSize, 4, zeroData);
 	delete []zeroData;
 
 	//1-component textures (LUMINANCE) GL_LUMINANCE16F_ARB | GL_LUMINANCE32F_ARB
-	GLuint lumFormat = doublePrecision ? GL_LUMINANCE32F_ARB : GL_LUMINANCE16F_ARB;
+	GLuint lumFormat = TextureFormat(mOptions.PressurePrecision, 1);
 
 	size = bits*solverTextureSize.xi()*solverTextureSize.yi();
 	zeroData = new char[size];
@@ -133,6 +149,7 @@ void Fluid3D::InitTextures() {
 	SetupTexture(mTextures[pressure], lumFormat, solverTextureSize, 1, zeroData);
 	SetupTexture(mTextures[divField], lumFormat, solverTextureSize, 1, zeroData);
 	SetupTexture(mTextures[outputSolver1d], lumFormat, solverTextureSize, 1, zeroData);
+	SetupTexture(mTextures[previousSolver1d], lumFormat, solverTextureSize, 1, zeroData);
 	delete []zeroData;
 
 	/// RENDER TEXTURES
@@ -140,8 +157,8 @@ void Fluid3D::InitTextures() {
 	zeroData = new char[size];
 	memset(zeroData, 0, sizeof(char) * size);
 	
-	SetupTexture(mTextures[backface], rgbaFormat, mOptions.RenderResolution, 4, zeroData);
-	SetupTexture(mTextures[outputRender], rgbaFormat, mOptions.RenderResolution, 4, zeroData);
+	SetupTexture(mTextures[backface], inkFormat, mOptions.RenderResolution, 4, zeroData);
+	SetupTexture(mTextures[outputRender], inkFormat, mOptions.RenderResolution, 4, zeroData);
 	delete []zeroData;
 
 	SetGlobalProgramParams();
@@ -273,6 +290,9 @@ void Fluid3D::InitPrograms(const std::string &cgHomeDir)
 	GPUProgramLoader3D loader(cgHomeDir, mCgContext, mCgVertexProfile,  mCgFragmentProfile);
 
 	mAdvect = loader.Advect();
+	mSimpleAdvect = loader.SimpleAdvect();
+	mMacCormackAdvect = loader.MacCormackAdvect();
+	mFusedAdvect = loader.FusedAdvect();
 	mVorticity = loader.Vorticity();
 	mInject = loader.Inject();
 	mPerturb = loader.Perturb();
@@ -280,9 +300,14 @@ void Fluid3D::InitPrograms(const std::string &cgHomeDir)
 	mF4Boundary = loader.F4Boundary();
 	mOffset = loader.Offset();
 	mF1Jacobi = loader.F1Jacobi();
+	mF1JacobiBoundary = loader.F1JacobiBoundary();
 	mF4Jacobi = loader.F4Jacobi();
+	mF1RedBlack = loader.F1RedBlack();
+	mF1ChebyshevJacobi = loader.F1ChebyshevJacobi();
 	mDivField = loader.DivField();
+	mDivFieldBoundary = loader.DivFieldBoundary();
 	mSubtractPressureGradient = loader.SubtractPressureGradient();
+	mSubtractPressureGradientBoundary = loader.SubtractPressureGradientBoundary();
 	mZCull = loader.ZCull();
 	mRender = loader.Render();
 
@@ -297,28 +322,44 @@ void Fluid3D::SetGlobalProgramParams()
 	      resY = mOptions.SolverResolution.y,
 	      resZ = mOptions.SolverResolution.z;
 	mAdvect->SetParam("res", resX, resY, resZ);
+	mSimpleAdvect->SetParam("res", resX, resY, resZ);
+	mMacCormackAdvect->SetParam("res", resX, resY, resZ);
+	mFusedAdvect->SetParam("res", resX, resY, resZ);
 	mVorticity->SetParam("res", resX, resY, resZ);
 	//mInject->SetParam("res", resX, resY, resZ);
 	mF1Boundary->SetParam("res", resX, resY, resZ);
 	mF4Boundary->SetParam("res", resX, resY, resZ);
 	mF1Jacobi->SetParam("res", resX, resY, resZ);
 	mF4Jacobi->SetParam("res", resX, resY, resZ);
+	mF1RedBlack->SetParam("res", resX, resY, resZ);
+	mF1ChebyshevJacobi->SetParam("res", resX, resY, resZ);
 	mDivField->SetParam("res", resX, resY, resZ);
 	mSubtractPressureGradient->SetParam("res", resX, resY, resZ);
+	mF1JacobiBoundary->SetParam("res", resX, resY, resZ);
+	mDivFieldBoundary->SetParam("res", resX, resY, resZ);
+	mSubtractPressureGradientBoundary->SetParam("res", resX, resY, resZ);
 	mOffset->SetParam("res", resX, resY, resZ);
 	mRaycastFProgram->SetParam("res", resX, resY, resZ);
 	//fixme illuminateProgram->SetParam("res", resX, resY, resZ);
 	
 	float slabsX = mSlabs.x, slabsY = mSlabs.y;
 	mAdvect->SetParam("slabs", slabsX, slabsY);
+	mSimpleAdvect->SetParam("slabs", slabsX, slabsY);
+	mMacCormackAdvect->SetParam("slabs", slabsX, slabsY);
+	mFusedAdvect->SetParam("slabs", slabsX, slabsY);
 	mVorticity->SetParam("slabs", slabsX, slabsY);
 	//mInject->SetParam("slabs", slabsX, slabsY);
 	mF1Boundary->SetParam("slabs", slabsX, slabsY);
 	mF4Boundary->SetParam("slabs", slabsX, slabsY);
 	mF1Jacobi->SetParam("slabs", slabsX, slabsY);
 	mF4Jacobi->SetParam("slabs", slabsX, slabsY);
+	mF1RedBlack->SetParam("slabs", slabsX, slabsY);
+	mF1ChebyshevJacobi->SetParam("slabs", slabsX, slabsY);
 	mDivField->SetParam("slabs", slabsX, slabsY);
 	mSubtractPressureGradient->SetParam("slabs", slabsX, slabsY);
+	mF1JacobiBoundary->SetParam("slabs", slabsX, slabsY);
+	mDivFieldBoundary->SetParam("slabs", slabsX, slabsY);
+	mSubtractPressureGradientBoundary->SetParam("slabs", slabsX, slabsY);
 	mOffset->SetParam("slabs", slabsX, slabsY);
 	mRaycastFProgram->SetParam("slabs", slabsX, slabsY);
 	//fixme illuminateProgram->SetParam("slabs", slabsX, slabsY);
@@ -366,11 +407,15 @@ void Fluid3D::Update(float time)
 
 void Fluid3D::UpdateStep(float time)
 {
+	mViscosityIterations = 0;
 	//glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, mRenderbufferId);
 	PerturbDensityStep(time);
-	BoundaryVelocityStep();
+	//fused, the divergence and gradient passes set the boundaries instead
+	const bool fuseProjection = FuseProjection();
+	if (!fuseProjection) BoundaryVelocityStep();
 	if (mOptions.GetOption(RS_VORTICITY_CONFINEMENT)) VorticityConfinementStep(time);
-	if (mOptions.GetOption(RS_ADVECT_VELOCITY)) AdvectVelocityStep(time);
+	const bool fuseAdvection = FuseAdvection(true);
+	if (mOptions.GetOption(RS_ADVECT_VELOCITY) && !fuseAdvection) AdvectVelocityStep(time);
 	
 	if (mOptions.GetOption(RS_ZCULL)) 
 	{
@@ -381,12 +426,14 @@ void Fluid3D::UpdateStep(float time)
 
 	UpdatePressureStep(time);
 	if (mOptions.GetOption(RS_ZCULL)) glDisable(GL_DEPTH_TEST);
-	BoundaryPressureStep();
+	if (!fuseProjection) BoundaryPressureStep();
 	SubtractPressureGradientStep(time);
 
 	Poll(time);
 
-	if (mOptions.GetOption(RS_ADVECT_DATA)) AdvectDataStep(time);
+	//fused, the velocity is advected here too, by the projected velocity the ink uses
+	if (fuseAdvection) AdvectVelocityAndDataStep(time);
+	else if (mOptions.GetOption(RS_ADVECT_DATA)) AdvectDataStep(time);
 	if (mOptions.GetOption(RS_DIFFUSE_DATA)) DiffuseDataStep(time);
 }
 
@@ -592,6 +639,12 @@ void Fluid3D::AdvectDataStep(float time)
 {
 	if (!ready) return;
 
+	if (mOptions.Advection == AD_MACCORMACK)
+	{
+		MacCormackAdvect(data, time);
+		return;
+	}
+
 	mAdvect->Bind();
 
 	//params
@@ -607,6 +660,12 @@ void Fluid3D::AdvectVelocityStep(float time)
 {
 	if (!ready) return;
 
+	if (mOptions.Advection == AD_MACCORMACK)
+	{
+		MacCormackAdvect(velocity, time);
+		return;
+	}
+
 	mAdvect->Bind();
 
 	//params
@@ -618,6 +677,40 @@ void Fluid3D::AdvectVelocityStep(float time)
 	DoCalculationSolver(velocity);
 }
 
+void Fluid3D::AdvectVelocityAndDataStep(float time)
+{
+	if (!ready) return;
+
+	mFusedAdvect->Bind();
+
+	//params
+	mFusedAdvect->SetParamTex("boundary", mTextures[boundaries]);
+	mFusedAdvect->SetParamTex("velocity", mTextures[velocity]);
+	mFusedAdvect->SetParamTex("data", mTextures[data]);
+	mFusedAdvect->SetParam("d", mOptions.SolverDelta.x, mOptions.SolverDelta.y, mOptions.SolverDelta.z, time);
+
+	DoCalculationSolver(velocity, data);
+}
+
+// A plain step back into 'advected', then the correction back into textureIndex
+void Fluid3D::MacCormackAdvect(int &textureIndex, float time)
+{
+	mSimpleAdvect->Bind();
+	mSimpleAdvect->SetParamTex("boundary", mTextures[boundaries]);
+	mSimpleAdvect->SetParamTex("velocity", mTextures[velocity]);
+	mSimpleAdvect->SetParamTex("data", mTextures[textureIndex]);
+	mSimpleAdvect->SetParam("d", mOptions.SolverDelta.x, mOptions.SolverDelta.y, mOptions.SolverDelta.z, time);
+	DoCalculationSolver(advected);
+
+	mMacCormackAdvect->Bind();
+	mMacCormackAdvect->SetParamTex("boundary", mTextures[boundaries]);
+	mMacCormackAdvect->SetParamTex("velocity", mTextures[velocity]);
+	mMacCormackAdvect->SetParamTex("data", mTextures[textureIndex]);
+	mMacCormackAdvect->SetParamTex("advected", mTextures[advected]);
+	mMacCormackAdvect->SetParam("d", mOptions.SolverDelta.x, mOptions.SolverDelta.y, mOptions.SolverDelta.z, time);
+	DoCalculationSolver(textureIndex);
+}
+
 void Fluid3D::VorticityConfinementStep(float time)
 {
 	if (!ready) return;
@@ -641,7 +734,7 @@ void Fluid3D::DiffuseDataStep(float time)
 	mF4Jacobi->SetParam("alpha", alpha);
 	mF4Jacobi->SetParam("beta", beta);
 
-	for (int i=0;i<mOptions.DiffuseSteps;i++)
+	for (int i=0;i<mOptions.GetViscosityMaxIterations();i++)
 	{
 		mF4Jacobi->SetParamTex("x", mTextures[data]);
 		mF4Jacobi->SetParamTex("b", mTextures[data]);
@@ -649,6 +742,7 @@ void Fluid3D::DiffuseDataStep(float time)
 		glTranslatef(0, 0, -0.025f);
 		DoCalculationSolver(data);
 	}
+	mViscosityIterations += mOptions.GetViscosityMaxIterations();
 	glLoadIdentity();
 }
 
@@ -664,7 +758,7 @@ void Fluid3D::DiffuseVelocityStep(float time)
 	mF4Jacobi->SetParam("alpha", alpha);
 	mF4Jacobi->SetParam("beta", beta);
 
-	for (int i=0; i<mOptions.DiffuseSteps; i++)
+	for (int i=0; i<mOptions.GetViscosityMaxIterations(); i++)
 	{
 		mF4Jacobi->SetParamTex("x", mTextures[velocity]);
 		mF4Jacobi->SetParamTex("b", mTextures[velocity]);
@@ -673,6 +767,7 @@ void Fluid3D::DiffuseVelocityStep(float time)
 		DoCalculationSolver(velocity);
 	}
 
+	mViscosityIterations += mOptions.GetViscosityMaxIterations();
 	glLoadIdentity(); //restore matrix Z to 0 for z cull
 }
 
@@ -680,29 +775,85 @@ void Fluid3D::UpdatePressureStep(float time)
 {
 	if (!ready) return;
 
-	// Calculate Divergence Field 
-	mDivField->Bind();
+	// Calculate Divergence Field, setting the velocity boundaries on the way when they're fused
+	const bool fuseProjection = FuseProjection();
+	GPUProgram *divProgram = fuseProjection ? mDivFieldBoundary : mDivField;
+	divProgram->Bind();
 
-	mDivField->SetParamTex("velocity", mTextures[velocity]);
-	mDivField->SetParam("d", mOptions.SolverDelta.x, mOptions.SolverDelta.y, mOptions.SolverDelta.z, time);
+	divProgram->SetParamTex("velocity", mTextures[velocity]);
+	if (fuseProjection)
+	{
+		divProgram->SetParamTex("offset", mTextures[offset]);
+	}
+	divProgram->SetParam("d", mOptions.SolverDelta.x, mOptions.SolverDelta.y, mOptions.SolverDelta.z, time);
 
 	DoCalculationSolver1D(divField);
 
-	// Find pressure using jacobi iterations
-	for (int i=0;i<mOptions.DiffuseSteps;i++)
+	if (mOptions.PressureSolver == PS_RED_BLACK_SOR)
 	{
-		mF1Jacobi->Bind();
-		//tfsbad what about dz?
-		mF1Jacobi->SetParam("alpha", -(mOptions.SolverDelta.x * mOptions.SolverDelta.y));
-		mF1Jacobi->SetParam("beta", 6.0);
-		mF1Jacobi->SetParamTex("b", mTextures[divField]);
-		mF1Jacobi->SetParamTex("x", mTextures[pressure]);
-		
-		glTranslatef(0, 0, -0.025f);
-		DoCalculationSolver1D(pressure);
+		// Find pressure using red-black SOR - each iteration is 2 half passes, the second
+		// reading the cells updated by the first
+		for (int i=0;i<mOptions.GetPressureMaxIterations();i++)
+		{
+			for (int parity=0;parity<2;parity++)
+			{
+				mF1RedBlack->Bind();
+				mF1RedBlack->SetParam("alpha", -(mOptions.SolverDelta.x * mOptions.SolverDelta.y));
+				mF1RedBlack->SetParam("beta", 6.0);
+				mF1RedBlack->SetParam("omega", mOptions.RelaxationFactor);
+				mF1RedBlack->SetParam("parity", (float)parity);
+				mF1RedBlack->SetParamTex("b", mTextures[divField]);
+				mF1RedBlack->SetParamTex("x", mTextures[pressure]);
+
+				glTranslatef(0, 0, -0.025f);
+				DoCalculationSolver1D(pressure);
+			}
+		}
+	}
+	else if (mOptions.PressureSolver == PS_CHEBYSHEV_JACOBI)
+	{
+		// Find pressure using jacobi iterations, each extrapolated from the one before last
+		const float spectralRadius = PressureSpectralRadius(3);
+		float omega = 1;
 
-		//bcPressure();
+		for (int i=0;i<mOptions.GetPressureMaxIterations();i++)
+		{
+			omega = ChebyshevWeight(i, spectralRadius, omega);
+
+			mF1ChebyshevJacobi->Bind();
+			mF1ChebyshevJacobi->SetParam("alpha", -(mOptions.SolverDelta.x * mOptions.SolverDelta.y));
+			mF1ChebyshevJacobi->SetParam("beta", 6.0);
+			mF1ChebyshevJacobi->SetParam("omega", omega);
+			mF1ChebyshevJacobi->SetParamTex("b", mTextures[divField]);
+			mF1ChebyshevJacobi->SetParamTex("x", mTextures[pressure]);
+			mF1ChebyshevJacobi->SetParamTex("previous", mTextures[i == 0 ? pressure : previousSolver1d]);
+
+			glTranslatef(0, 0, -0.025f);
+			DoCalculationSolver1D(pressure, previousSolver1d);
+		}
 	}
+	else
+	{
+		// Find pressure using jacobi iterations, the last setting the pressure boundaries when fused
+		for (int i=0;i<mOptions.GetPressureMaxIterations();i++)
+		{
+			const bool last = fuseProjection && i == mOptions.GetPressureMaxIterations() - 1;
+			GPUProgram *jacobi = last ? mF1JacobiBoundary : mF1Jacobi;
+			jacobi->Bind();
+			//tfsbad what about dz?
+			jacobi->SetParam("alpha", -(mOptions.SolverDelta.x * mOptions.SolverDelta.y));
+			jacobi->SetParam("beta", 6.0);
+			jacobi->SetParamTex("b", mTextures[divField]);
+			jacobi->SetParamTex("x", mTextures[pressure]);
+			if (last) jacobi->SetParamTex("offset", mTextures[offset]);
+			
+			glTranslatef(0, 0, -0.025f);
+			DoCalculationSolver1D(pressure);
+
+			//bcPressure();
+		}
+	}
+	mPressureIterations = mOptions.GetPressureMaxIterations();
 	glLoadIdentity();
 }
 
@@ -710,12 +861,18 @@ void Fluid3D::SubtractPressureGradientStep(float time)
 {
 	if (!ready) return;
 	
-	//Subtract the pressure gradient
-	mSubtractPressureGradient->Bind();
-
-	mSubtractPressureGradient->SetParamTex("velocity", mTextures[velocity]);
-	mSubtractPressureGradient->SetParamTex("pressure", mTextures[pressure]);
-	mSubtractPressureGradient->SetParam("d", mOptions.SolverDelta.x, mOptions.SolverDelta.y, mOptions.SolverDelta.z, time);
+	//Subtract the pressure gradient, setting the velocity boundaries on the way when they're fused
+	const bool fuseProjection = FuseProjection();
+	GPUProgram *gradProgram = fuseProjection ? mSubtractPressureGradientBoundary : mSubtractPressureGradient;
+	gradProgram->Bind();
+
+	gradProgram->SetParamTex("velocity", mTextures[velocity]);
+	gradProgram->SetParamTex("pressure", mTextures[pressure]);
+	if (fuseProjection)
+	{
+		gradProgram->SetParamTex("offset", mTextures[offset]);
+	}
+	gradProgram->SetParam("d", mOptions.SolverDelta.x, mOptions.SolverDelta.y, mOptions.SolverDelta.z, time);
 
 	DoCalculationSolver(velocity);
 }
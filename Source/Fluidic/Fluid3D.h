@@ -82,6 +82,10 @@ namespace Fluidic
 
 		void AdvectDataStep(float time);
 		void AdvectVelocityStep(float time);
+		/// Both advection steps in one pass, for RS_FUSED_ADVECTION
+		void AdvectVelocityAndDataStep(float time);
+		/// Both passes of AD_MACCORMACK on the given solver texture
+		void MacCormackAdvect(int &textureIndex, float time);
 
 		void VorticityConfinementStep(float time);
 
@@ -0,0 +1,1684 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "FluidCPU2D.h"
+
+#ifdef _OPENMP
+	#include <omp.h>
+#endif
+
+#include "CPUKernels.h"
+#include "IVelocityPoller.h"
+
+using namespace std;
+using namespace Fluidic;
+
+namespace
+{
+	/// One jacobi iteration for a single cell of a 1 component row, clamping at the ends of the row
+	inline float Jacobi1Cell(const float *row, const float *up, const float *down, const float *b,
+							 int x, int width, float alpha, float invBeta)
+	{
+		float left = row[x > 0 ? x-1 : 0];
+		float right = row[x < width-1 ? x+1 : width-1];
+		return (left + right + up[x] + down[x] + alpha*b[x]) * invBeta;
+	}
+
+	/**
+	 * One jacobi iteration for a 1 component row, 4 cells at a time. With ghosts (rows of a padded
+	 * field) the whole row is done that way and the output's ghost cells are set on the way;
+	 * without, the ends of the row are clamped. With tiles (a TileMask::TileRow), the cells of
+	 * inactive tiles are left alone.
+	 */
+	inline void Jacobi1Row(const float *row, const float *up, const float *down, const float *b, float *out,
+						   int width, float alpha, float invBeta, const unsigned char *tiles, int shift, bool ghosts)
+	{
+		const __m128 alpha4 = _mm_set1_ps(alpha);
+		const __m128 invBeta4 = _mm_set1_ps(invBeta);
+
+		int c = 0, end = width;
+		if (!ghosts)
+		{
+			if (!tiles || tiles[0]) out[0] = Jacobi1Cell(row, up, down, b, 0, width, alpha, invBeta);
+			c = 1;
+			end = width - 1;
+		}
+
+		for (; c + 4 <= end; c += 4)
+		{
+			if (tiles && !tiles[c >> shift] && !tiles[(c+3) >> shift]) continue;
+
+			__m128 sum = _mm_add_ps(
+				_mm_add_ps(_mm_loadu_ps(row + c-1), _mm_loadu_ps(row + c+1)),
+				_mm_add_ps(_mm_loadu_ps(up + c), _mm_loadu_ps(down + c)));
+			sum = _mm_add_ps(sum, _mm_mul_ps(alpha4, _mm_loadu_ps(b + c)));
+
+			_mm_storeu_ps(out + c, _mm_mul_ps(sum, invBeta4));
+		}
+		for (; c < end; c++)
+		{
+			if (tiles && !tiles[c >> shift]) continue;
+			out[c] = (row[c-1] + row[c+1] + up[c] + down[c] + alpha*b[c]) * invBeta;
+		}
+
+		if (ghosts)
+		{
+			out[-1] = out[0];
+			out[width] = out[width-1];
+		}
+		else if (width > 1 && (!tiles || tiles[(width-1) >> shift]))
+		{
+			out[width-1] = Jacobi1Cell(row, up, down, b, width-1, width, alpha, invBeta);
+		}
+	}
+
+	/// One jacobi iteration for a single cell of an interleaved 4 component row, reading the given left and right cells
+	inline __m128 Jacobi4Cell(const float *row, const float *up, const float *down, const float *b,
+							  int x, int left, int right, __m128 alpha4, __m128 invBeta4)
+	{
+		__m128 sum = _mm_add_ps(
+			_mm_add_ps(_mm_load_ps(row + 4*left), _mm_load_ps(row + 4*right)),
+			_mm_add_ps(_mm_load_ps(up + 4*x), _mm_load_ps(down + 4*x)));
+		sum = _mm_add_ps(sum, _mm_mul_ps(alpha4, _mm_load_ps(b + 4*x)));
+		return _mm_mul_ps(sum, invBeta4);
+	}
+
+	/**
+	 * One jacobi iteration for an interleaved 4 component row. The end cells are clamped, so the
+	 * rest of the row reads its neighbours directly. Tiles are as Jacobi1Row.
+	 */
+	inline void Jacobi4Row(const float *row, const float *up, const float *down, const float *b, float *out,
+						   int width, __m128 alpha4, __m128 invBeta4, const unsigned char *tiles, int shift)
+	{
+		const int last = width - 1;
+		if (!tiles || tiles[0])
+		{
+			_mm_store_ps(out, Jacobi4Cell(row, up, down, b, 0, 0, last > 0 ? 1 : 0, alpha4, invBeta4));
+		}
+
+		for (int c = 1; c < last; c++)
+		{
+			if (tiles && !tiles[c >> shift]) continue;
+			_mm_store_ps(out + 4*c, Jacobi4Cell(row, up, down, b, c, c-1, c+1, alpha4, invBeta4));
+		}
+
+		if (last > 0 && (!tiles || tiles[last >> shift]))
+		{
+			_mm_store_ps(out + 4*last, Jacobi4Cell(row, up, down, b, last, last-1, last, alpha4, invBeta4));
+		}
+	}
+
+	/**
+	 * The divergence of a single cell of a velocity row, reading the given left and right cells.
+	 * up and down point at the y components of the neighbouring rows; cell is the field's CellPitch.
+	 */
+	inline float DivergenceCell(const float *row, const float *up, const float *down, int x, int left, int right,
+								int cell, float halfInvDX, float halfInvDY)
+	{
+		return (row[right * cell] - row[left * cell]) * halfInvDX + (up[x * cell] - down[x * cell]) * halfInvDY;
+	}
+
+	/// The divergence of a velocity row, peeled like Jacobi4Row. Cells of inactive tiles get 0.
+	inline void DivergenceRow(const float *row, const float *up, const float *down, float *div, int width, int cell,
+							  float halfInvDX, float halfInvDY, const unsigned char *tiles, int shift)
+	{
+		const int last = width - 1;
+		div[0] = !tiles || tiles[0] ? DivergenceCell(row, up, down, 0, 0, last > 0 ? 1 : 0, cell, halfInvDX, halfInvDY) : 0;
+
+		for (int x = 1; x < last; x++)
+		{
+			div[x] = !tiles || tiles[x >> shift] ? DivergenceCell(row, up, down, x, x-1, x+1, cell, halfInvDX, halfInvDY) : 0;
+		}
+
+		if (last > 0)
+		{
+			div[last] = !tiles || tiles[last >> shift] ?
+				DivergenceCell(row, up, down, last, last-1, last, cell, halfInvDX, halfInvDY) : 0;
+		}
+	}
+
+	/**
+	 * Vorticity2D for a single cell of a velocity row, reading the given left and right cells. The
+	 * output field has the velocity's layout.
+	 */
+	inline void VorticityCell(const CPUField &velocity, CPUField &output, const float *row, const float *up, const float *down,
+							  float *out, int x, int left, int right, float scaleX, float scaleY)
+	{
+		const int cell = velocity.CellPitch();
+		const int pitch = velocity.ComponentPitch();
+
+		float *o = out + x * cell;
+		F4Store(output, o, F4Load(velocity, row + x * cell));
+		o[0] += scaleX * (row[right * cell] + row[left * cell]);
+		o[pitch] += scaleY * (up[x * cell + pitch] + down[x * cell + pitch]);
+	}
+}
+
+FluidCPU2D::FluidCPU2D() :
+Fluid(), mOffsetsDirty(true), mHasObstacles(false), mRenderTexture(0)
+{
+	mDensities[0] = mDensities[1] = mDensities[2] = 0;
+}
+
+FluidCPU2D::~FluidCPU2D(void)
+{
+	if (mRenderTexture) glDeleteTextures(1, &mRenderTexture);
+}
+
+FluidOptions FluidCPU2D::DefaultOptions()
+{
+	FluidOptions options;
+	options.Size = Vector(1,1);
+	options.SolverResolution = Vector(200, 200);
+	options.RenderResolution = Vector(400, 400);
+	options.Viscosity = ViscosityAir;
+	options.SolverOptions = RS_NICE;
+	options.RenderOptions = RR_NONE;
+	options.DiffuseSteps = 30;
+	options.FixedTimeInterval = 0.005f;
+	options.SolverThreads = 0;
+	return options;
+}
+
+void FluidCPU2D::Init(const FluidOptions &options, bool)
+{
+	SetOptions(options);
+
+	ready = 0;
+
+#ifdef _OPENMP
+	if (mOptions.SolverThreads > 0) omp_set_num_threads(mOptions.SolverThreads);
+#endif
+
+	InitTextures();
+	ready = 1;
+
+	mTimeDelta = 0.f;
+	mLastSolveCount = 0;
+}
+
+void FluidCPU2D::InitTextures()
+{
+	int resX = mOptions.SolverResolution.xi(), resY = mOptions.SolverResolution.yi();
+
+	//4-component fields, but the velocity is 2 planes with FL_PLANAR
+	const FieldLayout layout = mOptions.VelocityLayout;
+	const int velocityComponents = layout == FL_PLANAR ? 2 : 4;
+	mVelocity.Resize(resX, resY, 1, velocityComponents, 0, layout);
+	mOutputSolver.Resize(resX, resY, 1, velocityComponents, 0, layout);
+	mVelocitySource.Resize(resX, resY, 1, velocityComponents, 0, layout);
+
+	//1-component fields. The pressure ones are padded, for the stencils to read past the edges
+	mPressure.Resize(resX, resY, 1, 1, 1);
+	mDivField.Resize(resX, resY, 1, 1, 1);
+	mBoundaryField.Resize(resX, resY, 1, 1);
+	mOutputSolver1d.Resize(resX, resY, 1, 1, 1);
+	if (mOptions.PressureRefinements > 0)
+	{
+		mCorrection.Resize(resX, resY, 1, 1, 1);
+		mCorrectionSource.Resize(resX, resY, 1, 1, 1);
+	}
+	mUnpaddedPressure.Resize(resX, resY, 1, 1);
+	mUnpaddedDivField.Resize(resX, resY, 1, 1);
+
+	//data fields, which can be halves
+	const FieldPrecision inkPrecision = mOptions.GetPrecision(mOptions.InkPrecision, false);
+	mData.Resize(mOptions.RenderResolution.xi(), mOptions.RenderResolution.yi(), 1, 4, 0, FL_INTERLEAVED, inkPrecision);
+	mOutputRender.Resize(mOptions.RenderResolution.xi(), mOptions.RenderResolution.yi(), 1, 4, 0, FL_INTERLEAVED, inkPrecision);
+	mChannels.Resize(resX, resY, 1);
+	mTiles.Resize(resX, resY, 1);
+	mStaggered.Resize(resX, resY, 1);
+
+	mOffsetsDirty = true;
+}
+
+CPUField &FluidCPU2D::JacobiSource(const CPUField &field)
+{
+	//the velocity has its own, as it can be planar
+	if (&field == &mVelocity) return mVelocitySource;
+
+	if (!mJacobiSource.SameShape(field)) mJacobiSource.ResizeLike(field);
+	return mJacobiSource;
+}
+
+/** Render and Updates */
+void FluidCPU2D::Update(float time)
+{
+	if (!ready) return;
+
+	//Do the interactiony stuff
+	InjectInkStep();
+	InjectChannelsStep();
+	PerturbFluidStep();
+	UpdateArbitraryBoundaryStep();
+	UpdateOffsetStep();
+
+	mLastSolveCount = 0;
+	if (mOptions.FixedTimeInterval == 0)
+	{
+		if (time > 0) 
+		{
+			UpdateStep(time);
+			mLastSolveCount++;
+		}
+	}
+	else
+	{
+		mTimeDelta += time;
+		while (mTimeDelta > mOptions.FixedTimeInterval && mLastSolveCount < 10)
+		{
+			UpdateStep(mOptions.FixedTimeInterval);
+			mTimeDelta -= mOptions.FixedTimeInterval;
+			mLastSolveCount++;
+		}
+	}
+}
+
+void FluidCPU2D::UpdateStep(float time) 
+{
+	mViscosityIterations = 0;
+
+	if (mOptions.GetOption(RS_STAGGERED_VELOCITY))
+	{
+		StaggeredUpdateStep(time);
+		return;
+	}
+
+	PerturbDensityStep(time);
+	UpdateTilesStep();
+
+	// RS_ZCULL needs the depth buffer, so it is ignored on the CPU. So is RS_FUSED_PROJECTION: the
+	// boundary steps only visit the boundary cells here, so there's no full pass to fold away
+	BoundaryVelocityStep();
+	const bool fuseAdvection = FuseAdvection(mOptions.RenderResolution.xi() == mOptions.SolverResolution.xi() &&
+											 mOptions.RenderResolution.yi() == mOptions.SolverResolution.yi());
+	if (mOptions.GetOption(RS_ADVECT_VELOCITY) && !fuseAdvection) AdvectVelocityStep(time);
+	if (mOptions.GetOption(RS_VORTICITY_CONFINEMENT)) VorticityConfinementStep(time);
+	if (mOptions.GetOption(RS_DIFFUSE_VELOCITY)) DiffuseVelocityStep(time);
+
+	UpdatePressureStep(time);
+
+	BoundaryPressureStep();
+	SubtractPressureGradientStep(time);
+	
+	Poll(time);
+
+	//fused, the velocity is advected here too, by the projected velocity the ink uses
+	if (fuseAdvection) AdvectVelocityAndDataStep(time);
+	else if (mOptions.GetOption(RS_ADVECT_DATA)) AdvectDataStep(time);
+	if (mOptions.GetOption(RS_ADVECT_DATA)) AdvectChannelsStep(time);
+	if (mOptions.GetOption(RS_DIFFUSE_DATA)) DiffuseDataStep(time);
+	DiffuseChannelsStep(time);
+}
+
+// UpdateStep with the velocity on the faces. The buoyancy, vorticity and interaction still push the
+// cell velocity, and Stagger carries what they add over to the faces before they're advected,
+// diffused and projected. The projection's boundaries are set on the faces themselves, so the
+// boundary cell lists aren't used. Solid cells are solved as fluid, with the faces into them held
+// at 0.
+void FluidCPU2D::StaggeredUpdateStep(float time)
+{
+	if (!ready) return;
+
+	const float invDelta[3] = { 1.f / mOptions.SolverDelta.x, 1.f / mOptions.SolverDelta.y, 0 };
+
+	PerturbDensityStep(time);
+	UpdateTilesStep();
+
+	if (mOptions.GetOption(RS_VORTICITY_CONFINEMENT)) VorticityConfinementStep(time);
+	mStaggered.Stagger(mVelocity);
+
+	if (mOptions.GetOption(RS_ADVECT_VELOCITY))
+	{
+		const float alpha[3] = { time * invDelta[0], time * invDelta[1], 0 };
+		mStaggered.Advect(mBoundaryField, alpha);
+	}
+
+	if (mOptions.GetOption(RS_DIFFUSE_VELOCITY))
+	{
+		//each component on its own grid, with the same equation as DiffuseVelocityStep
+		float alpha = mOptions.SolverDelta.x*mOptions.SolverDelta.y / (time * mOptions.Viscosity);
+		float beta = 4 + alpha;
+
+		for (int a = 0; a < 2; a++)
+		{
+			CPUField &source = mStaggered.Source(a);
+			source.CopyFrom(mStaggered.Face(a));
+			mViscosityIterations += Jacobi1(mStaggered.Face(a), source, mStaggered.Output(a), alpha, beta,
+				mOptions.GetViscosityMaxIterations(), mOptions.ViscosityTolerance);
+		}
+	}
+
+	mStaggered.SetBoundaries(mBoundaryField, mHasObstacles);
+	mStaggered.Divergence(mDivField, invDelta);
+	SolvePressure();
+	mStaggered.SubtractGradient(mPressure, invDelta);
+	mStaggered.SetBoundaries(mBoundaryField, mHasObstacles);
+	mStaggered.Centre(mVelocity);
+
+	Poll(time);
+
+	if (mOptions.GetOption(RS_ADVECT_DATA))
+	{
+		AdvectDataStep(time);
+		AdvectChannelsStep(time);
+	}
+	if (mOptions.GetOption(RS_DIFFUSE_DATA)) DiffuseDataStep(time);
+	DiffuseChannelsStep(time);
+}
+
+void FluidCPU2D::Render()
+{
+	if (!ready) return;
+	if (mOptions.RenderOptions == RR_NONE) return;
+
+	//upload the ink, and draw it over the size of the fluid
+	if (!mRenderTexture) glGenTextures(1, &mRenderTexture);
+	if (mData.Half()) SetupTexture(mRenderTexture, GL_RGBA16F_ARB, mOptions.RenderResolution, 4, (char*)mData.HalfData(), GL_HALF_FLOAT_ARB);
+	else SetupTexture(mRenderTexture, GL_RGBA, mOptions.RenderResolution, 4, (char*)mData.Data());
+
+	glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
+	glEnable(GL_TEXTURE_RECTANGLE_ARB);
+	glColor4f(1, 1, 1, 1);
+	DrawSolverQuad(mOptions.RenderResolution, mOptions.Size, 0.f);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);
+	glPopAttrib();
+}
+
+void FluidCPU2D::InjectCheckeredData()
+{
+	if (!ready) return;
+
+	for (int j=0;j<mData.Height();j++)
+	{
+		for (int i=0;i<mData.Width();i++)
+		{
+			//rgb, and an alpha of 1
+			F4Store(mData, mData.Index(i, j), _mm_setr_ps(
+				(float)((i % 20 < 10) & (j % 20 < 10)),
+				(float)((i % 20 > 10) & (j % 20 < 10)),
+				(float)((i % 20 < 10) & (j % 20 > 10)),
+				1));
+		}
+	}
+}
+
+void FluidCPU2D::GenerateCircularVortex()
+{
+	if (!ready) return;
+
+	for (int j=0;j<mVelocity.Height();j++)
+	{
+		for (int i=0;i<mVelocity.Width();i++)
+		{
+			//circular vortex
+			float velX = -1*(j - mOptions.SolverResolution.y/2.0f) / (mOptions.SolverResolution.y + 1.0f);
+			float velY = 1*(i - mOptions.SolverResolution.x/2.0f) / (mOptions.SolverResolution.x + 1.0f);
+			F4Store(mVelocity, mVelocity.Cell(i, j), _mm_setr_ps(velX, velY, 0, 0));
+		}
+	}
+}
+
+double FluidCPU2D::BenchmarkAdvection(int steps)
+{
+	if (!ready || steps <= 0) return 0;
+
+	double start = Seconds();
+	for (int i = 0; i < steps; i++)
+	{
+		AdvectVelocityStep(mOptions.FixedTimeInterval);
+		AdvectDataStep(mOptions.FixedTimeInterval);
+	}
+	double elapsed = Seconds() - start;
+
+	double cells = (double)steps * (mVelocity.Width() * mVelocity.Height() + mData.Width() * mData.Height());
+	return elapsed > 0 ? cells / elapsed : 0;
+}
+
+void FluidCPU2D::Poll(float)
+{
+	if (mPollFrame++ % 20 == 0)
+	{
+		mPollPositions.Clear();
+		for (VelocityPollerList::iterator it = mVelocityPollers.begin(); it != mVelocityPollers.end(); it++)
+		{
+			mPollPositions.PushBack(Vec3f((*it)->GetPosition()));
+		}
+		GetVelocities(mPollPositions, mPollVelocities);
+
+		int i = 0;
+		for (VelocityPollerList::iterator it = mVelocityPollers.begin(); it != mVelocityPollers.end(); it++, i++)
+		{
+			(*it)->UpdateVelocity(Vector(mPollVelocities.X()[i], mPollVelocities.Y()[i]));
+		}
+	}
+}
+
+// Each lane works out its cell as Poll did one at a time - position * resolution / size, clamped
+// to the grid and truncated - so the results are the same. Only the lookups are one by one.
+void FluidCPU2D::GetVelocities(const Vec3Array &positions, Vec3Array &velocities) const
+{
+	velocities.Resize(positions.Size());
+	if (!ready) return;
+
+	const int count = positions.Size();
+	const __m128 resX = _mm_set1_ps(mOptions.SolverResolution.x);
+	const __m128 resY = _mm_set1_ps(mOptions.SolverResolution.y);
+	const __m128 sizeX = _mm_set1_ps(mOptions.Size.x);
+	const __m128 sizeY = _mm_set1_ps(mOptions.Size.y);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 maxX = _mm_set1_ps((float)(mVelocity.Width() - 1));
+	const __m128 maxY = _mm_set1_ps((float)(mVelocity.Height() - 1));
+	const int pitch = mVelocity.ComponentPitch();
+	const float *posX = positions.X();
+	const float *posY = positions.Y();
+	float *velX = velocities.X();
+	float *velY = velocities.Y();
+
+	for (int i = 0; i < count; i += 4)
+	{
+		__m128 x = _mm_div_ps(_mm_mul_ps(_mm_loadu_ps(posX + i), resX), sizeX);
+		__m128 y = _mm_div_ps(_mm_mul_ps(_mm_loadu_ps(posY + i), resY), sizeY);
+
+		int cellX[4], cellY[4];
+		_mm_storeu_si128((__m128i*)cellX, _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(x, zero), maxX)));
+		_mm_storeu_si128((__m128i*)cellY, _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(y, zero), maxY)));
+
+		for (int j = 0; j < 4 && i + j < count; j++)
+		{
+			const float *vel = mVelocity.Cell(cellX[j], cellY[j]);
+			velX[i + j] = vel[0];
+			velY[i + j] = vel[pitch];
+		}
+	}
+}
+
+/** Kernels */
+
+// Port of Advect2D. 'field' is advected by the velocity; scale is the size of a field cell in
+// velocity cells (1 for the velocity itself, SolverToRenderScale for the ink). The traces are
+// worked out for 4 cells at a time; only the lookups are done a cell at a time, since each cell
+// is already a whole __m128. 'second' (with secondOutput) is another field with the same cells as
+// 'field', advected along the same traces.
+void FluidCPU2D::Advect(CPUField &field, CPUField &output, const Vector &scale, float time,
+						CPUField *second, CPUField *secondOutput)
+{
+	const int width = field.Width();
+	const int height = field.Height();
+	const int blockWidth = width & ~3;
+	const float alphaX = time / mOptions.SolverDelta.x;
+	const float alphaY = time / mOptions.SolverDelta.y;
+	const float invScaleX = 1.f / scale.x;
+	const float invScaleY = 1.f / scale.y;
+
+	const __m128 alphaX4 = _mm_set1_ps(alphaX);
+	const __m128 alphaY4 = _mm_set1_ps(alphaY);
+	const __m128 halfAlphaX4 = _mm_set1_ps(0.5f * alphaX);
+	const __m128 halfAlphaY4 = _mm_set1_ps(0.5f * alphaY);
+	const __m128 scaleX4 = _mm_set1_ps(scale.x);
+	const __m128 invScaleX4 = _mm_set1_ps(invScaleX);
+	const __m128 invScaleY4 = _mm_set1_ps(invScaleY);
+	const __m128 centres = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	const int pitch = mVelocity.ComponentPitch();
+
+	#pragma omp parallel for
+	for (int y = 0; y < height; y++)
+	{
+		const float coordY = (y + 0.5f) * scale.y;
+		const __m128 coordY4 = _mm_set1_ps(coordY);
+
+		int x = 0;
+		for (; x < blockWidth; x += 4)
+		{
+			int cellX[4], cellY[4];
+			float tx[4], ty[4];
+
+			//get the velocity at these cells
+			__m128 coordX4 = _mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)x), centres), scaleX4);
+			_mm_storeu_si128((__m128i*)cellX, _mm_cvttps_epi32(coordX4));
+			if (!mTiles.Active(cellX[0], (int)coordY) && !mTiles.Active(cellX[3], (int)coordY))
+			{
+				//still air, so nothing moves
+				for (int i = 0; i < 4; i++)
+				{
+					F4Store(output, output.Index(x + i, y), F4Load(field, field.Index(x + i, y)));
+					if (second) F4Store(*secondOutput, secondOutput->Index(x + i, y), F4Load(*second, second->Index(x + i, y)));
+				}
+				continue;
+			}
+
+			__m128 velX = F4Load(mVelocity, mVelocity.ClampedCell(cellX[0], (int)coordY));
+			__m128 velY = F4Load(mVelocity, mVelocity.ClampedCell(cellX[1], (int)coordY));
+			__m128 velZ = F4Load(mVelocity, mVelocity.ClampedCell(cellX[2], (int)coordY));
+			__m128 velW = F4Load(mVelocity, mVelocity.ClampedCell(cellX[3], (int)coordY));
+			_MM_TRANSPOSE4_PS(velX, velY, velZ, velW); //now one component of the 4 cells each
+
+			//step back a timestep to get the previous velocity
+			__m128 backX = _mm_sub_ps(coordX4, _mm_mul_ps(alphaX4, velX));
+			__m128 backY = _mm_sub_ps(coordY4, _mm_mul_ps(alphaY4, velY));
+
+			//the cells that are boundaries keep their base value
+			int boundX[4], boundY[4];
+			_mm_storeu_si128((__m128i*)boundX, _mm_cvttps_epi32(F4Floor(backX)));
+			_mm_storeu_si128((__m128i*)boundY, _mm_cvttps_epi32(F4Floor(backY)));
+
+			//use the error in stepping forward again to correct the step back
+			F4LerpSetup(backX, cellX, tx);
+			F4LerpSetup(backY, cellY, ty);
+			__m128 nextX = F4Bilerp(mVelocity, cellX[0], cellY[0], tx[0], ty[0]);
+			__m128 nextY = F4Bilerp(mVelocity, cellX[1], cellY[1], tx[1], ty[1]);
+			__m128 nextZ = F4Bilerp(mVelocity, cellX[2], cellY[2], tx[2], ty[2]);
+			__m128 nextW = F4Bilerp(mVelocity, cellX[3], cellY[3], tx[3], ty[3]);
+			_MM_TRANSPOSE4_PS(nextX, nextY, nextZ, nextW);
+			backX = _mm_sub_ps(backX, _mm_mul_ps(halfAlphaX4, nextX));
+			backY = _mm_sub_ps(backY, _mm_mul_ps(halfAlphaY4, nextY));
+
+			F4LerpSetup(_mm_mul_ps(backX, invScaleX4), cellX, tx);
+			F4LerpSetup(_mm_mul_ps(backY, invScaleY4), cellY, ty);
+			for (int i = 0; i < 4; i++)
+			{
+				if (*mBoundaryField.ClampedCell(boundX[i], boundY[i]) > 0)
+				{
+					F4Store(output, output.Index(x + i, y), F4Load(field, field.Index(x + i, y)));
+					if (second) F4Store(*secondOutput, secondOutput->Index(x + i, y), F4Load(*second, second->Index(x + i, y)));
+				}
+				else
+				{
+					F4Store(output, output.Index(x + i, y), F4Bilerp(field, cellX[i], cellY[i], tx[i], ty[i]));
+					if (second) F4Store(*secondOutput, secondOutput->Index(x + i, y), F4Bilerp(*second, cellX[i], cellY[i], tx[i], ty[i]));
+				}
+			}
+		}
+
+		//the cells left over at the end of the row
+		for (; x < width; x++)
+		{
+			const int out = output.Index(x, y);
+
+			float coordX = (x + 0.5f) * scale.x;
+			const float *currVel = mVelocity.ClampedCell((int)coordX, (int)coordY);
+
+			float backX = coordX - alphaX * currVel[0];
+			float backY = coordY - alphaY * currVel[pitch];
+
+			if (!mTiles.Active((int)coordX, (int)coordY) ||
+				*mBoundaryField.ClampedCell((int)floorf(backX), (int)floorf(backY)) > 0)
+			{
+				F4Store(output, out, F4Load(field, field.Index(x, y)));
+				if (second) F4Store(*secondOutput, secondOutput->Index(x, y), F4Load(*second, second->Index(x, y)));
+				continue;
+			}
+
+			float nextVel[4];
+			_mm_storeu_ps(nextVel, F4Bilerp(mVelocity, backX, backY));
+			backX -= 0.5f * alphaX * nextVel[0];
+			backY -= 0.5f * alphaY * nextVel[1];
+
+			F4Store(output, out, F4Bilerp(field, backX * invScaleX, backY * invScaleY));
+			if (second) F4Store(*secondOutput, secondOutput->Index(x, y), F4Bilerp(*second, backX * invScaleX, backY * invScaleY));
+		}
+	}
+
+	field.Swap(output);
+	if (second) second->Swap(*secondOutput);
+}
+
+// Port of MacCormackAdvect2D. A plain step back is taken into a scratch field, which is then stepped
+// forward again: the difference from the original is twice the error of the step back, so half
+// of it is added on. The result is clamped to the cells the step back interpolated between.
+void FluidCPU2D::MacCormack(CPUField &field, CPUField &output, const Vector &scale, float time)
+{
+	const int width = field.Width();
+	const int height = field.Height();
+	const float alphaX = time / mOptions.SolverDelta.x;
+	const float alphaY = time / mOptions.SolverDelta.y;
+	const float invScaleX = 1.f / scale.x;
+	const float invScaleY = 1.f / scale.y;
+	const __m128 half = _mm_set1_ps(0.5f);
+	const int pitch = mVelocity.ComponentPitch();
+
+	CPUField &advected = JacobiSource(field);
+
+	#pragma omp parallel for
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			float coordX = (x + 0.5f) * scale.x;
+			float coordY = (y + 0.5f) * scale.y;
+			const float *currVel = mVelocity.ClampedCell((int)coordX, (int)coordY);
+
+			float backX = coordX - alphaX * currVel[0];
+			float backY = coordY - alphaY * currVel[pitch];
+
+			if (!mTiles.Active((int)coordX, (int)coordY) ||
+				*mBoundaryField.ClampedCell((int)floorf(backX), (int)floorf(backY)) > 0)
+				F4Store(advected, advected.Index(x, y), F4Load(field, field.Index(x, y)));
+			else
+				F4Store(advected, advected.Index(x, y), F4Bilerp(field, backX * invScaleX, backY * invScaleY));
+		}
+	}
+
+	#pragma omp parallel for
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			const int out = output.Index(x, y);
+			__m128 result = F4Load(advected, advected.Index(x, y));
+
+			float coordX = (x + 0.5f) * scale.x;
+			float coordY = (y + 0.5f) * scale.y;
+			const float *currVel = mVelocity.ClampedCell((int)coordX, (int)coordY);
+
+			float backX = coordX - alphaX * currVel[0];
+			float backY = coordY - alphaY * currVel[pitch];
+			float forwardX = coordX + alphaX * currVel[0];
+			float forwardY = coordY + alphaY * currVel[pitch];
+
+			//near boundaries one of the traces is meaningless, so keep the plain step back
+			if (!mTiles.Active((int)coordX, (int)coordY) ||
+				*mBoundaryField.ClampedCell((int)floorf(backX), (int)floorf(backY)) > 0 ||
+				*mBoundaryField.ClampedCell((int)floorf(forwardX), (int)floorf(forwardY)) > 0)
+			{
+				F4Store(output, out, result);
+				continue;
+			}
+
+			__m128 back = F4Bilerp(advected, forwardX * invScaleX, forwardY * invScaleY);
+			result = _mm_add_ps(result, _mm_mul_ps(half, _mm_sub_ps(F4Load(field, field.Index(x, y)), back)));
+
+			__m128 low, high;
+			F4Bounds(field, backX * invScaleX, backY * invScaleY, low, high);
+			F4Store(output, out, _mm_min_ps(high, _mm_max_ps(low, result)));
+		}
+	}
+
+	field.Swap(output);
+}
+
+// Port of F4Jacobi2D, run until the residual is tolerance times alpha*b, or for maxIterations.
+// Returns the number of iterations used.
+int FluidCPU2D::Jacobi4(CPUField &x, const CPUField &b, CPUField &output, float alpha, float beta, int maxIterations, float tolerance)
+{
+	const int width = x.Width();
+	const int height = x.Height();
+	const __m128 alpha4 = _mm_set1_ps(alpha);
+	const __m128 invBeta = _mm_set1_ps(1.f / beta);
+
+	//the residual of an iteration is beta times the change it makes
+	const double target = (double)tolerance * tolerance * alpha * alpha * SumOfSquares(b) / ((double)beta * beta);
+
+	//skipped cells are never written, so start both buffers the same
+	const bool sparse = mTiles.Covers(x);
+	const int shift = mTiles.TileShift();
+	if (sparse) output.CopyFrom(x);
+
+	const bool planar = x.Planar();
+
+	int i = 0;
+	while (i < maxIterations)
+	{
+		double change = 0;
+
+		#pragma omp parallel for reduction(+:change)
+		for (int y = 0; y < height; y++)
+		{
+			const float *row = x.Cell(0, y);
+			const float *up = x.Cell(0, y < height-1 ? y+1 : y);
+			const float *down = x.Cell(0, y > 0 ? y-1 : y);
+			const float *rowB = b.Cell(0, y);
+			float *out = output.Cell(0, y);
+			const unsigned char *tiles = sparse ? mTiles.TileRow(y, 0) : 0;
+
+			if (planar)
+			{
+				//a plane at a time, as Jacobi1
+				for (int p = 0; p < x.Planes(); p++)
+				{
+					const int offset = p * x.ComponentPitch();
+					Jacobi1Row(row + offset, up + offset, down + offset, rowB + offset, out + offset,
+							   width, alpha, 1.f / beta, tiles, shift, false);
+					change += SquaredChange(row + offset, out + offset, width);
+				}
+				continue;
+			}
+
+			Jacobi4Row(row, up, down, rowB, out, width, alpha4, invBeta, tiles, shift);
+			change += SquaredChange(row, out, 4*width);
+		}
+		x.Swap(output);
+		i++;
+
+		if (change <= target) break;
+	}
+
+	return i;
+}
+
+// Port of F1Jacobi2D, run like Jacobi4. The inside of each row is done 4 cells at a time.
+int FluidCPU2D::Jacobi1(CPUField &x, const CPUField &b, CPUField &output, float alpha, float beta, int maxIterations, float tolerance)
+{
+	const int width = x.Width();
+	const int height = x.Height();
+	const float invBeta = 1.f / beta;
+
+	const bool sparse = mTiles.Covers(x);
+	const int shift = mTiles.TileShift();
+	if (mOptions.JacobiBlockDepth > 1 && !sparse)
+	{
+		return BlockedJacobi1(x, b, output, alpha, beta, maxIterations, tolerance, mOptions.JacobiBlockDepth);
+	}
+
+	//the residual of an iteration is beta times the change it makes
+	const double target = (double)tolerance * tolerance * alpha * alpha * SumOfSquares(b) / ((double)beta * beta);
+
+	//padded, each row sets its own ghosts, so only the rows above and below need clamping
+	const bool ghosts = x.Ghost() > 0;
+	x.FillGhosts();
+
+	if (sparse) output.CopyFrom(x);
+
+	int i = 0;
+	while (i < maxIterations)
+	{
+		double change = 0;
+
+		#pragma omp parallel for reduction(+:change)
+		for (int y = 0; y < height; y++)
+		{
+			const float *row = x.Cell(0, y);
+			const float *up = x.Cell(0, y < height-1 ? y+1 : y);
+			const float *down = x.Cell(0, y > 0 ? y-1 : y);
+			const float *rowB = b.Cell(0, y);
+			float *out = output.Cell(0, y);
+			const unsigned char *tiles = sparse ? mTiles.TileRow(y, 0) : 0;
+
+			Jacobi1Row(row, up, down, rowB, out, width, alpha, invBeta, tiles, shift, ghosts);
+
+			change += SquaredChange(row, out, width);
+		}
+		x.Swap(output);
+		i++;
+
+		if (change <= target) break;
+	}
+
+	return i;
+}
+
+// Jacobi1, doing 'depth' iterations in each pass over the grid. Each thread takes a band of rows
+// and runs the iterations down it as a wavefront: iteration t works one row behind iteration t-1,
+// whose last few rows wait in a small ring buffer instead of going out to memory. The bands
+// overlap by a row per iteration, so they need nothing from each other until the pass is over.
+int FluidCPU2D::BlockedJacobi1(CPUField &x, const CPUField &b, CPUField &output, float alpha, float beta,
+							   int maxIterations, float tolerance, int depth)
+{
+	const int width = x.Width();
+	const int height = x.Height();
+	const float invBeta = 1.f / beta;
+	const int ringRows = 4; //iteration t needs rows r-1 to r+1 of t-1, and r+1 is the newest
+
+#ifdef _OPENMP
+	const int bands = min(height, omp_get_max_threads());
+#else
+	const int bands = 1;
+#endif
+
+	//as Jacobi1, checked against the change of the last iteration in each pass
+	const double target = (double)tolerance * tolerance * alpha * alpha * SumOfSquares(b) / ((double)beta * beta);
+
+	//padded, the ring rows get ghost cells too
+	const int ghost = x.Ghost();
+	const int stride = width + 2 * ghost;
+	x.FillGhosts();
+
+	int i = 0;
+	while (i < maxIterations)
+	{
+		const int levels = min(depth, maxIterations - i);
+		double change = 0;
+
+		#pragma omp parallel for reduction(+:change)
+		for (int band = 0; band < bands; band++)
+		{
+			const int y0 = height * band / bands;
+			const int y1 = height * (band + 1) / bands;
+
+			//rows of the iterations between x and output
+			vector<float> ring((levels - 1) * ringRows * stride);
+
+			//iteration t (1 to levels) covers the band and levels-t rows either side, and does
+			//row s-t at step s
+			const int first = max(0, y0 - (levels - 1)) + 1;
+			const int last = y1 + levels;
+			for (int s = first; s < last; s++)
+			{
+				for (int t = 1; t <= levels; t++)
+				{
+					const int r = s - t;
+					if (r < max(0, y0 - (levels - t)) || r >= min(height, y1 + (levels - t))) continue;
+
+					const int up = r < height-1 ? r+1 : r;
+					const int down = r > 0 ? r-1 : r;
+					const float *row, *rowUp, *rowDown;
+					if (t == 1)
+					{
+						row = x.Cell(0, r);
+						rowUp = x.Cell(0, up);
+						rowDown = x.Cell(0, down);
+					}
+					else
+					{
+						const float *level = &ring[(t - 2) * ringRows * stride + ghost];
+						row = level + (r % ringRows) * stride;
+						rowUp = level + (up % ringRows) * stride;
+						rowDown = level + (down % ringRows) * stride;
+					}
+
+					float *out = t == levels ? output.Cell(0, r) : &ring[((t - 1) * ringRows + r % ringRows) * stride + ghost];
+					Jacobi1Row(row, rowUp, rowDown, b.Cell(0, r), out, width, alpha, invBeta, 0, 0, ghost > 0);
+
+					if (t == levels) change += SquaredChange(row, out, width);
+				}
+			}
+		}
+		x.Swap(output);
+		i += levels;
+
+		if (change <= target) break;
+	}
+
+	return i;
+}
+
+int FluidCPU2D::Diffuse(DiffusionSolver &solver, CPUField &field, const CPUField &source, CPUField &output, float alpha, float beta)
+{
+	if (mOptions.ViscositySolver == VS_CONJUGATE_GRADIENT)
+	{
+		return solver.Solve(field, source, alpha, mOptions.ViscosityTolerance, mOptions.GetViscosityMaxIterations());
+	}
+
+	return Jacobi4(field, source, output, alpha, beta, mOptions.GetViscosityMaxIterations(), mOptions.ViscosityTolerance);
+}
+
+int FluidCPU2D::RedBlack1(CPUField &x, const CPUField &b, float alpha, float beta, float omega, int maxIterations, float tolerance)
+{
+	const int width = x.Width();
+	const int height = x.Height();
+	const float invBeta = 1.f / beta;
+	const bool sparse = mTiles.Covers(x);
+	const int shift = mTiles.TileShift();
+
+	//as for Jacobi1, with the change a gauss-seidel update would make
+	const double target = (double)tolerance * tolerance * alpha * alpha * SumOfSquares(b) / ((double)beta * beta);
+
+	int i = 0;
+	while (i < maxIterations)
+	{
+		double change = 0;
+
+		//a cell's neighbours are all the other colour, so each half can update in parallel, and the
+		//second half uses the values from the first
+		for (int parity = 0; parity < 2; parity++)
+		{
+			#pragma omp parallel for reduction(+:change)
+			for (int y = 0; y < height; y++)
+			{
+				float *row = x.Cell(0, y);
+				const float *up = x.Cell(0, y < height-1 ? y+1 : y);
+				const float *down = x.Cell(0, y > 0 ? y-1 : y);
+				const float *rowB = b.Cell(0, y);
+				const unsigned char *tiles = sparse ? mTiles.TileRow(y, 0) : 0;
+
+				for (int c = (y + parity) & 1; c < width; c += 2)
+				{
+					if (tiles && !tiles[c >> shift]) continue;
+
+					float delta = Jacobi1Cell(row, up, down, rowB, c, width, alpha, invBeta) - row[c];
+					row[c] += omega * delta;
+					change += delta * delta;
+				}
+			}
+		}
+		i++;
+
+		if (change <= target) break;
+	}
+
+	return i;
+}
+
+/** Steps - Simulation */
+void FluidCPU2D::UpdateTilesStep()
+{
+	if (!ready) return;
+
+	//the faces aren't tiled, so a staggered velocity solves everywhere
+	if (!mOptions.GetOption(RS_SPARSE_TILES) || mOptions.GetOption(RS_STAGGERED_VELOCITY))
+	{
+		mTiles.Disable();
+		return;
+	}
+
+	mTiles.Begin();
+	mTiles.Mark(mVelocity, mOptions.TileThreshold);
+	mTiles.Mark(mData, mOptions.TileThreshold);
+	mTiles.Mark(mDivField, mOptions.TileThreshold);
+	for (int c = 0; c < mChannels.Count(); c++)
+	{
+		mTiles.Mark(mChannels[c].field, mOptions.TileThreshold);
+	}
+	mTiles.Finish();
+}
+
+void FluidCPU2D::AdvectDataStep(float time)
+{
+	if (!ready) return;
+
+	if (mOptions.Advection == AD_MACCORMACK)
+		MacCormack(mData, mOutputRender, mOptions.SolverToRenderScale, time);
+	else
+		Advect(mData, mOutputRender, mOptions.SolverToRenderScale, time);
+}
+
+void FluidCPU2D::AdvectVelocityStep(float time)
+{
+	if (!ready) return;
+
+	if (mOptions.Advection == AD_MACCORMACK)
+		MacCormack(mVelocity, mOutputSolver, Vector(1, 1), time);
+	else
+		Advect(mVelocity, mOutputSolver, Vector(1, 1), time);
+}
+
+void FluidCPU2D::AdvectVelocityAndDataStep(float time)
+{
+	if (!ready) return;
+
+	Advect(mVelocity, mOutputSolver, Vector(1, 1), time, &mData, &mOutputRender);
+}
+
+// The same trace as Advect, but each cell's corners and weights are found once and shared by
+// every channel, so another channel only costs its 4 lookups
+void FluidCPU2D::AdvectChannelsStep(float time)
+{
+	if (!ready) return;
+
+	const int count = mChannels.Count();
+	if (count == 0) return;
+
+	std::vector<const float*> in(count);
+	std::vector<float*> out(count);
+	for (int c = 0; c < count; c++)
+	{
+		in[c] = mChannels[c].field.Data();
+		out[c] = mChannels[c].output.Data();
+	}
+
+	const int width = mVelocity.Width();
+	const int height = mVelocity.Height();
+	const float alphaX = time / mOptions.SolverDelta.x;
+	const float alphaY = time / mOptions.SolverDelta.y;
+	const int pitch = mVelocity.ComponentPitch();
+
+	#pragma omp parallel for
+	for (int y = 0; y < height; y++)
+	{
+		const float coordY = y + 0.5f;
+		for (int x = 0; x < width; x++)
+		{
+			const int cell = y * width + x;
+			const float coordX = x + 0.5f;
+			const float *currVel = mVelocity.Cell(x, y);
+
+			float backX = coordX - alphaX * currVel[0];
+			float backY = coordY - alphaY * currVel[pitch];
+
+			if (!mTiles.Active(x, y) || *mBoundaryField.ClampedCell((int)floorf(backX), (int)floorf(backY)) > 0)
+			{
+				for (int c = 0; c < count; c++) out[c][cell] = in[c][cell];
+				continue;
+			}
+
+			float nextVel[4];
+			_mm_storeu_ps(nextVel, F4Bilerp(mVelocity, backX, backY));
+			backX -= 0.5f * alphaX * nextVel[0];
+			backY -= 0.5f * alphaY * nextVel[1];
+
+			//the corners and weights, as F4Bilerp
+			float fx = floorf(backX - 0.5f), fy = floorf(backY - 0.5f);
+			float tx = backX - 0.5f - fx, ty = backY - 0.5f - fy;
+			int x0 = CPUField::Clamp((int)fx, width), x1 = CPUField::Clamp((int)fx + 1, width);
+			int y0 = CPUField::Clamp((int)fy, height), y1 = CPUField::Clamp((int)fy + 1, height);
+
+			const int c11 = y0 * width + x0, c21 = y0 * width + x1;
+			const int c12 = y1 * width + x0, c22 = y1 * width + x1;
+			const float w11 = (1 - tx) * (1 - ty), w21 = tx * (1 - ty);
+			const float w12 = (1 - tx) * ty, w22 = tx * ty;
+
+			for (int c = 0; c < count; c++)
+			{
+				const float *f = in[c];
+				out[c][cell] = f[c11] * w11 + f[c21] * w21 + f[c12] * w12 + f[c22] * w22;
+			}
+		}
+	}
+
+	for (int c = 0; c < count; c++) mChannels[c].field.Swap(mChannels[c].output);
+}
+
+// Port of Vorticity2D
+void FluidCPU2D::VorticityConfinementStep(float time)
+{
+	if (!ready) return;
+
+	const int width = mVelocity.Width();
+	const int height = mVelocity.Height();
+	const float scaleX = 0.5f * mOptions.SolverDelta.x * time;
+	const float scaleY = 0.5f * mOptions.SolverDelta.y * time;
+	const int last = width - 1;
+
+	//the end cells are clamped, the rest read their neighbours directly
+	#pragma omp parallel for
+	for (int y = 0; y < height; y++)
+	{
+		const float *row = mVelocity.Cell(0, y);
+		const float *up = mVelocity.Cell(0, y < height-1 ? y+1 : y);
+		const float *down = mVelocity.Cell(0, y > 0 ? y-1 : y);
+		float *out = mOutputSolver.Cell(0, y);
+
+		VorticityCell(mVelocity, mOutputSolver, row, up, down, out, 0, 0, last > 0 ? 1 : 0, scaleX, scaleY);
+		for (int x = 1; x < last; x++)
+		{
+			VorticityCell(mVelocity, mOutputSolver, row, up, down, out, x, x-1, x+1, scaleX, scaleY);
+		}
+		if (last > 0) VorticityCell(mVelocity, mOutputSolver, row, up, down, out, last, last-1, last, scaleX, scaleY);
+	}
+
+	mVelocity.Swap(mOutputSolver);
+}
+
+void FluidCPU2D::DiffuseDataStep(float time)
+{
+	if (!ready) return;
+
+	float alpha = mOptions.RenderDelta.x*mOptions.RenderDelta.y / (time * mOptions.Viscosity);
+	float beta = 4 + alpha;
+
+	//the solvers work on floats, so halves are diffused as a copy
+	CPUField &data = mData.Half() ? mSingleData : mData;
+	CPUField &output = mData.Half() ? mSingleOutputRender : mOutputRender;
+	if (mData.Half())
+	{
+		if (!mSingleData.SameShape(mData)) mSingleData.ResizeLike(mData);
+		if (!mSingleOutputRender.SameShape(mData)) mSingleOutputRender.ResizeLike(mData);
+		mSingleData.CopyFrom(mData);
+	}
+
+	CPUField &source = JacobiSource(data);
+	source.CopyFrom(data);
+	mViscosityIterations += Diffuse(mDataDiffusion, data, source, output, alpha, beta);
+
+	if (mData.Half()) mData.CopyFrom(mSingleData);
+}
+
+void FluidCPU2D::DiffuseVelocityStep(float time)
+{
+	if (!ready) return;
+
+	float alpha = mOptions.SolverDelta.x*mOptions.SolverDelta.y / (time * mOptions.Viscosity);
+	float beta = 4 + alpha;
+
+	CPUField &source = JacobiSource(mVelocity);
+	source.CopyFrom(mVelocity);
+	mViscosityIterations += Diffuse(mVelocityDiffusion, mVelocity, source, mOutputSolver, alpha, beta);
+}
+
+void FluidCPU2D::DiffuseChannelsStep(float time)
+{
+	if (!ready) return;
+
+	for (int c = 0; c < mChannels.Count(); c++)
+	{
+		ScalarChannel &channel = mChannels[c];
+		if (channel.diffusion <= 0) continue;
+
+		float alpha = mOptions.SolverDelta.x*mOptions.SolverDelta.y / (time * channel.diffusion);
+		float beta = 4 + alpha;
+
+		CPUField &source = mChannels.Source();
+		source.CopyFrom(channel.field);
+		mViscosityIterations += Jacobi1(channel.field, source, channel.output, alpha, beta,
+			mOptions.GetViscosityMaxIterations(), mOptions.ViscosityTolerance);
+	}
+}
+
+void FluidCPU2D::UpdatePressureStep(float)
+{
+	if (!ready) return;
+
+	const int width = mVelocity.Width();
+	const int height = mVelocity.Height();
+	const float halfInvDX = 0.5f / mOptions.SolverDelta.x;
+	const float halfInvDY = 0.5f / mOptions.SolverDelta.y;
+	const int pitch = mVelocity.ComponentPitch();
+
+	const int shift = mTiles.TileShift();
+
+	// Calculate Divergence Field (DivField2D)
+	#pragma omp parallel for
+	for (int y = 0; y < height; y++)
+	{
+		const unsigned char *tiles = mTiles.Enabled() ? mTiles.TileRow(y, 0) : 0;
+
+		DivergenceRow(mVelocity.Cell(0, y), mVelocity.Cell(0, y < height-1 ? y+1 : y) + pitch,
+					  mVelocity.Cell(0, y > 0 ? y-1 : y) + pitch, mDivField.Cell(0, y), width, mVelocity.CellPitch(),
+					  halfInvDX, halfInvDY, tiles, shift);
+	}
+
+	SolvePressure();
+}
+
+void FluidCPU2D::SolvePressure()
+{
+	if (mOptions.SpectralPressure && !mHasObstacles)
+	{
+		//exact, so needs no iterations
+		UnpadPressure();
+		mSpectral.Solve(mUnpaddedPressure, mUnpaddedDivField, mOptions.SolverDelta.x * mOptions.SolverDelta.y);
+		PadPressure();
+		mPressureIterations = 1;
+		return;
+	}
+
+	if (mOptions.PressureRefinements > 0 &&
+		(mOptions.PressureSolver == PS_JACOBI || mOptions.PressureSolver == PS_RED_BLACK_SOR))
+	{
+		mPressureIterations = RefinePressure(-(mOptions.SolverDelta.x * mOptions.SolverDelta.y), 4.f);
+		return;
+	}
+
+	switch (mOptions.PressureSolver)
+	{
+	case PS_MULTIGRID:
+	case PS_FULL_MULTIGRID:
+		UnpadPressure();
+		mPressureIterations = mMultigrid.Solve(mUnpaddedPressure, mUnpaddedDivField, mOptions.SolverDelta.x * mOptions.SolverDelta.y,
+			mOptions.MultigridCycles, mOptions.PressureSolver == PS_FULL_MULTIGRID, mOptions.PressureTolerance);
+		PadPressure();
+		break;
+
+	case PS_CHOLESKY:
+		if (mCholesky.IsReady())
+		{
+			UnpadPressure();
+			mCholesky.Solve(mUnpaddedPressure, mUnpaddedDivField, mOptions.SolverDelta.x * mOptions.SolverDelta.y);
+			PadPressure();
+			mPressureIterations = 1;
+			break;
+		}
+		//too big to factorise, so use conjugate gradients
+		//fall through
+	case PS_CONJUGATE_GRADIENT:
+		UnpadPressure();
+		mPressureIterations = mConjugateGradient.Solve(mUnpaddedPressure, mUnpaddedDivField, mOptions.SolverDelta.x * mOptions.SolverDelta.y,
+			mOptions.PressureTolerance, mOptions.GetPressureMaxIterations());
+		PadPressure();
+		break;
+
+	case PS_RED_BLACK_SOR:
+		mPressureIterations = RedBlack1(mPressure, mDivField, -(mOptions.SolverDelta.x * mOptions.SolverDelta.y), 4.f,
+			mOptions.RelaxationFactor, mOptions.GetPressureMaxIterations(), mOptions.PressureTolerance);
+		break;
+
+	default:
+		if (mOptions.GetPrecision(mOptions.PressurePrecision, false) == FP_DOUBLE)
+		{
+			mPressureIterations = mDoublePressure.Solve(mPressure, mDivField, -(mOptions.SolverDelta.x * mOptions.SolverDelta.y), 4.f,
+				mOptions.GetPressureMaxIterations(), mOptions.PressureTolerance);
+			break;
+		}
+		mPressureIterations = Jacobi1(mPressure, mDivField, mOutputSolver1d, -(mOptions.SolverDelta.x * mOptions.SolverDelta.y), 4.f,
+			mOptions.GetPressureMaxIterations(), mOptions.PressureTolerance);
+		break;
+	}
+}
+
+// Mixed precision iterative refinement. The pressure is held in doubles by mDoublePressure, which finds
+// the residual in double precision; the fp32 solver then finds the correction from 0, as the
+// same equation with the residual as its right hand side. Each refinement gains about as much as
+// a whole fp32 solve, where fp32 on its own stalls once the residual reaches its rounding.
+int FluidCPU2D::RefinePressure(float alpha, float beta)
+{
+	const double sumB = mDoublePressure.Load(mPressure, mDivField);
+	const double target = (double)mOptions.PressureTolerance * mOptions.PressureTolerance * alpha * alpha * sumB;
+
+	int iterations = 0;
+	for (int r = 0; r < mOptions.PressureRefinements; r++)
+	{
+		if (mDoublePressure.Residual(mCorrectionSource, alpha, beta) <= target) break;
+
+		mCorrection.Zero();
+		if (mOptions.PressureSolver == PS_RED_BLACK_SOR)
+			iterations += RedBlack1(mCorrection, mCorrectionSource, alpha, beta, mOptions.RelaxationFactor,
+				mOptions.GetPressureMaxIterations(), mOptions.PressureTolerance);
+		else
+			iterations += Jacobi1(mCorrection, mCorrectionSource, mOutputSolver1d, alpha, beta,
+				mOptions.GetPressureMaxIterations(), mOptions.PressureTolerance);
+
+		mDoublePressure.Correct(mCorrection);
+	}
+
+	mDoublePressure.Store(mPressure);
+	return iterations;
+}
+
+void FluidCPU2D::UnpadPressure()
+{
+	mUnpaddedPressure.CopyFrom(mPressure);
+	mUnpaddedDivField.CopyFrom(mDivField);
+}
+
+void FluidCPU2D::PadPressure()
+{
+	mPressure.CopyFrom(mUnpaddedPressure);
+	mPressure.FillGhosts();
+}
+
+// Port of SubtractPressureGradient2D. The pressure's ghost cells are up to date from
+// BoundaryPressureStep, so the neighbours are read without clamping.
+void FluidCPU2D::SubtractPressureGradientStep(float)
+{
+	if (!ready) return;
+
+	const int width = mVelocity.Width();
+	const int height = mVelocity.Height();
+	const __m128 halfInvD = _mm_set_ps(0, 0, 0.5f / mOptions.SolverDelta.y, 0.5f / mOptions.SolverDelta.x);
+	const float halfInvDX = 0.5f / mOptions.SolverDelta.x;
+	const float halfInvDY = 0.5f / mOptions.SolverDelta.y;
+	const int pitch = mVelocity.ComponentPitch();
+
+	const int shift = mTiles.TileShift();
+
+	#pragma omp parallel for
+	for (int y = 0; y < height; y++)
+	{
+		const float *row = mPressure.Cell(0, y);
+		const float *up = mPressure.Cell(0, y+1);
+		const float *down = mPressure.Cell(0, y-1);
+		float *vel = mVelocity.Cell(0, y);
+		const unsigned char *tiles = mTiles.Enabled() ? mTiles.TileRow(y, 0) : 0;
+
+		if (mVelocity.Planar())
+		{
+			//each component's row is 4 cells to a register
+			float *velX = vel, *velY = vel + pitch;
+			int x = 0;
+			if (!tiles)
+			{
+				const __m128 halfInvDX4 = _mm_set1_ps(halfInvDX);
+				const __m128 halfInvDY4 = _mm_set1_ps(halfInvDY);
+				for (; x + 4 <= width; x += 4)
+				{
+					__m128 gradX = _mm_sub_ps(_mm_loadu_ps(row + x+1), _mm_loadu_ps(row + x-1));
+					__m128 gradY = _mm_sub_ps(_mm_loadu_ps(up + x), _mm_loadu_ps(down + x));
+					_mm_storeu_ps(velX + x, _mm_sub_ps(_mm_loadu_ps(velX + x), _mm_mul_ps(gradX, halfInvDX4)));
+					_mm_storeu_ps(velY + x, _mm_sub_ps(_mm_loadu_ps(velY + x), _mm_mul_ps(gradY, halfInvDY4)));
+				}
+			}
+			for (; x < width; x++)
+			{
+				if (tiles && !tiles[x >> shift]) continue;
+				velX[x] -= (row[x+1] - row[x-1]) * halfInvDX;
+				velY[x] -= (up[x] - down[x]) * halfInvDY;
+			}
+			continue;
+		}
+
+		for (int x = 0; x < width; x++)
+		{
+			if (tiles && !tiles[x >> shift]) continue;
+
+			__m128 gradient = _mm_set_ps(0, 0, up[x] - down[x], row[x+1] - row[x-1]);
+			_mm_store_ps(vel + 4*x, _mm_sub_ps(_mm_load_ps(vel + 4*x), _mm_mul_ps(gradient, halfInvD)));
+		}
+	}
+}
+
+/** Steps - Interaction */
+void FluidCPU2D::InjectInkStep()
+{
+	if (!ready) return;
+	if (mInjectors.empty()) return;
+
+	//fill the cells whose centres are inside each injector's square
+	for (InjectorList::iterator it = mInjectors.begin(); it != mInjectors.end(); ++it)
+	{
+		const Injector &inj = *it;
+
+		Vector d = mOptions.RenderDeltaInv * inj.size;
+		Vector pos = inj.position * mOptions.RenderDeltaInv - d/2;
+
+		int startX = max(0, (int)ceilf(pos.x - 0.5f));
+		int endX = min(mData.Width(), (int)ceilf(pos.x + d.x - 0.5f));
+		int startY = max(0, (int)ceilf(pos.y - 0.5f));
+		int endY = min(mData.Height(), (int)ceilf(pos.y + d.y - 0.5f));
+
+		__m128 color = _mm_setr_ps(inj.color.x, inj.color.y, inj.color.z, 0.8f);
+
+		for (int y = startY; y < endY; y++)
+		{
+			for (int x = startX; x < endX; x++)
+			{
+				const int cell = mData.Index(x, y);
+				F4Store(mData, cell, inj.overwrite ? color : _mm_add_ps(color, F4Load(mData, cell)));
+			}
+		}
+	}
+
+	mInjectors.clear();
+}
+
+void FluidCPU2D::InjectChannelsStep()
+{
+	if (!ready) return;
+
+	const ScalarChannels::InjectionList &injections = mChannels.Injections();
+	for (ScalarChannels::InjectionList::const_iterator it = injections.begin(); it != injections.end(); ++it)
+	{
+		const ScalarChannels::Injection &inj = *it;
+		CPUField &field = mChannels[inj.channel].field;
+
+		Vector d = mOptions.SolverDeltaInv * inj.size;
+		Vector pos = inj.position * mOptions.SolverDeltaInv - d/2;
+
+		int startX = max(0, (int)ceilf(pos.x - 0.5f));
+		int endX = min(field.Width(), (int)ceilf(pos.x + d.x - 0.5f));
+		int startY = max(0, (int)ceilf(pos.y - 0.5f));
+		int endY = min(field.Height(), (int)ceilf(pos.y + d.y - 0.5f));
+
+		for (int y = startY; y < endY; y++)
+		{
+			for (int x = startX; x < endX; x++)
+			{
+				float *cell = field.Cell(x, y);
+				*cell = inj.overwrite ? inj.amount : *cell + inj.amount;
+			}
+		}
+	}
+
+	mChannels.ClearInjections();
+}
+
+// Port of Inject2D, for each perturbation
+void FluidCPU2D::PerturbFluidStep()
+{
+	if (!ready) return;
+	if (mPerturbers.empty()) return;
+
+	for (PerturberList::iterator it = mPerturbers.begin(); it != mPerturbers.end(); ++it)
+	{
+		Perturber perturber = *it;
+		Vector pos = perturber.position * mOptions.SolverDeltaInv;
+		float scale = perturber.size * mOptions.SolverDeltaInv.Length();
+
+		int startX = max(0, (int)floorf(pos.x - scale));
+		int endX = min(mVelocity.Width(), (int)ceilf(pos.x + scale));
+		int startY = max(0, (int)floorf(pos.y - scale));
+		int endY = min(mVelocity.Height(), (int)ceilf(pos.y + scale));
+
+		for (int y = startY; y < endY; y++)
+		{
+			for (int x = startX; x < endX; x++)
+			{
+				float dx = pos.x - (x + 0.5f);
+				float dy = pos.y - (y + 0.5f);
+				if (dx*dx + dy*dy < scale*scale)
+				{
+					float *vel = mVelocity.Cell(x, y);
+					vel[0] += perturber.velocity.x;
+					vel[mVelocity.ComponentPitch()] += perturber.velocity.y;
+				}
+			}
+		}
+	}
+	mPerturbers.clear();
+}
+
+// Port of Perturb2D
+void FluidCPU2D::PerturbDensityStep(float time)
+{
+	if (!ready) return;
+
+	const int width = mVelocity.Width();
+	const int height = mVelocity.Height();
+	const float invScaleX = 1.f / mOptions.SolverToRenderScale.x;
+	const float invScaleY = 1.f / mOptions.SolverToRenderScale.y;
+
+	#pragma omp parallel for
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			float col[4];
+			_mm_storeu_ps(col, F4Load(mData, mData.ClampedIndex((int)((x + 0.5f) * invScaleX), (int)((y + 0.5f) * invScaleY))));
+			float density = col[0]*mDensities[0] + col[1]*mDensities[1] + col[2]*mDensities[2];
+			for (int c = 0; c < mChannels.Count(); c++)
+			{
+				density += *mChannels[c].field.Cell(x, y) * mChannels[c].density;
+			}
+
+			mVelocity.Cell(x, y)[mVelocity.ComponentPitch()] += density * time;
+		}
+	}
+}
+
+void FluidCPU2D::UpdateArbitraryBoundaryStep()
+{
+	if (!ready) return;
+
+	// Boundary textures live on the GPU, so can't be read back here. Only AddArbitraryBoundary works.
+	mNextBoundaryTexture = 0;
+
+	if (mBoundaries.empty()) return;
+
+	//fill the cells whose centres are inside each boundary's square
+	for (BoundaryList::iterator it = mBoundaries.begin(); it != mBoundaries.end(); ++it)
+	{
+		Boundary boundary = *it;
+		Vector d(boundary.size, boundary.size);
+		Vector p(boundary.position - d/2);
+		d = d / mOptions.Size * mOptions.SolverResolution;
+		p = p / mOptions.Size * mOptions.SolverResolution;
+
+		int startX = max(0, (int)ceilf(p.x - 0.5f));
+		int endX = min(mBoundaryField.Width(), (int)ceilf(p.x + d.x - 0.5f));
+		int startY = max(0, (int)ceilf(p.y - 0.5f));
+		int endY = min(mBoundaryField.Height(), (int)ceilf(p.y + d.y - 0.5f));
+
+		for (int y = startY; y < endY; y++)
+		{
+			for (int x = startX; x < endX; x++)
+			{
+				*mBoundaryField.Cell(x, y) = 1;
+			}
+		}
+	}
+
+	mOffsetsDirty = true;
+	mBoundaries.clear();
+}
+
+/** Steps - Boundaries */
+
+// Port of F4Boundary2D - only the boundary and solid cells are visited
+void FluidCPU2D::BoundaryVelocityStep()
+{
+	if (!ready) return;
+
+	const int count = (int)mVelocityBoundaryCells.size();
+	const int components = mVelocity.Components();
+	const int pitch = mVelocity.ComponentPitch();
+	mBoundaryValues.resize(components * count);
+
+	//gather first, as boundary cells can be the source of other boundary cells
+	#pragma omp parallel for
+	for (int i = 0; i < count; i++)
+	{
+		const BoundaryCell &bc = mVelocityBoundaryCells[i];
+		if (!mTiles.ActiveIndex(bc.cell)) continue;
+
+		const float *source = mVelocity.Data() + mVelocity.CellIndex(bc.source);
+		for (int c = 0; c < components; c++) mBoundaryValues[components*i + c] = bc.scale * source[c*pitch];
+	}
+
+	#pragma omp parallel for
+	for (int i = 0; i < count; i++)
+	{
+		if (!mTiles.ActiveIndex(mVelocityBoundaryCells[i].cell)) continue;
+
+		float *cell = mVelocity.Data() + mVelocity.CellIndex(mVelocityBoundaryCells[i].cell);
+		for (int c = 0; c < components; c++) cell[c*pitch] = mBoundaryValues[components*i + c];
+	}
+}
+
+// Port of F1Boundary2D - only the boundary cells are visited
+void FluidCPU2D::BoundaryPressureStep()
+{
+	if (!ready) return;
+
+	const int count = (int)mPressureBoundaryCells.size();
+	mBoundaryValues.resize(count);
+
+	#pragma omp parallel for
+	for (int i = 0; i < count; i++)
+	{
+		if (!mTiles.ActiveIndex(mPressureBoundaryCells[i].cell)) continue;
+		mBoundaryValues[i] = mPressure.Data()[mPressure.CellIndex(mPressureBoundaryCells[i].source)];
+	}
+
+	#pragma omp parallel for
+	for (int i = 0; i < count; i++)
+	{
+		if (!mTiles.ActiveIndex(mPressureBoundaryCells[i].cell)) continue;
+		mPressure.Data()[mPressure.CellIndex(mPressureBoundaryCells[i].cell)] = mBoundaryValues[i];
+	}
+
+	//the halo update - the gradient reads the ghost cells rather than clamping
+	mPressure.FillGhosts();
+}
+
+// Port of CalculateOffsets2D. Rather than storing offsets per cell, this builds the list of cells
+// the boundary steps need to update, and only when the boundaries have changed.
+void FluidCPU2D::UpdateOffsetStep() 
+{
+	if (!ready) return;
+	if (!mOffsetsDirty) return;
+
+	const int width = mBoundaryField.Width();
+	const int height = mBoundaryField.Height();
+
+	mVelocityBoundaryCells.clear();
+	mPressureBoundaryCells.clear();
+
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			float left = *mBoundaryField.ClampedCell(x-1, y);
+			float right = *mBoundaryField.ClampedCell(x+1, y);
+			float up = *mBoundaryField.ClampedCell(x, y+1);
+			float down = *mBoundaryField.ClampedCell(x, y-1);
+
+			int offsetX = 0, offsetY = 0;
+
+			if (right - left < 0) offsetX = 1; //arb right wall
+			if (right - left > 0) offsetX = -1; //arb left wall
+			if (up - down > 0) offsetY = -1; //arb bottom wall
+			if (up - down < 0) offsetY = 1; //arb top wall
+
+			if (x == 0) offsetX = 1; //left bound
+			if (x == width-1) offsetX = -1; //right bound
+			if (y == 0) offsetY = 1; //bottom bound
+			if (y == height-1) offsetY = -1; //top bound
+
+			float b = *mBoundaryField.Cell(x, y);
+
+			BoundaryCell bc;
+			bc.cell = x + width * y;
+
+			if (offsetX != 0 || offsetY != 0)
+			{
+				bc.source = CPUField::Clamp(x + offsetX, width) + width * CPUField::Clamp(y + offsetY, height);
+
+				bc.scale = 1;
+				mPressureBoundaryCells.push_back(bc);
+
+				bc.scale = -(1 - b);
+				mVelocityBoundaryCells.push_back(bc);
+			}
+			else if (b != 0)
+			{
+				//solid cell - scaled down by the boundary value
+				bc.source = bc.cell;
+				bc.scale = 1 - b;
+				mVelocityBoundaryCells.push_back(bc);
+			}
+		}
+	}
+
+	mHasObstacles = false;
+	for (int i = 0; i < mBoundaryField.Size(); i++)
+	{
+		if (mBoundaryField.Data()[i] != 0)
+		{
+			mHasObstacles = true;
+			break;
+		}
+	}
+
+	//the pressure solvers leave out the solid cells, so are rebuilt with the offsets
+	if (mOptions.PressureSolver == PS_MULTIGRID || mOptions.PressureSolver == PS_FULL_MULTIGRID)
+	{
+		mMultigrid.Init(mBoundaryField);
+	}
+	else if (mOptions.PressureSolver == PS_CONJUGATE_GRADIENT ||
+		(mOptions.PressureSolver == PS_CHOLESKY && !mCholesky.Init(mBoundaryField, mOptions.DirectSolverMaxCells)))
+	{
+		mConjugateGradient.Init(mBoundaryField, mOptions.PressurePreconditioner);
+	}
+
+	if (mOptions.SpectralPressure && !mHasObstacles)
+	{
+		mSpectral.Init(mBoundaryField.Width(), mBoundaryField.Height(), mBoundaryField.Depth());
+	}
+
+	mOffsetsDirty = false;
+}
+
+void FluidCPU2D::SetColorDensities(float r, float g, float b)
+{
+	mDensities[0] = r;
+	mDensities[1] = g;
+	mDensities[2] = b;
+}
@@ -0,0 +1,277 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#pragma once
+
+#include <vector>
+
+#include "Fluid.h"
+#include "CPUField.h"
+#include "CholeskySolver.h"
+#include "ConjugateGradientSolver.h"
+#include "DiffusionSolver.h"
+#include "FluidSolver.h"
+#include "MultigridSolver.h"
+#include "ScalarChannels.h"
+#include "SpectralSolver.h"
+#include "StaggeredVelocity.h"
+#include "TileMask.h"
+
+namespace Fluidic
+{
+	/**
+	 * \brief Sets up and solves a 2d fluid on the CPU, without needing a GPU or GL context.
+	 *
+	 * Runs the same steps as Fluid2D, with the shader programs ported to SSE kernels that are
+	 * spread across cores with OpenMP (see FluidOptions::SolverThreads). Fields keep the layout of
+	 * the GPU textures: velocity and ink are RGBA per cell, pressure and divergence 1 component.
+	 * Rendering is optional - with RenderOptions set to RR_NONE the fluid never touches GL.
+	 */
+	class FluidCPU2D : public Fluid
+	{
+	public:
+
+		FluidCPU2D();
+		~FluidCPU2D(void);
+
+		void Init(const FluidOptions &options, bool reloadPrograms=false);
+
+		void SetColorDensities(float r, float g, float b);
+
+		void GenerateCircularVortex();
+		void InjectCheckeredData();
+		void Update(float time);
+
+		/**
+		 * \brief Draws the ink over the fluid's size using the current GL context. Does nothing if
+		 * RenderOptions is RR_NONE, so headless fluids can still be rendered by the same scene code.
+		 */
+		void Render();
+
+		/// Ink, RGBA per cell at RenderResolution, rows contiguous in x. 0 with an InkPrecision of FP_HALF
+		const float *GetData() const { return mData.Data(); }
+
+		/// GetData as halves, with an InkPrecision of FP_HALF (0 otherwise)
+		const unsigned short *GetHalfData() const { return mData.HalfData(); }
+
+		/**
+		 * \brief Velocity, RGBA per cell (xy used) at SolverResolution, rows contiguous in x. With
+		 * RS_STAGGERED_VELOCITY, the average of the faces around each cell.
+		 *
+		 * With FL_PLANAR (FluidOptions::VelocityLayout) it's an x plane then a y plane instead,
+		 * GetVelocityComponentPitch() floats apart.
+		 */
+		const float *GetVelocity() const { return mVelocity.Data(); }
+
+		/// Floats from one component of a cell's velocity to the next - 1, or a plane with FL_PLANAR
+		int GetVelocityComponentPitch() const { return mVelocity.ComponentPitch(); }
+
+		/**
+		 * \brief The velocity of the cells at many positions at once, as the pollers get it.
+		 *
+		 * The positions are in the units of the fluid's size, and go 4 at a time. z is ignored, and set to 0.
+		 * @param velocities resized to the number of positions
+		 */
+		void GetVelocities(const Vec3Array &positions, Vec3Array &velocities) const;
+
+		/**
+		 * \brief With RS_STAGGERED_VELOCITY, the velocity along an axis on the faces across it, 1 float per face.
+		 *
+		 * The faces across x are one longer in x than the grid (and so on), with face i between cells i-1 and i.
+		 * @param axis 0 or 1 for x or y
+		 */
+		const float *GetFaceVelocity(int axis) const { return mStaggered.Face(axis).Data(); }
+
+		/// Pressure, 1 component per cell at SolverResolution. Rows are GetPressureRowPitch() floats apart.
+		const float *GetPressure() const { return mPressure.Cell(0, 0); }
+
+		/// Floats between rows of GetPressure - the field has a ghost cell around each edge
+		int GetPressureRowPitch() const { return mPressure.RowPitch(); }
+
+		/**
+		 * \brief Adds a scalar carried along by the fluid, such as temperature or fuel.
+		 *
+		 * Channels are at the solver resolution and are advected with the ink (RS_ADVECT_DATA), all
+		 * in one pass that traces each cell once, so each costs about an interpolation per cell.
+		 * Diffusion uses jacobi iterations whatever the ViscositySolver. Init zeroes the channels
+		 * but keeps them.
+		 * @param diffusion the channel's viscosity, 0 for none
+		 * @param density how strongly the channel pushes the fluid up, as SetColorDensities
+		 * @return the channel's index
+		 */
+		int AddScalarChannel(float diffusion, float density) { return mChannels.Add(diffusion, density); }
+
+		/// Number of channels added with AddScalarChannel
+		int GetScalarChannelCount() const { return mChannels.Count(); }
+
+		/// Adds amount to a channel over a square of the given size (or sets it, with overwrite)
+		void InjectScalar(int channel, const Vector &position, float amount, float size, bool overwrite)
+		{
+			mChannels.Inject(channel, position, amount, size, overwrite);
+		}
+
+		/// A channel's values, 1 float per cell at SolverResolution
+		const float *GetScalarChannel(int channel) const { return mChannels[channel].field.Data(); }
+
+		static FluidOptions DefaultOptions();
+
+		/**
+		 * \brief Times the advection kernels, for comparing machines and options.
+		 *
+		 * Advects the velocity and ink 'steps' times over FixedTimeInterval, using the current
+		 * Advection option, so the fluid moves on as it would in Update.
+		 * @return the velocity and ink cells advected per second
+		 */
+		double BenchmarkAdvection(int steps);
+
+		/// Tiles solved in the last step with RS_SPARSE_TILES (16x16 cells each), or all of them without
+		int GetActiveTiles() const { return mTiles.ActiveTiles(); }
+
+		/// Tiles covering the solver grid
+		int GetTileCount() const { return mTiles.TileCount(); }
+
+	private:
+		// Methods...
+		void InitCallLists() {}
+		void InitPrograms(const std::string &) {}
+		void InitTextures();
+		void InitBuffers() {}
+		void DeletePrograms() {}
+
+		/// Gives each poller its velocity, through GetVelocities
+		void Poll(float time);
+
+		void UpdateStep(float time);
+		/// UpdateStep with the velocity on the cell faces, for RS_STAGGERED_VELOCITY
+		void StaggeredUpdateStep(float time);
+
+		/// Marks the tiles the steps work on this step, for RS_SPARSE_TILES
+		void UpdateTilesStep();
+
+		void AdvectDataStep(float time);
+		void AdvectVelocityStep(float time);
+		/// Both advection steps in one pass, for RS_FUSED_ADVECTION
+		void AdvectVelocityAndDataStep(float time);
+		void AdvectChannelsStep(float time);
+
+		void VorticityConfinementStep(float time);
+
+		void DiffuseDataStep(float time);
+		void DiffuseVelocityStep(float time);
+		void DiffuseChannelsStep(float time);
+
+		void UpdatePressureStep(float time);
+		/// Solves for mPressure from mDivField with the chosen pressure solver
+		void SolvePressure();
+		/// SolvePressure with FluidOptions::PressureRefinements; returns the fp32 iterations used
+		int RefinePressure(float alpha, float beta);
+		void SubtractPressureGradientStep(float time);
+
+		/// Copies the pressure and divergence to the unpadded fields the multigrid, conjugate gradient, cholesky and spectral solvers use
+		void UnpadPressure();
+		/// Copies the unpadded pressure back after one of those solvers, and fills its ghost cells
+		void PadPressure();
+
+		void PerturbDensityStep(float time);
+
+		void UpdateArbitraryBoundaryStep();
+		void UpdateOffsetStep();
+		void BoundaryVelocityStep();
+		void BoundaryPressureStep();
+
+		void InjectInkStep();
+		void InjectChannelsStep();
+		void PerturbFluidStep();
+
+		// Kernels
+		void Advect(CPUField &field, CPUField &output, const Vector &scale, float time,
+					CPUField *second = 0, CPUField *secondOutput = 0);
+		/// Second order advection for AD_MACCORMACK, with the same arguments as Advect
+		void MacCormack(CPUField &field, CPUField &output, const Vector &scale, float time);
+		int Jacobi4(CPUField &x, const CPUField &b, CPUField &output, float alpha, float beta, int maxIterations, float tolerance);
+		int Jacobi1(CPUField &x, const CPUField &b, CPUField &output, float alpha, float beta, int maxIterations, float tolerance);
+		/// Jacobi1 with 'depth' iterations per pass over the grid, for FluidOptions::JacobiBlockDepth
+		int BlockedJacobi1(CPUField &x, const CPUField &b, CPUField &output, float alpha, float beta,
+						   int maxIterations, float tolerance, int depth);
+		/// Implicit diffusion of a 4 component field with the chosen viscosity solver; returns the iterations used
+		int Diffuse(DiffusionSolver &solver, CPUField &field, const CPUField &source, CPUField &output, float alpha, float beta);
+		/// Red-black SOR for the same equation as Jacobi1, updating x in place
+		int RedBlack1(CPUField &x, const CPUField &b, float alpha, float beta, float omega, int maxIterations, float tolerance);
+
+		/// Returns the scratch field used as the right hand side of the diffusion solves (and by MacCormack), sized like field
+		CPUField &JacobiSource(const CPUField &field);
+
+		// Solver fields
+		CPUField mVelocity;
+		CPUField mPressure;
+		CPUField mDivField;
+		CPUField mBoundaryField;
+		CPUField mOutputSolver;
+		CPUField mOutputSolver1d;
+		CPUField mCorrection; ///< the pressure's correction and its right hand side, for PressureRefinements
+		CPUField mCorrectionSource;
+		CPUField mJacobiSource;
+		CPUField mVelocitySource; ///< JacobiSource for the velocity, in its layout
+		CPUField mUnpaddedPressure;
+		CPUField mUnpaddedDivField;
+
+		MultigridSolver mMultigrid;
+		ConjugateGradientSolver mConjugateGradient;
+		CholeskySolver mCholesky;
+		FluidSolver<2, double> mDoublePressure; ///< the PS_JACOBI pressure with a PressurePrecision of FP_DOUBLE, and PressureRefinements
+		DiffusionSolver mVelocityDiffusion;
+		DiffusionSolver mDataDiffusion; ///< the ink is at a different resolution, so has its own scratch fields
+		SpectralSolver mSpectral;
+		StaggeredVelocity mStaggered; ///< the face velocity, for RS_STAGGERED_VELOCITY
+
+		// Data (aka Ink/density) fields
+		CPUField mData;
+		CPUField mOutputRender;
+		CPUField mSingleData; ///< FP_HALF ink as floats, for the diffusion
+		CPUField mSingleOutputRender;
+
+		ScalarChannels mChannels;
+
+		TileMask mTiles;
+
+		/// A cell on a boundary, which takes its value from (minus) the cell it is offset to
+		struct BoundaryCell {
+			int cell;
+			int source;
+			float scale;
+		};
+		typedef std::vector<BoundaryCell> BoundaryCellList;
+
+		BoundaryCellList mVelocityBoundaryCells; ///< boundary cells + solid cells (source of -1 zeroes them)
+		BoundaryCellList mPressureBoundaryCells; ///< boundary cells only
+		std::vector<float> mBoundaryValues; ///< scratch for gathering boundary values before writing
+		bool mOffsetsDirty;
+		bool mHasObstacles; ///< any solid cells inside the grid
+
+		float mDensities[3];
+
+		Vec3Array mPollPositions; ///< the pollers' positions and velocities, gathered for GetVelocities
+		Vec3Array mPollVelocities;
+
+		// Texture the ink is uploaded to when rendering
+		GLuint mRenderTexture;
+	};
+}
@@ -0,0 +1,1850 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include "FluidCPU3D.h"
+
+#ifdef _OPENMP
+	#include <omp.h>
+#endif
+
+#include "CPUKernels.h"
+#include "IVelocityPoller.h"
+
+using namespace std;
+using namespace Fluidic;
+
+namespace
+{
+	/// The neighbouring rows of a row in a 3d field, clamped at the faces of the volume
+	struct RowNeighbours
+	{
+		int y, z;
+		int up, down, front, back;
+
+		RowNeighbours(int row, int height, int depth)
+		{
+			y = row % height;
+			z = row / height;
+			up = y < height-1 ? y+1 : y;
+			down = y > 0 ? y-1 : y;
+			front = z < depth-1 ? z+1 : z;
+			back = z > 0 ? z-1 : z;
+		}
+	};
+
+	/// One jacobi iteration for a single cell of a 1 component row, clamping at the ends of the row
+	inline float Jacobi1Cell(const float *row, const float *up, const float *down, const float *front, const float *back,
+							 const float *b, int x, int width, float alpha, float invBeta)
+	{
+		float left = row[x > 0 ? x-1 : 0];
+		float right = row[x < width-1 ? x+1 : width-1];
+		return (left + right + up[x] + down[x] + front[x] + back[x] + alpha*b[x]) * invBeta;
+	}
+
+	/**
+	 * One jacobi iteration for a 1 component row, 4 cells at a time. With ghosts (rows of a padded
+	 * field) the whole row is done that way and the output's ghost cells are set on the way;
+	 * without, the ends of the row are clamped. With tiles (a TileMask::TileRow), the cells of
+	 * inactive tiles are left alone.
+	 */
+	inline void Jacobi1Row(const float *row, const float *up, const float *down, const float *front, const float *back,
+						   const float *b, float *out, int width, float alpha, float invBeta, const unsigned char *tiles, int shift,
+						   bool ghosts)
+	{
+		const __m128 alpha4 = _mm_set1_ps(alpha);
+		const __m128 invBeta4 = _mm_set1_ps(invBeta);
+
+		int c = 0, end = width;
+		if (!ghosts)
+		{
+			if (!tiles || tiles[0]) out[0] = Jacobi1Cell(row, up, down, front, back, b, 0, width, alpha, invBeta);
+			c = 1;
+			end = width - 1;
+		}
+
+		for (; c + 4 <= end; c += 4)
+		{
+			if (tiles && !tiles[c >> shift] && !tiles[(c+3) >> shift]) continue;
+
+			__m128 sum = _mm_add_ps(
+				_mm_add_ps(_mm_loadu_ps(row + c-1), _mm_loadu_ps(row + c+1)),
+				_mm_add_ps(_mm_loadu_ps(up + c), _mm_loadu_ps(down + c)));
+			sum = _mm_add_ps(sum, _mm_add_ps(_mm_loadu_ps(front + c), _mm_loadu_ps(back + c)));
+			sum = _mm_add_ps(sum, _mm_mul_ps(alpha4, _mm_loadu_ps(b + c)));
+
+			_mm_storeu_ps(out + c, _mm_mul_ps(sum, invBeta4));
+		}
+		for (; c < end; c++)
+		{
+			if (tiles && !tiles[c >> shift]) continue;
+			out[c] = (row[c-1] + row[c+1] + up[c] + down[c] + front[c] + back[c] + alpha*b[c]) * invBeta;
+		}
+
+		if (ghosts)
+		{
+			out[-1] = out[0];
+			out[width] = out[width-1];
+		}
+		else if (width > 1 && (!tiles || tiles[(width-1) >> shift]))
+		{
+			out[width-1] = Jacobi1Cell(row, up, down, front, back, b, width-1, width, alpha, invBeta);
+		}
+	}
+
+	/// One jacobi iteration for a single cell of an interleaved 4 component row, reading the given left and right cells
+	inline __m128 Jacobi4Cell(const float *row, const float *up, const float *down, const float *front, const float *back,
+							  const float *b, int x, int left, int right, __m128 alpha4, __m128 invBeta4)
+	{
+		__m128 sum = _mm_add_ps(
+			_mm_add_ps(_mm_load_ps(row + 4*left), _mm_load_ps(row + 4*right)),
+			_mm_add_ps(_mm_load_ps(up + 4*x), _mm_load_ps(down + 4*x)));
+		sum = _mm_add_ps(sum, _mm_add_ps(_mm_load_ps(front + 4*x), _mm_load_ps(back + 4*x)));
+		sum = _mm_add_ps(sum, _mm_mul_ps(alpha4, _mm_load_ps(b + 4*x)));
+		return _mm_mul_ps(sum, invBeta4);
+	}
+
+	/**
+	 * One jacobi iteration for an interleaved 4 component row. The end cells are clamped, so the
+	 * rest of the row reads its neighbours directly. Tiles are as Jacobi1Row.
+	 */
+	inline void Jacobi4Row(const float *row, const float *up, const float *down, const float *front, const float *back,
+						   const float *b, float *out, int width, __m128 alpha4, __m128 invBeta4, const unsigned char *tiles, int shift)
+	{
+		const int last = width - 1;
+		if (!tiles || tiles[0])
+		{
+			_mm_store_ps(out, Jacobi4Cell(row, up, down, front, back, b, 0, 0, last > 0 ? 1 : 0, alpha4, invBeta4));
+		}
+
+		for (int c = 1; c < last; c++)
+		{
+			if (tiles && !tiles[c >> shift]) continue;
+			_mm_store_ps(out + 4*c, Jacobi4Cell(row, up, down, front, back, b, c, c-1, c+1, alpha4, invBeta4));
+		}
+
+		if (last > 0 && (!tiles || tiles[last >> shift]))
+		{
+			_mm_store_ps(out + 4*last, Jacobi4Cell(row, up, down, front, back, b, last, last-1, last, alpha4, invBeta4));
+		}
+	}
+
+	/**
+	 * The divergence of a single cell of a velocity row, reading the given left and right cells. up and
+	 * down point at the y components of the neighbouring rows, front and back at the z components;
+	 * cell is the field's CellPitch.
+	 */
+	inline float DivergenceCell(const float *row, const float *up, const float *down, const float *front, const float *back,
+								int x, int left, int right, int cell, float halfInvDX, float halfInvDY, float halfInvDZ)
+	{
+		return (row[right * cell] - row[left * cell]) * halfInvDX +
+			(up[x * cell] - down[x * cell]) * halfInvDY +
+			(front[x * cell] - back[x * cell]) * halfInvDZ;
+	}
+
+	/// The divergence of a velocity row, peeled like Jacobi4Row. Cells of inactive tiles get 0.
+	inline void DivergenceRow(const float *row, const float *up, const float *down, const float *front, const float *back,
+							  float *div, int width, int cell, float halfInvDX, float halfInvDY, float halfInvDZ,
+							  const unsigned char *tiles, int shift)
+	{
+		const int last = width - 1;
+		div[0] = !tiles || tiles[0] ?
+			DivergenceCell(row, up, down, front, back, 0, 0, last > 0 ? 1 : 0, cell, halfInvDX, halfInvDY, halfInvDZ) : 0;
+
+		for (int x = 1; x < last; x++)
+		{
+			div[x] = !tiles || tiles[x >> shift] ?
+				DivergenceCell(row, up, down, front, back, x, x-1, x+1, cell, halfInvDX, halfInvDY, halfInvDZ) : 0;
+		}
+
+		if (last > 0)
+		{
+			div[last] = !tiles || tiles[last >> shift] ?
+				DivergenceCell(row, up, down, front, back, last, last-1, last, cell, halfInvDX, halfInvDY, halfInvDZ) : 0;
+		}
+	}
+
+	/**
+	 * Vorticity3D for a single cell of a velocity row, reading the given left and right cells. The
+	 * output field has the velocity's layout.
+	 */
+	inline void VorticityCell(const CPUField &velocity, CPUField &output, const float *row, const float *up, const float *down,
+							  const float *front, const float *back, float *out, int x, int left, int right, __m128 scale)
+	{
+		const int cell = velocity.CellPitch();
+		const int pitch = velocity.ComponentPitch();
+
+		//(r.x + l.x, u.y + d.y, c.z + f.z)
+		float sum[4];
+		sum[0] = row[right * cell] + row[left * cell];
+		sum[1] = up[x * cell + pitch] + down[x * cell + pitch];
+		sum[2] = front[x * cell + 2*pitch] + back[x * cell + 2*pitch];
+		sum[3] = 0;
+
+		F4Store(output, out + x * cell, _mm_add_ps(F4Load(velocity, row + x * cell), _mm_mul_ps(scale, _mm_loadu_ps(sum))));
+	}
+}
+
+FluidCPU3D::FluidCPU3D() :
+Fluid(), mOffsetsDirty(true), mHasObstacles(false), mRenderTexture(0)
+{
+	mDensities[0] = mDensities[1] = mDensities[2] = 0;
+}
+
+FluidCPU3D::~FluidCPU3D(void)
+{
+	if (mRenderTexture) glDeleteTextures(1, &mRenderTexture);
+}
+
+FluidOptions FluidCPU3D::DefaultOptions()
+{
+	FluidOptions options;
+	options.Size = Vector(1,1,1);
+	options.SolverResolution = Vector(64,64,64);
+	options.RenderResolution = Vector(400, 400);
+	options.Viscosity = ViscosityAir;
+	options.SolverOptions = RS_NICE;
+	options.RenderOptions = RR_NONE;
+	options.DiffuseSteps = 10;
+	options.FixedTimeInterval = 0.02f;
+	options.SolverThreads = 0;
+	return options;
+}
+
+void FluidCPU3D::Init(const FluidOptions &options, bool)
+{
+	SetOptions(options);
+
+	ready = 0;
+
+#ifdef _OPENMP
+	if (mOptions.SolverThreads > 0) omp_set_num_threads(mOptions.SolverThreads);
+#endif
+
+	InitTextures();
+	ready = 1;
+
+	mTimeDelta = 0.f;
+	mLastSolveCount = 0;
+}
+
+void FluidCPU3D::InitTextures()
+{
+	int resX = mOptions.SolverResolution.xi(), resY = mOptions.SolverResolution.yi(), resZ = mOptions.SolverResolution.zi();
+
+	//4-component fields, but the velocity is 3 planes with FL_PLANAR
+	const FieldLayout layout = mOptions.VelocityLayout;
+	const int velocityComponents = layout == FL_PLANAR ? 3 : 4;
+	mVelocity.Resize(resX, resY, resZ, velocityComponents, 0, layout);
+	mOutputSolver.Resize(resX, resY, resZ, velocityComponents, 0, layout);
+	mVelocitySource.Resize(resX, resY, resZ, velocityComponents, 0, layout);
+	mJacobiSource.Resize(resX, resY, resZ, 4);
+
+	//1-component fields. The pressure ones are padded, for the stencils to read past the faces
+	mPressure.Resize(resX, resY, resZ, 1, 1);
+	mDivField.Resize(resX, resY, resZ, 1, 1);
+	mBoundaryField.Resize(resX, resY, resZ, 1);
+	mOutputSolver1d.Resize(resX, resY, resZ, 1, 1);
+	if (mOptions.PressureRefinements > 0)
+	{
+		mCorrection.Resize(resX, resY, resZ, 1, 1);
+		mCorrectionSource.Resize(resX, resY, resZ, 1, 1);
+	}
+	mUnpaddedPressure.Resize(resX, resY, resZ, 1);
+	mUnpaddedDivField.Resize(resX, resY, resZ, 1);
+	if (mOptions.GetOption(RS_BRICKED_PRESSURE) && BrickedField::Fits(resX, resY, resZ))
+	{
+		mBrickedPressure.Resize(resX, resY, resZ);
+		mBrickedDivField.Resize(resX, resY, resZ);
+		mBrickedOutput.Resize(resX, resY, resZ);
+	}
+
+	//data fields, which can be halves
+	const FieldPrecision inkPrecision = mOptions.GetPrecision(mOptions.InkPrecision, false);
+	mData.Resize(resX, resY, resZ, 4, 0, FL_INTERLEAVED, inkPrecision);
+	mOutputData.Resize(resX, resY, resZ, 4, 0, FL_INTERLEAVED, inkPrecision);
+	mChannels.Resize(resX, resY, resZ);
+	mTiles.Resize(resX, resY, resZ);
+	mStaggered.Resize(resX, resY, resZ);
+
+	mOffsetsDirty = true;
+}
+
+/** Render and Updates */
+void FluidCPU3D::Update(float time)
+{
+	if (!ready) return;
+
+	//Do the interactiony stuff
+	InjectInkStep();
+	InjectChannelsStep();
+	PerturbFluidStep();
+	UpdateArbitraryBoundaryStep();
+	UpdateOffsetStep();
+
+	mLastSolveCount = 0;
+	if (mOptions.FixedTimeInterval == 0)
+	{
+		if (time > 0) 
+		{
+			UpdateStep(time);
+			mLastSolveCount++;
+		}
+	}
+	else
+	{
+		mTimeDelta += time;
+		while (mTimeDelta > mOptions.FixedTimeInterval && mLastSolveCount < 10)
+		{
+			UpdateStep(mOptions.FixedTimeInterval);
+			mTimeDelta -= mOptions.FixedTimeInterval;
+			mLastSolveCount++;
+		}
+	}
+}
+
+void FluidCPU3D::UpdateStep(float time) 
+{
+	mViscosityIterations = 0;
+
+	if (mOptions.GetOption(RS_STAGGERED_VELOCITY))
+	{
+		StaggeredUpdateStep(time);
+		return;
+	}
+
+	PerturbDensityStep(time);
+	UpdateTilesStep();
+
+	// RS_ZCULL needs the depth buffer, so it is ignored on the CPU. So is RS_FUSED_PROJECTION: the
+	// boundary steps only visit the boundary cells here, so there's no full pass to fold away
+	BoundaryVelocityStep();
+	if (mOptions.GetOption(RS_VORTICITY_CONFINEMENT)) VorticityConfinementStep(time);
+	const bool fuseAdvection = FuseAdvection(true);
+	if (mOptions.GetOption(RS_ADVECT_VELOCITY) && !fuseAdvection) AdvectVelocityStep(time);
+	if (mOptions.GetOption(RS_DIFFUSE_VELOCITY)) DiffuseVelocityStep(time);
+
+	UpdatePressureStep(time);
+
+	BoundaryPressureStep();
+	SubtractPressureGradientStep(time);
+	
+	Poll(time);
+
+	//fused, the velocity is advected here too, by the projected velocity the ink uses
+	if (fuseAdvection) AdvectVelocityAndDataStep(time);
+	else if (mOptions.GetOption(RS_ADVECT_DATA)) AdvectDataStep(time);
+	if (mOptions.GetOption(RS_ADVECT_DATA)) AdvectChannelsStep(time);
+	if (mOptions.GetOption(RS_DIFFUSE_DATA)) DiffuseDataStep(time);
+	DiffuseChannelsStep(time);
+}
+
+// UpdateStep with the velocity on the faces, as FluidCPU2D::StaggeredUpdateStep
+void FluidCPU3D::StaggeredUpdateStep(float time)
+{
+	if (!ready) return;
+
+	const float invDelta[3] = { 1.f / mOptions.SolverDelta.x, 1.f / mOptions.SolverDelta.y, 1.f / mOptions.SolverDelta.z };
+
+	PerturbDensityStep(time);
+	UpdateTilesStep();
+
+	if (mOptions.GetOption(RS_VORTICITY_CONFINEMENT)) VorticityConfinementStep(time);
+	mStaggered.Stagger(mVelocity);
+
+	if (mOptions.GetOption(RS_ADVECT_VELOCITY))
+	{
+		const float alpha[3] = { time * invDelta[0], time * invDelta[1], time * invDelta[2] };
+		mStaggered.Advect(mBoundaryField, alpha);
+	}
+
+	if (mOptions.GetOption(RS_DIFFUSE_VELOCITY))
+	{
+		float alpha = mOptions.SolverDelta.x*mOptions.SolverDelta.y / (time * mOptions.Viscosity);
+		float beta = 6 + alpha;
+
+		for (int a = 0; a < 3; a++)
+		{
+			CPUField &source = mStaggered.Source(a);
+			source.CopyFrom(mStaggered.Face(a));
+			mViscosityIterations += Jacobi1(mStaggered.Face(a), source, mStaggered.Output(a), alpha, beta,
+				mOptions.GetViscosityMaxIterations(), mOptions.ViscosityTolerance);
+		}
+	}
+
+	mStaggered.SetBoundaries(mBoundaryField, mHasObstacles);
+	mStaggered.Divergence(mDivField, invDelta);
+	SolvePressure();
+	mStaggered.SubtractGradient(mPressure, invDelta);
+	mStaggered.SetBoundaries(mBoundaryField, mHasObstacles);
+	mStaggered.Centre(mVelocity);
+
+	Poll(time);
+
+	if (mOptions.GetOption(RS_ADVECT_DATA))
+	{
+		AdvectDataStep(time);
+		AdvectChannelsStep(time);
+	}
+	if (mOptions.GetOption(RS_DIFFUSE_DATA)) DiffuseDataStep(time);
+	DiffuseChannelsStep(time);
+}
+
+void FluidCPU3D::Render()
+{
+	if (!ready) return;
+	if (mOptions.RenderOptions == RR_NONE) return;
+
+	const int depth = mData.Depth();
+
+	//upload the ink as a 3d texture
+	if (!mRenderTexture) glGenTextures(1, &mRenderTexture);
+	glBindTexture(GL_TEXTURE_3D, mRenderTexture);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	if (mData.Half()) glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F_ARB, mData.Width(), mData.Height(), depth, 0, GL_RGBA, GL_HALF_FLOAT_ARB, mData.HalfData());
+	else glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, mData.Width(), mData.Height(), depth, 0, GL_RGBA, GL_FLOAT, mData.Data());
+
+	//draw a slice through each z layer, adding the ink up along the view
+	glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_TEXTURE_3D);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+	glDepthMask(GL_FALSE);
+	glColor4f(1, 1, 1, 2.f / depth);
+
+	glPushMatrix();
+	glTranslatef(-mOptions.Size.x/2, -mOptions.Size.y/2, -mOptions.Size.z/2);
+
+	glBegin(GL_QUADS);
+	for (int z = 0; z < depth; z++)
+	{
+		float r = (z + 0.5f) / depth;
+		float pz = r * mOptions.Size.z;
+		glTexCoord3f(0, 0, r); glVertex3f(0, 0, pz);
+		glTexCoord3f(1, 0, r); glVertex3f(mOptions.Size.x, 0, pz);
+		glTexCoord3f(1, 1, r); glVertex3f(mOptions.Size.x, mOptions.Size.y, pz);
+		glTexCoord3f(0, 1, r); glVertex3f(0, mOptions.Size.y, pz);
+	}
+	glEnd();
+
+	glPopMatrix();
+	glBindTexture(GL_TEXTURE_3D, 0);
+	glPopAttrib();
+}
+
+void FluidCPU3D::InjectCheckeredData()
+{
+	if (!ready) return;
+
+	for (int k=0;k<mData.Depth();k++)
+	{
+		for (int j=0;j<mData.Height();j++)
+		{
+			for (int i=0;i<mData.Width();i++)
+			{
+				//rgb, and an alpha of 1
+				F4Store(mData, mData.Index(i, j, k), _mm_setr_ps(
+					((i % 16 < 8) | (j % 16 > 8)) ? 1.f : 0.f,
+					((j % 16 < 8) | (k % 16 > 8)) ? 1.f : 0.f,
+					((k % 16 < 8) | (i % 16 > 8)) ? 1.f : 0.f,
+					1));
+			}
+		}
+	}
+}
+
+void FluidCPU3D::GenerateCircularVortex()
+{
+	if (!ready) return;
+
+	//circular vortex around the z axis, the same in each slice
+	for (int k=0;k<mVelocity.Depth();k++)
+	{
+		for (int j=0;j<mVelocity.Height();j++)
+		{
+			for (int i=0;i<mVelocity.Width();i++)
+			{
+				float velX = -1*(j - mOptions.SolverResolution.y/2.0f) / (mOptions.SolverResolution.y + 1.0f);
+				float velY = 1*(i - mOptions.SolverResolution.x/2.0f) / (mOptions.SolverResolution.x + 1.0f);
+				F4Store(mVelocity, mVelocity.Cell(i, j, k), _mm_setr_ps(velX, velY, 0, 0));
+			}
+		}
+	}
+}
+
+double FluidCPU3D::BenchmarkAdvection(int steps)
+{
+	if (!ready || steps <= 0) return 0;
+
+	double start = Seconds();
+	for (int i = 0; i < steps; i++)
+	{
+		AdvectVelocityStep(mOptions.FixedTimeInterval);
+		AdvectDataStep(mOptions.FixedTimeInterval);
+	}
+	double elapsed = Seconds() - start;
+
+	double cells = 2. * steps * mVelocity.Width() * mVelocity.Height() * mVelocity.Depth();
+	return elapsed > 0 ? cells / elapsed : 0;
+}
+
+void FluidCPU3D::Poll(float)
+{
+	if (mPollFrame++ % 20 == 0)
+	{
+		mPollPositions.Clear();
+		for (VelocityPollerList::iterator it = mVelocityPollers.begin(); it != mVelocityPollers.end(); it++)
+		{
+			mPollPositions.PushBack(Vec3f((*it)->GetPosition()));
+		}
+		GetVelocities(mPollPositions, mPollVelocities);
+
+		int i = 0;
+		for (VelocityPollerList::iterator it = mVelocityPollers.begin(); it != mVelocityPollers.end(); it++, i++)
+		{
+			(*it)->UpdateVelocity(Vector(mPollVelocities.X()[i], mPollVelocities.Y()[i], mPollVelocities.Z()[i]));
+		}
+	}
+}
+
+// As FluidCPU2D::GetVelocities, with z
+void FluidCPU3D::GetVelocities(const Vec3Array &positions, Vec3Array &velocities) const
+{
+	velocities.Resize(positions.Size());
+	if (!ready) return;
+
+	const int count = positions.Size();
+	const __m128 resX = _mm_set1_ps(mOptions.SolverResolution.x);
+	const __m128 resY = _mm_set1_ps(mOptions.SolverResolution.y);
+	const __m128 resZ = _mm_set1_ps(mOptions.SolverResolution.z);
+	const __m128 sizeX = _mm_set1_ps(mOptions.Size.x);
+	const __m128 sizeY = _mm_set1_ps(mOptions.Size.y);
+	const __m128 sizeZ = _mm_set1_ps(mOptions.Size.z);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 maxX = _mm_set1_ps((float)(mVelocity.Width() - 1));
+	const __m128 maxY = _mm_set1_ps((float)(mVelocity.Height() - 1));
+	const __m128 maxZ = _mm_set1_ps((float)(mVelocity.Depth() - 1));
+	const int pitch = mVelocity.ComponentPitch();
+	const float *posX = positions.X();
+	const float *posY = positions.Y();
+	const float *posZ = positions.Z();
+	float *velX = velocities.X();
+	float *velY = velocities.Y();
+	float *velZ = velocities.Z();
+
+	for (int i = 0; i < count; i += 4)
+	{
+		__m128 x = _mm_div_ps(_mm_mul_ps(_mm_loadu_ps(posX + i), resX), sizeX);
+		__m128 y = _mm_div_ps(_mm_mul_ps(_mm_loadu_ps(posY + i), resY), sizeY);
+		__m128 z = _mm_div_ps(_mm_mul_ps(_mm_loadu_ps(posZ + i), resZ), sizeZ);
+
+		int cellX[4], cellY[4], cellZ[4];
+		_mm_storeu_si128((__m128i*)cellX, _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(x, zero), maxX)));
+		_mm_storeu_si128((__m128i*)cellY, _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(y, zero), maxY)));
+		_mm_storeu_si128((__m128i*)cellZ, _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(z, zero), maxZ)));
+
+		for (int j = 0; j < 4 && i + j < count; j++)
+		{
+			const float *vel = mVelocity.Cell(cellX[j], cellY[j], cellZ[j]);
+			velX[i + j] = vel[0];
+			velY[i + j] = vel[pitch];
+			velZ[i + j] = vel[2*pitch];
+		}
+	}
+}
+
+/** Kernels */
+
+// Port of Advect3D. The ink is at the solver resolution in 3d, so no scale is needed. As in
+// FluidCPU2D::Advect, the traces are worked out for 4 cells at a time, and 'second' (if given) is
+// advected along the same traces.
+void FluidCPU3D::Advect(CPUField &field, CPUField &output, float time, CPUField *second, CPUField *secondOutput)
+{
+	const int width = field.Width();
+	const int height = field.Height();
+	const int rows = field.Height() * field.Depth();
+	const int blockWidth = width & ~3;
+	const float alphaX = time / mOptions.SolverDelta.x;
+	const float alphaY = time / mOptions.SolverDelta.y;
+	const float alphaZ = time / mOptions.SolverDelta.z;
+	const float maxX = width - 0.5f;
+	const float maxY = height - 0.5f;
+	const float maxZ = field.Depth() - 0.5f;
+
+	const __m128 alphaX4 = _mm_set1_ps(alphaX);
+	const __m128 alphaY4 = _mm_set1_ps(alphaY);
+	const __m128 alphaZ4 = _mm_set1_ps(alphaZ);
+	const __m128 min4 = _mm_set1_ps(0.5f);
+	const __m128 maxX4 = _mm_set1_ps(maxX);
+	const __m128 maxY4 = _mm_set1_ps(maxY);
+	const __m128 maxZ4 = _mm_set1_ps(maxZ);
+	const __m128 centres = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	const int pitch = mVelocity.ComponentPitch();
+
+	#pragma omp parallel for
+	for (int row = 0; row < rows; row++)
+	{
+		const int y = row % height;
+		const int z = row / height;
+		const __m128 coordY4 = _mm_set1_ps(y + 0.5f);
+		const __m128 coordZ4 = _mm_set1_ps(z + 0.5f);
+
+		int x = 0;
+		for (; x < blockWidth; x += 4)
+		{
+			int cellX[4], cellY[4], cellZ[4];
+			float tx[4], ty[4], tz[4];
+
+			//the 4 cells are always in the same tile
+			if (!mTiles.Active(x, y, z))
+			{
+				for (int i = 0; i < 4; i++)
+				{
+					F4Store(output, output.Index(x + i, y, z), F4Load(field, field.Index(x + i, y, z)));
+					if (second) F4Store(*secondOutput, secondOutput->Index(x + i, y, z), F4Load(*second, second->Index(x + i, y, z)));
+				}
+				continue;
+			}
+
+			__m128 velX = F4Load(mVelocity, mVelocity.Cell(x, y, z));
+			__m128 velY = F4Load(mVelocity, mVelocity.Cell(x + 1, y, z));
+			__m128 velZ = F4Load(mVelocity, mVelocity.Cell(x + 2, y, z));
+			__m128 velW = F4Load(mVelocity, mVelocity.Cell(x + 3, y, z));
+			_MM_TRANSPOSE4_PS(velX, velY, velZ, velW); //now one component of the 4 cells each
+
+			//step back a timestep, staying inside the volume
+			__m128 coordX4 = _mm_add_ps(_mm_set1_ps((float)x), centres);
+			__m128 backX = _mm_min_ps(maxX4, _mm_max_ps(min4, _mm_sub_ps(coordX4, _mm_mul_ps(alphaX4, velX))));
+			__m128 backY = _mm_min_ps(maxY4, _mm_max_ps(min4, _mm_sub_ps(coordY4, _mm_mul_ps(alphaY4, velY))));
+			__m128 backZ = _mm_min_ps(maxZ4, _mm_max_ps(min4, _mm_sub_ps(coordZ4, _mm_mul_ps(alphaZ4, velZ))));
+
+			//the cells that are boundaries keep their base value
+			int boundX[4], boundY[4], boundZ[4];
+			_mm_storeu_si128((__m128i*)boundX, _mm_cvttps_epi32(backX));
+			_mm_storeu_si128((__m128i*)boundY, _mm_cvttps_epi32(backY));
+			_mm_storeu_si128((__m128i*)boundZ, _mm_cvttps_epi32(backZ));
+
+			F4LerpSetup(backX, cellX, tx);
+			F4LerpSetup(backY, cellY, ty);
+			F4LerpSetup(backZ, cellZ, tz);
+			for (int i = 0; i < 4; i++)
+			{
+				if (*mBoundaryField.ClampedCell(boundX[i], boundY[i], boundZ[i]) > 0)
+				{
+					F4Store(output, output.Index(x + i, y, z), F4Load(field, field.Index(x + i, y, z)));
+					if (second) F4Store(*secondOutput, secondOutput->Index(x + i, y, z), F4Load(*second, second->Index(x + i, y, z)));
+				}
+				else
+				{
+					F4Store(output, output.Index(x + i, y, z), F4Trilerp(field, cellX[i], cellY[i], cellZ[i], tx[i], ty[i], tz[i]));
+					if (second) F4Store(*secondOutput, secondOutput->Index(x + i, y, z), F4Trilerp(*second, cellX[i], cellY[i], cellZ[i], tx[i], ty[i], tz[i]));
+				}
+			}
+		}
+
+		//the cells left over at the end of the row
+		for (; x < width; x++)
+		{
+			const int out = output.Index(x, y, z);
+			const float *currVel = mVelocity.Cell(x, y, z);
+
+			float backX = min(maxX, max(0.5f, x + 0.5f - alphaX * currVel[0]));
+			float backY = min(maxY, max(0.5f, y + 0.5f - alphaY * currVel[pitch]));
+			float backZ = min(maxZ, max(0.5f, z + 0.5f - alphaZ * currVel[2*pitch]));
+
+			if (!mTiles.Active(x, y, z) || *mBoundaryField.ClampedCell((int)backX, (int)backY, (int)backZ) > 0)
+			{
+				F4Store(output, out, F4Load(field, field.Index(x, y, z)));
+				if (second) F4Store(*secondOutput, secondOutput->Index(x, y, z), F4Load(*second, second->Index(x, y, z)));
+				continue;
+			}
+
+			F4Store(output, out, F4Trilerp(field, backX, backY, backZ));
+			if (second) F4Store(*secondOutput, secondOutput->Index(x, y, z), F4Trilerp(*second, backX, backY, backZ));
+		}
+	}
+
+	field.Swap(output);
+	if (second) second->Swap(*secondOutput);
+}
+
+// Port of MacCormackAdvect3D, see FluidCPU2D::MacCormack. The step back uses mJacobiSource as
+// scratch, and the result is clamped to the 8 cells it interpolated between.
+void FluidCPU3D::MacCormack(CPUField &field, CPUField &output, float time)
+{
+	const int width = field.Width();
+	const int height = field.Height();
+	const int rows = field.Height() * field.Depth();
+	const float alphaX = time / mOptions.SolverDelta.x;
+	const float alphaY = time / mOptions.SolverDelta.y;
+	const float alphaZ = time / mOptions.SolverDelta.z;
+	const float maxX = width - 0.5f;
+	const float maxY = height - 0.5f;
+	const float maxZ = field.Depth() - 0.5f;
+	const __m128 half = _mm_set1_ps(0.5f);
+	const int pitch = mVelocity.ComponentPitch();
+
+	//the velocity has its own scratch field, as it can be planar
+	CPUField &advected = &field == &mVelocity ? mVelocitySource : mJacobiSource;
+
+	#pragma omp parallel for
+	for (int row = 0; row < rows; row++)
+	{
+		const int y = row % height;
+		const int z = row / height;
+
+		for (int x = 0; x < width; x++)
+		{
+			const float *currVel = mVelocity.Cell(x, y, z);
+
+			float backX = min(maxX, max(0.5f, x + 0.5f - alphaX * currVel[0]));
+			float backY = min(maxY, max(0.5f, y + 0.5f - alphaY * currVel[pitch]));
+			float backZ = min(maxZ, max(0.5f, z + 0.5f - alphaZ * currVel[2*pitch]));
+
+			if (!mTiles.Active(x, y, z) || *mBoundaryField.ClampedCell((int)backX, (int)backY, (int)backZ) > 0)
+				F4Store(advected, advected.Index(x, y, z), F4Load(field, field.Index(x, y, z)));
+			else
+				F4Store(advected, advected.Index(x, y, z), F4Trilerp(field, backX, backY, backZ));
+		}
+	}
+
+	#pragma omp parallel for
+	for (int row = 0; row < rows; row++)
+	{
+		const int y = row % height;
+		const int z = row / height;
+
+		for (int x = 0; x < width; x++)
+		{
+			const int out = output.Index(x, y, z);
+			__m128 result = F4Load(advected, advected.Index(x, y, z));
+			const float *currVel = mVelocity.Cell(x, y, z);
+
+			float backX = min(maxX, max(0.5f, x + 0.5f - alphaX * currVel[0]));
+			float backY = min(maxY, max(0.5f, y + 0.5f - alphaY * currVel[pitch]));
+			float backZ = min(maxZ, max(0.5f, z + 0.5f - alphaZ * currVel[2*pitch]));
+			float forwardX = min(maxX, max(0.5f, x + 0.5f + alphaX * currVel[0]));
+			float forwardY = min(maxY, max(0.5f, y + 0.5f + alphaY * currVel[pitch]));
+			float forwardZ = min(maxZ, max(0.5f, z + 0.5f + alphaZ * currVel[2*pitch]));
+
+			//near boundaries one of the traces is meaningless, so keep the plain step back
+			if (!mTiles.Active(x, y, z) ||
+				*mBoundaryField.ClampedCell((int)backX, (int)backY, (int)backZ) > 0 ||
+				*mBoundaryField.ClampedCell((int)forwardX, (int)forwardY, (int)forwardZ) > 0)
+			{
+				F4Store(output, out, result);
+				continue;
+			}
+
+			__m128 back = F4Trilerp(advected, forwardX, forwardY, forwardZ);
+			result = _mm_add_ps(result, _mm_mul_ps(half, _mm_sub_ps(F4Load(field, field.Index(x, y, z)), back)));
+
+			__m128 low, high;
+			F4Bounds(field, backX, backY, backZ, low, high);
+			F4Store(output, out, _mm_min_ps(high, _mm_max_ps(low, result)));
+		}
+	}
+
+	field.Swap(output);
+}
+
+// Port of F4Jacobi3D, run until the residual is tolerance times alpha*b, or for maxIterations.
+// Returns the number of iterations used.
+int FluidCPU3D::Jacobi4(CPUField &x, const CPUField &b, CPUField &output, float alpha, float beta, int maxIterations, float tolerance)
+{
+	const int width = x.Width();
+	const int height = x.Height();
+	const int depth = x.Depth();
+	const int rows = height * depth;
+	const __m128 alpha4 = _mm_set1_ps(alpha);
+	const __m128 invBeta = _mm_set1_ps(1.f / beta);
+
+	//the residual of an iteration is beta times the change it makes
+	const double target = (double)tolerance * tolerance * alpha * alpha * SumOfSquares(b) / ((double)beta * beta);
+
+	//skipped cells are never written, so start both buffers the same
+	const bool sparse = mTiles.Covers(x);
+	const int shift = mTiles.TileShift();
+	if (sparse) output.CopyFrom(x);
+
+	const bool planar = x.Planar();
+
+	int i = 0;
+	while (i < maxIterations)
+	{
+		double change = 0;
+
+		#pragma omp parallel for reduction(+:change)
+		for (int r = 0; r < rows; r++)
+		{
+			RowNeighbours n(r, height, depth);
+			const float *row = x.Cell(0, n.y, n.z);
+			const float *up = x.Cell(0, n.up, n.z);
+			const float *down = x.Cell(0, n.down, n.z);
+			const float *front = x.Cell(0, n.y, n.front);
+			const float *back = x.Cell(0, n.y, n.back);
+			const float *rowB = b.Cell(0, n.y, n.z);
+			float *out = output.Cell(0, n.y, n.z);
+			const unsigned char *tiles = sparse ? mTiles.TileRow(n.y, n.z) : 0;
+
+			if (planar)
+			{
+				//a plane at a time, as Jacobi1
+				for (int p = 0; p < x.Planes(); p++)
+				{
+					const int offset = p * x.ComponentPitch();
+					Jacobi1Row(row + offset, up + offset, down + offset, front + offset, back + offset, rowB + offset,
+							   out + offset, width, alpha, 1.f / beta, tiles, shift, false);
+					change += SquaredChange(row + offset, out + offset, width);
+				}
+				continue;
+			}
+
+			Jacobi4Row(row, up, down, front, back, rowB, out, width, alpha4, invBeta, tiles, shift);
+			change += SquaredChange(row, out, 4*width);
+		}
+		x.Swap(output);
+		i++;
+
+		if (change <= target) break;
+	}
+
+	return i;
+}
+
+// Port of F1Jacobi3D, run like Jacobi4. The inside of each row is done 4 cells at a time.
+int FluidCPU3D::Jacobi1(CPUField &x, const CPUField &b, CPUField &output, float alpha, float beta, int maxIterations, float tolerance)
+{
+	const int width = x.Width();
+	const int height = x.Height();
+	const int depth = x.Depth();
+	const int rows = height * depth;
+	const float invBeta = 1.f / beta;
+
+	const bool sparse = mTiles.Covers(x);
+	const int shift = mTiles.TileShift();
+	if (mOptions.JacobiBlockDepth > 1 && !sparse)
+	{
+		return BlockedJacobi1(x, b, output, alpha, beta, maxIterations, tolerance, mOptions.JacobiBlockDepth);
+	}
+
+	//the residual of an iteration is beta times the change it makes
+	const double target = (double)tolerance * tolerance * alpha * alpha * SumOfSquares(b) / ((double)beta * beta);
+
+	//padded, each row sets its own ghosts, so only the neighbouring rows need clamping
+	const bool ghosts = x.Ghost() > 0;
+	x.FillGhosts();
+
+	if (sparse) output.CopyFrom(x);
+
+	int i = 0;
+	while (i < maxIterations)
+	{
+		double change = 0;
+
+		#pragma omp parallel for reduction(+:change)
+		for (int r = 0; r < rows; r++)
+		{
+			RowNeighbours n(r, height, depth);
+			const float *row = x.Cell(0, n.y, n.z);
+			const float *up = x.Cell(0, n.up, n.z);
+			const float *down = x.Cell(0, n.down, n.z);
+			const float *front = x.Cell(0, n.y, n.front);
+			const float *back = x.Cell(0, n.y, n.back);
+			const float *rowB = b.Cell(0, n.y, n.z);
+			float *out = output.Cell(0, n.y, n.z);
+			const unsigned char *tiles = sparse ? mTiles.TileRow(n.y, n.z) : 0;
+
+			Jacobi1Row(row, up, down, front, back, rowB, out, width, alpha, invBeta, tiles, shift, ghosts);
+
+			change += SquaredChange(row, out, width);
+		}
+		x.Swap(output);
+		i++;
+
+		if (change <= target) break;
+	}
+
+	return i;
+}
+
+// Jacobi1, doing 'depth' iterations in each pass over the grid - the wavefront of
+// FluidCPU2D::BlockedJacobi1, a slice at a time. Each thread takes a band of slices, and
+// iteration t works a slice behind iteration t-1, whose last few slices wait in a ring buffer.
+int FluidCPU3D::BlockedJacobi1(CPUField &x, const CPUField &b, CPUField &output, float alpha, float beta,
+							   int maxIterations, float tolerance, int depth)
+{
+	const int width = x.Width();
+	const int height = x.Height();
+	const int slices = x.Depth();
+	const float invBeta = 1.f / beta;
+	const int ringSlices = 4; //iteration t needs slices z-1 to z+1 of t-1, and z+1 is the newest
+
+	//the ring slices are laid out like x's, ghost cells at the ends of the rows included
+	const int ghost = x.Ghost();
+	const int stride = x.RowPitch();
+	const int slice = stride * height;
+
+#ifdef _OPENMP
+	const int bands = min(slices, omp_get_max_threads());
+#else
+	const int bands = 1;
+#endif
+
+	//as Jacobi1, checked against the change of the last iteration in each pass
+	const double target = (double)tolerance * tolerance * alpha * alpha * SumOfSquares(b) / ((double)beta * beta);
+
+	x.FillGhosts();
+
+	int i = 0;
+	while (i < maxIterations)
+	{
+		const int levels = min(depth, maxIterations - i);
+		double change = 0;
+
+		#pragma omp parallel for reduction(+:change)
+		for (int band = 0; band < bands; band++)
+		{
+			const int z0 = slices * band / bands;
+			const int z1 = slices * (band + 1) / bands;
+
+			//slices of the iterations between x and output
+			vector<float> ring((levels - 1) * ringSlices * slice);
+
+			//iteration t (1 to levels) covers the band and levels-t slices either side, and does
+			//slice s-t at step s
+			const int first = max(0, z0 - (levels - 1)) + 1;
+			const int last = z1 + levels;
+			for (int s = first; s < last; s++)
+			{
+				for (int t = 1; t <= levels; t++)
+				{
+					const int z = s - t;
+					if (z < max(0, z0 - (levels - t)) || z >= min(slices, z1 + (levels - t))) continue;
+
+					const int front = z < slices-1 ? z+1 : z;
+					const int back = z > 0 ? z-1 : z;
+					const float *in, *inFront, *inBack;
+					if (t == 1)
+					{
+						in = x.Cell(0, 0, z);
+						inFront = x.Cell(0, 0, front);
+						inBack = x.Cell(0, 0, back);
+					}
+					else
+					{
+						const float *level = &ring[(t - 2) * ringSlices * slice + ghost];
+						in = level + (z % ringSlices) * slice;
+						inFront = level + (front % ringSlices) * slice;
+						inBack = level + (back % ringSlices) * slice;
+					}
+
+					float *out = t == levels ? output.Cell(0, 0, z) : &ring[((t - 1) * ringSlices + z % ringSlices) * slice + ghost];
+					for (int y = 0; y < height; y++)
+					{
+						const int row = y * stride;
+						const int up = (y < height-1 ? y+1 : y) * stride;
+						const int down = (y > 0 ? y-1 : y) * stride;
+						Jacobi1Row(in + row, in + up, in + down, inFront + row, inBack + row, b.Cell(0, y, z), out + row,
+							width, alpha, invBeta, 0, 0, ghost > 0);
+
+						if (t == levels) change += SquaredChange(in + row, out + row, width);
+					}
+				}
+			}
+		}
+		x.Swap(output);
+		i += levels;
+
+		if (change <= target) break;
+	}
+
+	return i;
+}
+
+// Jacobi1 over 8x8x8 bricks, so the y and z neighbours are mostly in the same 2KB as the cell
+// rather than a row and a slice away. The tolerance is checked as in Jacobi1.
+int FluidCPU3D::BrickedJacobi1(CPUField &x, const CPUField &b, float alpha, float beta, int maxIterations, float tolerance)
+{
+	const double target = (double)tolerance * tolerance * alpha * alpha * SumOfSquares(b) / ((double)beta * beta);
+
+	mBrickedPressure.CopyFrom(x);
+	mBrickedDivField.CopyFrom(b);
+
+	int i = 0;
+	while (i < maxIterations)
+	{
+		double change = mBrickedOutput.Jacobi(mBrickedPressure, mBrickedDivField, alpha, beta);
+		mBrickedPressure.Swap(mBrickedOutput);
+		i++;
+
+		if (change <= target) break;
+	}
+
+	mBrickedPressure.CopyTo(x);
+	x.FillGhosts();
+	return i;
+}
+
+int FluidCPU3D::Diffuse(DiffusionSolver &solver, CPUField &field, const CPUField &source, CPUField &output, float alpha, float beta)
+{
+	if (mOptions.ViscositySolver == VS_CONJUGATE_GRADIENT)
+	{
+		return solver.Solve(field, source, alpha, mOptions.ViscosityTolerance, mOptions.GetViscosityMaxIterations());
+	}
+
+	return Jacobi4(field, source, output, alpha, beta, mOptions.GetViscosityMaxIterations(), mOptions.ViscosityTolerance);
+}
+
+int FluidCPU3D::RedBlack1(CPUField &x, const CPUField &b, float alpha, float beta, float omega, int maxIterations, float tolerance)
+{
+	const int width = x.Width();
+	const int height = x.Height();
+	const int depth = x.Depth();
+	const int rows = height * depth;
+	const float invBeta = 1.f / beta;
+	const bool sparse = mTiles.Covers(x);
+	const int shift = mTiles.TileShift();
+
+	//as for Jacobi1, with the change a gauss-seidel update would make
+	const double target = (double)tolerance * tolerance * alpha * alpha * SumOfSquares(b) / ((double)beta * beta);
+
+	int i = 0;
+	while (i < maxIterations)
+	{
+		double change = 0;
+
+		//a cell's neighbours are all the other colour, so each half can update in parallel, and the
+		//second half uses the values from the first
+		for (int parity = 0; parity < 2; parity++)
+		{
+			#pragma omp parallel for reduction(+:change)
+			for (int r = 0; r < rows; r++)
+			{
+				RowNeighbours n(r, height, depth);
+				float *row = x.Cell(0, n.y, n.z);
+				const float *up = x.Cell(0, n.up, n.z);
+				const float *down = x.Cell(0, n.down, n.z);
+				const float *front = x.Cell(0, n.y, n.front);
+				const float *back = x.Cell(0, n.y, n.back);
+				const float *rowB = b.Cell(0, n.y, n.z);
+				const unsigned char *tiles = sparse ? mTiles.TileRow(n.y, n.z) : 0;
+
+				for (int c = (n.y + n.z + parity) & 1; c < width; c += 2)
+				{
+					if (tiles && !tiles[c >> shift]) continue;
+
+					float delta = Jacobi1Cell(row, up, down, front, back, rowB, c, width, alpha, invBeta) - row[c];
+					row[c] += omega * delta;
+					change += delta * delta;
+				}
+			}
+		}
+		i++;
+
+		if (change <= target) break;
+	}
+
+	return i;
+}
+
+/** Steps - Simulation */
+void FluidCPU3D::UpdateTilesStep()
+{
+	if (!ready) return;
+
+	//the faces aren't tiled, so a staggered velocity solves everywhere
+	if (!mOptions.GetOption(RS_SPARSE_TILES) || mOptions.GetOption(RS_STAGGERED_VELOCITY))
+	{
+		mTiles.Disable();
+		return;
+	}
+
+	mTiles.Begin();
+	mTiles.Mark(mVelocity, mOptions.TileThreshold);
+	mTiles.Mark(mData, mOptions.TileThreshold);
+	mTiles.Mark(mDivField, mOptions.TileThreshold);
+	for (int c = 0; c < mChannels.Count(); c++)
+	{
+		mTiles.Mark(mChannels[c].field, mOptions.TileThreshold);
+	}
+	mTiles.Finish();
+}
+
+void FluidCPU3D::AdvectDataStep(float time)
+{
+	if (!ready) return;
+
+	if (mOptions.Advection == AD_MACCORMACK)
+		MacCormack(mData, mOutputData, time);
+	else
+		Advect(mData, mOutputData, time);
+}
+
+void FluidCPU3D::AdvectVelocityStep(float time)
+{
+	if (!ready) return;
+
+	if (mOptions.Advection == AD_MACCORMACK)
+		MacCormack(mVelocity, mOutputSolver, time);
+	else
+		Advect(mVelocity, mOutputSolver, time);
+}
+
+void FluidCPU3D::AdvectVelocityAndDataStep(float time)
+{
+	if (!ready) return;
+
+	//the ink is at the solver resolution in 3d, so it shares the trace with the velocity
+	Advect(mVelocity, mOutputSolver, time, &mData, &mOutputData);
+}
+
+// Port of Vorticity3D
+// The same trace as Advect, but each cell's corners and weights are found once and shared by
+// every channel, so another channel only costs its 8 lookups
+void FluidCPU3D::AdvectChannelsStep(float time)
+{
+	if (!ready) return;
+
+	const int count = mChannels.Count();
+	if (count == 0) return;
+
+	std::vector<const float*> in(count);
+	std::vector<float*> out(count);
+	for (int c = 0; c < count; c++)
+	{
+		in[c] = mChannels[c].field.Data();
+		out[c] = mChannels[c].output.Data();
+	}
+
+	const int width = mVelocity.Width();
+	const int height = mVelocity.Height();
+	const int depth = mVelocity.Depth();
+	const int rows = height * depth;
+	const int slice = width * height;
+	const float alphaX = time / mOptions.SolverDelta.x;
+	const float alphaY = time / mOptions.SolverDelta.y;
+	const float alphaZ = time / mOptions.SolverDelta.z;
+	const int pitch = mVelocity.ComponentPitch();
+	const float maxX = width - 0.5f;
+	const float maxY = height - 0.5f;
+	const float maxZ = depth - 0.5f;
+
+	#pragma omp parallel for
+	for (int row = 0; row < rows; row++)
+	{
+		const int y = row % height;
+		const int z = row / height;
+		for (int x = 0; x < width; x++)
+		{
+			const int cell = row * width + x;
+			const float *currVel = mVelocity.Cell(x, y, z);
+
+			float backX = min(maxX, max(0.5f, x + 0.5f - alphaX * currVel[0]));
+			float backY = min(maxY, max(0.5f, y + 0.5f - alphaY * currVel[pitch]));
+			float backZ = min(maxZ, max(0.5f, z + 0.5f - alphaZ * currVel[2*pitch]));
+
+			if (!mTiles.Active(x, y, z) || *mBoundaryField.ClampedCell((int)backX, (int)backY, (int)backZ) > 0)
+			{
+				for (int c = 0; c < count; c++) out[c][cell] = in[c][cell];
+				continue;
+			}
+
+			//the corners and weights, as F4Trilerp
+			float fx = floorf(backX - 0.5f), fy = floorf(backY - 0.5f), fz = floorf(backZ - 0.5f);
+			float tx = backX - 0.5f - fx, ty = backY - 0.5f - fy, tz = backZ - 0.5f - fz;
+			int x0 = CPUField::Clamp((int)fx, width), x1 = CPUField::Clamp((int)fx + 1, width);
+			int y0 = CPUField::Clamp((int)fy, height), y1 = CPUField::Clamp((int)fy + 1, height);
+			int z0 = CPUField::Clamp((int)fz, depth), z1 = CPUField::Clamp((int)fz + 1, depth);
+
+			const int base = z0 * slice + y0 * width + x0;
+			const int dx = x1 - x0, dy = (y1 - y0) * width, dz = (z1 - z0) * slice;
+
+			for (int c = 0; c < count; c++)
+			{
+				const float *f = in[c] + base;
+				float f11 = f[0] + (f[dz] - f[0]) * tz;
+				float f12 = f[dy] + (f[dy + dz] - f[dy]) * tz;
+				float f21 = f[dx] + (f[dx + dz] - f[dx]) * tz;
+				float f22 = f[dx + dy] + (f[dx + dy + dz] - f[dx + dy]) * tz;
+				float f1 = f11 + (f21 - f11) * tx;
+				float f2 = f12 + (f22 - f12) * tx;
+				out[c][cell] = f1 + (f2 - f1) * ty;
+			}
+		}
+	}
+
+	for (int c = 0; c < count; c++) mChannels[c].field.Swap(mChannels[c].output);
+}
+
+void FluidCPU3D::VorticityConfinementStep(float time)
+{
+	if (!ready) return;
+
+	const int width = mVelocity.Width();
+	const int height = mVelocity.Height();
+	const int depth = mVelocity.Depth();
+	const int rows = height * depth;
+	const __m128 scale = _mm_setr_ps(
+		0.5f * mOptions.SolverDelta.x * time,
+		0.5f * mOptions.SolverDelta.y * time,
+		0.5f * mOptions.SolverDelta.z * time,
+		0);
+	const int last = width - 1;
+
+	//the end cells are clamped, the rest read their neighbours directly
+	#pragma omp parallel for
+	for (int r = 0; r < rows; r++)
+	{
+		RowNeighbours n(r, height, depth);
+		const float *row = mVelocity.Cell(0, n.y, n.z);
+		const float *up = mVelocity.Cell(0, n.up, n.z);
+		const float *down = mVelocity.Cell(0, n.down, n.z);
+		const float *front = mVelocity.Cell(0, n.y, n.front);
+		const float *back = mVelocity.Cell(0, n.y, n.back);
+		float *out = mOutputSolver.Cell(0, n.y, n.z);
+
+		VorticityCell(mVelocity, mOutputSolver, row, up, down, front, back, out, 0, 0, last > 0 ? 1 : 0, scale);
+		for (int x = 1; x < last; x++)
+		{
+			VorticityCell(mVelocity, mOutputSolver, row, up, down, front, back, out, x, x-1, x+1, scale);
+		}
+		if (last > 0) VorticityCell(mVelocity, mOutputSolver, row, up, down, front, back, out, last, last-1, last, scale);
+	}
+
+	mVelocity.Swap(mOutputSolver);
+}
+
+// Unlike Fluid3D, alpha uses the area of a cell face (dx*dy) rather than dx*dy*dz, matching
+// the units of the 7 point laplacian
+void FluidCPU3D::DiffuseDataStep(float time)
+{
+	if (!ready) return;
+
+	float alpha = mOptions.SolverDelta.x*mOptions.SolverDelta.y / (time * mOptions.Viscosity);
+	float beta = 6 + alpha;
+
+	//the solvers work on floats, so halves are diffused as a copy
+	CPUField &data = mData.Half() ? mSingleData : mData;
+	CPUField &output = mData.Half() ? mSingleOutputData : mOutputData;
+	if (mData.Half())
+	{
+		if (!mSingleData.SameShape(mData)) mSingleData.ResizeLike(mData);
+		if (!mSingleOutputData.SameShape(mData)) mSingleOutputData.ResizeLike(mData);
+		mSingleData.CopyFrom(mData);
+	}
+
+	mJacobiSource.CopyFrom(data);
+	mViscosityIterations += Diffuse(mDiffusion, data, mJacobiSource, output, alpha, beta);
+
+	if (mData.Half()) mData.CopyFrom(mSingleData);
+}
+
+void FluidCPU3D::DiffuseVelocityStep(float time)
+{
+	if (!ready) return;
+
+	float alpha = mOptions.SolverDelta.x*mOptions.SolverDelta.y / (time * mOptions.Viscosity);
+	float beta = 6 + alpha;
+
+	mVelocitySource.CopyFrom(mVelocity);
+	mViscosityIterations += Diffuse(mDiffusion, mVelocity, mVelocitySource, mOutputSolver, alpha, beta);
+}
+
+void FluidCPU3D::DiffuseChannelsStep(float time)
+{
+	if (!ready) return;
+
+	for (int c = 0; c < mChannels.Count(); c++)
+	{
+		ScalarChannel &channel = mChannels[c];
+		if (channel.diffusion <= 0) continue;
+
+		float alpha = mOptions.SolverDelta.x*mOptions.SolverDelta.y / (time * channel.diffusion);
+		float beta = 6 + alpha;
+
+		CPUField &source = mChannels.Source();
+		source.CopyFrom(channel.field);
+		mViscosityIterations += Jacobi1(channel.field, source, channel.output, alpha, beta,
+			mOptions.GetViscosityMaxIterations(), mOptions.ViscosityTolerance);
+	}
+}
+
+void FluidCPU3D::UpdatePressureStep(float)
+{
+	if (!ready) return;
+
+	const int width = mVelocity.Width();
+	const int height = mVelocity.Height();
+	const int depth = mVelocity.Depth();
+	const int rows = height * depth;
+	const float halfInvDX = 0.5f / mOptions.SolverDelta.x;
+	const float halfInvDY = 0.5f / mOptions.SolverDelta.y;
+	const float halfInvDZ = 0.5f / mOptions.SolverDelta.z;
+	const int pitch = mVelocity.ComponentPitch();
+
+	const int shift = mTiles.TileShift();
+
+	// Calculate Divergence Field (DivField3D)
+	#pragma omp parallel for
+	for (int r = 0; r < rows; r++)
+	{
+		RowNeighbours n(r, height, depth);
+		const unsigned char *tiles = mTiles.Enabled() ? mTiles.TileRow(n.y, n.z) : 0;
+
+		DivergenceRow(mVelocity.Cell(0, n.y, n.z), mVelocity.Cell(0, n.up, n.z) + pitch, mVelocity.Cell(0, n.down, n.z) + pitch,
+					  mVelocity.Cell(0, n.y, n.front) + 2*pitch, mVelocity.Cell(0, n.y, n.back) + 2*pitch,
+					  mDivField.Cell(0, n.y, n.z), width, mVelocity.CellPitch(), halfInvDX, halfInvDY, halfInvDZ, tiles, shift);
+	}
+
+	SolvePressure();
+}
+
+void FluidCPU3D::SolvePressure()
+{
+	if (mOptions.SpectralPressure && !mHasObstacles)
+	{
+		//exact, so needs no iterations
+		UnpadPressure();
+		mSpectral.Solve(mUnpaddedPressure, mUnpaddedDivField, mOptions.SolverDelta.x * mOptions.SolverDelta.y);
+		PadPressure();
+		mPressureIterations = 1;
+		return;
+	}
+
+	if (mOptions.PressureRefinements > 0 &&
+		(mOptions.PressureSolver == PS_JACOBI || mOptions.PressureSolver == PS_RED_BLACK_SOR))
+	{
+		mPressureIterations = RefinePressure(-(mOptions.SolverDelta.x * mOptions.SolverDelta.y), 6.f);
+		return;
+	}
+
+	switch (mOptions.PressureSolver)
+	{
+	case PS_MULTIGRID:
+	case PS_FULL_MULTIGRID:
+		UnpadPressure();
+		mPressureIterations = mMultigrid.Solve(mUnpaddedPressure, mUnpaddedDivField, mOptions.SolverDelta.x * mOptions.SolverDelta.y,
+			mOptions.MultigridCycles, mOptions.PressureSolver == PS_FULL_MULTIGRID, mOptions.PressureTolerance);
+		PadPressure();
+		break;
+
+	case PS_CHOLESKY:
+		if (mCholesky.IsReady())
+		{
+			UnpadPressure();
+			mCholesky.Solve(mUnpaddedPressure, mUnpaddedDivField, mOptions.SolverDelta.x * mOptions.SolverDelta.y);
+			PadPressure();
+			mPressureIterations = 1;
+			break;
+		}
+		//too big to factorise, so use conjugate gradients
+		//fall through
+	case PS_CONJUGATE_GRADIENT:
+		UnpadPressure();
+		mPressureIterations = mConjugateGradient.Solve(mUnpaddedPressure, mUnpaddedDivField, mOptions.SolverDelta.x * mOptions.SolverDelta.y,
+			mOptions.PressureTolerance, mOptions.GetPressureMaxIterations());
+		PadPressure();
+		break;
+
+	case PS_RED_BLACK_SOR:
+		mPressureIterations = RedBlack1(mPressure, mDivField, -(mOptions.SolverDelta.x * mOptions.SolverDelta.y), 6.f,
+			mOptions.RelaxationFactor, mOptions.GetPressureMaxIterations(), mOptions.PressureTolerance);
+		break;
+
+	default:
+		if (mOptions.GetPrecision(mOptions.PressurePrecision, false) == FP_DOUBLE)
+		{
+			mPressureIterations = mDoublePressure.Solve(mPressure, mDivField, -(mOptions.SolverDelta.x * mOptions.SolverDelta.y), 6.f,
+				mOptions.GetPressureMaxIterations(), mOptions.PressureTolerance);
+			break;
+		}
+		if (mOptions.GetOption(RS_BRICKED_PRESSURE) && mBrickedPressure.Bricks() && !mTiles.Covers(mPressure))
+		{
+			mPressureIterations = BrickedJacobi1(mPressure, mDivField, -(mOptions.SolverDelta.x * mOptions.SolverDelta.y), 6.f,
+				mOptions.GetPressureMaxIterations(), mOptions.PressureTolerance);
+			break;
+		}
+		mPressureIterations = Jacobi1(mPressure, mDivField, mOutputSolver1d, -(mOptions.SolverDelta.x * mOptions.SolverDelta.y), 6.f,
+			mOptions.GetPressureMaxIterations(), mOptions.PressureTolerance);
+		break;
+	}
+}
+
+// Mixed precision iterative refinement. The pressure is held in doubles by mDoublePressure, which finds
+// the residual in double precision; the fp32 solver then finds the correction from 0, as the
+// same equation with the residual as its right hand side. Each refinement gains about as much as
+// a whole fp32 solve, where fp32 on its own stalls once the residual reaches its rounding.
+int FluidCPU3D::RefinePressure(float alpha, float beta)
+{
+	const double sumB = mDoublePressure.Load(mPressure, mDivField);
+	const double target = (double)mOptions.PressureTolerance * mOptions.PressureTolerance * alpha * alpha * sumB;
+
+	int iterations = 0;
+	for (int r = 0; r < mOptions.PressureRefinements; r++)
+	{
+		if (mDoublePressure.Residual(mCorrectionSource, alpha, beta) <= target) break;
+
+		mCorrection.Zero();
+		if (mOptions.PressureSolver == PS_RED_BLACK_SOR)
+			iterations += RedBlack1(mCorrection, mCorrectionSource, alpha, beta, mOptions.RelaxationFactor,
+				mOptions.GetPressureMaxIterations(), mOptions.PressureTolerance);
+		else
+			iterations += Jacobi1(mCorrection, mCorrectionSource, mOutputSolver1d, alpha, beta,
+				mOptions.GetPressureMaxIterations(), mOptions.PressureTolerance);
+
+		mDoublePressure.Correct(mCorrection);
+	}
+
+	mDoublePressure.Store(mPressure);
+	return iterations;
+}
+
+void FluidCPU3D::UnpadPressure()
+{
+	mUnpaddedPressure.CopyFrom(mPressure);
+	mUnpaddedDivField.CopyFrom(mDivField);
+}
+
+void FluidCPU3D::PadPressure()
+{
+	mPressure.CopyFrom(mUnpaddedPressure);
+	mPressure.FillGhosts();
+}
+
+// Port of SubtractPressureGradient3D. The pressure's ghost cells are up to date from
+// BoundaryPressureStep, so the neighbours are read without clamping.
+void FluidCPU3D::SubtractPressureGradientStep(float)
+{
+	if (!ready) return;
+
+	const int width = mVelocity.Width();
+	const int height = mVelocity.Height();
+	const int depth = mVelocity.Depth();
+	const int rows = height * depth;
+	const __m128 halfInvD = _mm_set_ps(0, 0.5f / mOptions.SolverDelta.z, 0.5f / mOptions.SolverDelta.y, 0.5f / mOptions.SolverDelta.x);
+	const float halfInvDX = 0.5f / mOptions.SolverDelta.x;
+	const float halfInvDY = 0.5f / mOptions.SolverDelta.y;
+	const float halfInvDZ = 0.5f / mOptions.SolverDelta.z;
+	const int pitch = mVelocity.ComponentPitch();
+
+	const int shift = mTiles.TileShift();
+
+	#pragma omp parallel for
+	for (int r = 0; r < rows; r++)
+	{
+		const int y = r % height, z = r / height;
+		const float *row = mPressure.Cell(0, y, z);
+		const float *up = mPressure.Cell(0, y+1, z);
+		const float *down = mPressure.Cell(0, y-1, z);
+		const float *front = mPressure.Cell(0, y, z+1);
+		const float *back = mPressure.Cell(0, y, z-1);
+		float *vel = mVelocity.Cell(0, y, z);
+		const unsigned char *tiles = mTiles.Enabled() ? mTiles.TileRow(y, z) : 0;
+
+		if (mVelocity.Planar())
+		{
+			//each component's row is 4 cells to a register
+			float *velX = vel, *velY = vel + pitch, *velZ = vel + 2*pitch;
+			int x = 0;
+			if (!tiles)
+			{
+				const __m128 halfInvDX4 = _mm_set1_ps(halfInvDX);
+				const __m128 halfInvDY4 = _mm_set1_ps(halfInvDY);
+				const __m128 halfInvDZ4 = _mm_set1_ps(halfInvDZ);
+				for (; x + 4 <= width; x += 4)
+				{
+					__m128 gradX = _mm_sub_ps(_mm_loadu_ps(row + x+1), _mm_loadu_ps(row + x-1));
+					__m128 gradY = _mm_sub_ps(_mm_loadu_ps(up + x), _mm_loadu_ps(down + x));
+					__m128 gradZ = _mm_sub_ps(_mm_loadu_ps(front + x), _mm_loadu_ps(back + x));
+					_mm_storeu_ps(velX + x, _mm_sub_ps(_mm_loadu_ps(velX + x), _mm_mul_ps(gradX, halfInvDX4)));
+					_mm_storeu_ps(velY + x, _mm_sub_ps(_mm_loadu_ps(velY + x), _mm_mul_ps(gradY, halfInvDY4)));
+					_mm_storeu_ps(velZ + x, _mm_sub_ps(_mm_loadu_ps(velZ + x), _mm_mul_ps(gradZ, halfInvDZ4)));
+				}
+			}
+			for (; x < width; x++)
+			{
+				if (tiles && !tiles[x >> shift]) continue;
+				velX[x] -= (row[x+1] - row[x-1]) * halfInvDX;
+				velY[x] -= (up[x] - down[x]) * halfInvDY;
+				velZ[x] -= (front[x] - back[x]) * halfInvDZ;
+			}
+			continue;
+		}
+
+		for (int x = 0; x < width; x++)
+		{
+			if (tiles && !tiles[x >> shift]) continue;
+
+			__m128 gradient = _mm_set_ps(0, front[x] - back[x], up[x] - down[x], row[x+1] - row[x-1]);
+			_mm_store_ps(vel + 4*x, _mm_sub_ps(_mm_load_ps(vel + 4*x), _mm_mul_ps(gradient, halfInvD)));
+		}
+	}
+}
+
+/** Steps - Interaction */
+void FluidCPU3D::InjectInkStep()
+{
+	if (!ready) return;
+	if (mInjectors.empty()) return;
+
+	//fill the cells whose centres are inside each injector's cube
+	for (InjectorList::iterator it = mInjectors.begin(); it != mInjectors.end(); ++it)
+	{
+		const Injector &inj = *it;
+
+		Vector d = mOptions.SolverDeltaInv * inj.size;
+		Vector pos = inj.position * mOptions.SolverDeltaInv - d/2;
+
+		int startX = max(0, (int)ceilf(pos.x - 0.5f));
+		int endX = min(mData.Width(), (int)ceilf(pos.x + d.x - 0.5f));
+		int startY = max(0, (int)ceilf(pos.y - 0.5f));
+		int endY = min(mData.Height(), (int)ceilf(pos.y + d.y - 0.5f));
+		int startZ = max(0, (int)ceilf(pos.z - 0.5f));
+		int endZ = min(mData.Depth(), (int)ceilf(pos.z + d.z - 0.5f));
+
+		__m128 color = _mm_setr_ps(inj.color.x, inj.color.y, inj.color.z, 1.f);
+
+		for (int z = startZ; z < endZ; z++)
+		{
+			for (int y = startY; y < endY; y++)
+			{
+				for (int x = startX; x < endX; x++)
+				{
+					const int cell = mData.Index(x, y, z);
+					F4Store(mData, cell, inj.overwrite ? color : _mm_add_ps(color, F4Load(mData, cell)));
+				}
+			}
+		}
+	}
+
+	mInjectors.clear();
+}
+
+void FluidCPU3D::InjectChannelsStep()
+{
+	if (!ready) return;
+
+	const ScalarChannels::InjectionList &injections = mChannels.Injections();
+	for (ScalarChannels::InjectionList::const_iterator it = injections.begin(); it != injections.end(); ++it)
+	{
+		const ScalarChannels::Injection &inj = *it;
+		CPUField &field = mChannels[inj.channel].field;
+
+		Vector d = mOptions.SolverDeltaInv * inj.size;
+		Vector pos = inj.position * mOptions.SolverDeltaInv - d/2;
+
+		int startX = max(0, (int)ceilf(pos.x - 0.5f));
+		int endX = min(field.Width(), (int)ceilf(pos.x + d.x - 0.5f));
+		int startY = max(0, (int)ceilf(pos.y - 0.5f));
+		int endY = min(field.Height(), (int)ceilf(pos.y + d.y - 0.5f));
+		int startZ = max(0, (int)ceilf(pos.z - 0.5f));
+		int endZ = min(field.Depth(), (int)ceilf(pos.z + d.z - 0.5f));
+
+		for (int z = startZ; z < endZ; z++)
+		{
+			for (int y = startY; y < endY; y++)
+			{
+				for (int x = startX; x < endX; x++)
+				{
+					float *cell = field.Cell(x, y, z);
+					*cell = inj.overwrite ? inj.amount : *cell + inj.amount;
+				}
+			}
+		}
+	}
+
+	mChannels.ClearInjections();
+}
+
+// Like Inject3D, adds the velocity to the cells inside a sphere around each perturbation
+void FluidCPU3D::PerturbFluidStep()
+{
+	if (!ready) return;
+	if (mPerturbers.empty()) return;
+
+	for (PerturberList::iterator it = mPerturbers.begin(); it != mPerturbers.end(); ++it)
+	{
+		Perturber perturber = *it;
+		Vector pos = perturber.position * mOptions.SolverDeltaInv;
+		float scale = perturber.size * mOptions.SolverDeltaInv.Length();
+
+		int startX = max(0, (int)floorf(pos.x - scale));
+		int endX = min(mVelocity.Width(), (int)ceilf(pos.x + scale));
+		int startY = max(0, (int)floorf(pos.y - scale));
+		int endY = min(mVelocity.Height(), (int)ceilf(pos.y + scale));
+		int startZ = max(0, (int)floorf(pos.z - scale));
+		int endZ = min(mVelocity.Depth(), (int)ceilf(pos.z + scale));
+
+		for (int z = startZ; z < endZ; z++)
+		{
+			for (int y = startY; y < endY; y++)
+			{
+				for (int x = startX; x < endX; x++)
+				{
+					float dx = pos.x - (x + 0.5f);
+					float dy = pos.y - (y + 0.5f);
+					float dz = pos.z - (z + 0.5f);
+					if (dx*dx + dy*dy + dz*dz < scale*scale)
+					{
+						float *vel = mVelocity.Cell(x, y, z);
+						const int pitch = mVelocity.ComponentPitch();
+						vel[0] += perturber.velocity.x;
+						vel[pitch] += perturber.velocity.y;
+						vel[2*pitch] += perturber.velocity.z;
+					}
+				}
+			}
+		}
+	}
+	mPerturbers.clear();
+}
+
+// Port of Perturb3D
+void FluidCPU3D::PerturbDensityStep(float time)
+{
+	if (!ready) return;
+
+	const int count = mVelocity.Width() * mVelocity.Height() * mVelocity.Depth();
+
+	#pragma omp parallel for
+	for (int i = 0; i < count; i++)
+	{
+		float col[4];
+		_mm_storeu_ps(col, F4Load(mData, mData.CellIndex(i)));
+		float density = col[0]*mDensities[0] + col[1]*mDensities[1] + col[2]*mDensities[2];
+		for (int c = 0; c < mChannels.Count(); c++)
+		{
+			density += mChannels[c].field.Data()[i] * mChannels[c].density;
+		}
+
+		mVelocity.Data()[mVelocity.CellIndex(i) + mVelocity.ComponentPitch()] += density * time;
+	}
+}
+
+void FluidCPU3D::UpdateArbitraryBoundaryStep()
+{
+	if (!ready) return;
+
+	// Boundary textures live on the GPU, so can't be read back here. Only AddArbitraryBoundary works.
+	mNextBoundaryTexture = 0;
+
+	if (mBoundaries.empty()) return;
+
+	//fill the cells whose centres are inside each boundary's cube
+	for (BoundaryList::iterator it = mBoundaries.begin(); it != mBoundaries.end(); ++it)
+	{
+		Boundary boundary = *it;
+		Vector d(boundary.size, boundary.size, boundary.size);
+		Vector p(boundary.position - d/2);
+		d = d / mOptions.Size * mOptions.SolverResolution;
+		p = p / mOptions.Size * mOptions.SolverResolution;
+
+		int startX = max(0, (int)ceilf(p.x - 0.5f));
+		int endX = min(mBoundaryField.Width(), (int)ceilf(p.x + d.x - 0.5f));
+		int startY = max(0, (int)ceilf(p.y - 0.5f));
+		int endY = min(mBoundaryField.Height(), (int)ceilf(p.y + d.y - 0.5f));
+		int startZ = max(0, (int)ceilf(p.z - 0.5f));
+		int endZ = min(mBoundaryField.Depth(), (int)ceilf(p.z + d.z - 0.5f));
+
+		for (int z = startZ; z < endZ; z++)
+		{
+			for (int y = startY; y < endY; y++)
+			{
+				for (int x = startX; x < endX; x++)
+				{
+					*mBoundaryField.Cell(x, y, z) = 1;
+				}
+			}
+		}
+	}
+
+	mOffsetsDirty = true;
+	mBoundaries.clear();
+}
+
+/** Steps - Boundaries */
+
+// Port of F4Boundary3D - only the boundary and solid cells are visited
+void FluidCPU3D::BoundaryVelocityStep()
+{
+	if (!ready) return;
+
+	const int count = (int)mVelocityBoundaryCells.size();
+	const int components = mVelocity.Components();
+	const int pitch = mVelocity.ComponentPitch();
+	mBoundaryValues.resize(components * count);
+
+	//gather first, as boundary cells can be the source of other boundary cells
+	#pragma omp parallel for
+	for (int i = 0; i < count; i++)
+	{
+		const BoundaryCell &bc = mVelocityBoundaryCells[i];
+		if (!mTiles.ActiveIndex(bc.cell)) continue;
+
+		const float *source = mVelocity.Data() + mVelocity.CellIndex(bc.source);
+		for (int c = 0; c < components; c++) mBoundaryValues[components*i + c] = bc.scale * source[c*pitch];
+	}
+
+	#pragma omp parallel for
+	for (int i = 0; i < count; i++)
+	{
+		if (!mTiles.ActiveIndex(mVelocityBoundaryCells[i].cell)) continue;
+
+		float *cell = mVelocity.Data() + mVelocity.CellIndex(mVelocityBoundaryCells[i].cell);
+		for (int c = 0; c < components; c++) cell[c*pitch] = mBoundaryValues[components*i + c];
+	}
+}
+
+// Port of F1Boundary3D - only the boundary cells are visited
+void FluidCPU3D::BoundaryPressureStep()
+{
+	if (!ready) return;
+
+	const int count = (int)mPressureBoundaryCells.size();
+	mBoundaryValues.resize(count);
+
+	#pragma omp parallel for
+	for (int i = 0; i < count; i++)
+	{
+		if (!mTiles.ActiveIndex(mPressureBoundaryCells[i].cell)) continue;
+		mBoundaryValues[i] = mPressure.Data()[mPressure.CellIndex(mPressureBoundaryCells[i].source)];
+	}
+
+	#pragma omp parallel for
+	for (int i = 0; i < count; i++)
+	{
+		if (!mTiles.ActiveIndex(mPressureBoundaryCells[i].cell)) continue;
+		mPressure.Data()[mPressure.CellIndex(mPressureBoundaryCells[i].cell)] = mBoundaryValues[i];
+	}
+
+	//the halo update - the gradient reads the ghost cells rather than clamping
+	mPressure.FillGhosts();
+}
+
+// Port of CalculateOffsets3D. As in FluidCPU2D, this builds the list of cells the boundary steps
+// need to update, and only when the boundaries have changed.
+void FluidCPU3D::UpdateOffsetStep() 
+{
+	if (!ready) return;
+	if (!mOffsetsDirty) return;
+
+	const int width = mBoundaryField.Width();
+	const int height = mBoundaryField.Height();
+	const int depth = mBoundaryField.Depth();
+
+	mVelocityBoundaryCells.clear();
+	mPressureBoundaryCells.clear();
+
+	for (int z = 0; z < depth; z++)
+	{
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				float left = *mBoundaryField.ClampedCell(x-1, y, z);
+				float right = *mBoundaryField.ClampedCell(x+1, y, z);
+				float up = *mBoundaryField.ClampedCell(x, y+1, z);
+				float down = *mBoundaryField.ClampedCell(x, y-1, z);
+				float front = *mBoundaryField.ClampedCell(x, y, z+1);
+				float back = *mBoundaryField.ClampedCell(x, y, z-1);
+
+				int offsetX = 0, offsetY = 0, offsetZ = 0;
+
+				if (right - left < 0) offsetX = 1; //arb right wall
+				if (right - left > 0) offsetX = -1; //arb left wall
+				if (up - down > 0) offsetY = -1; //arb bottom wall
+				if (up - down < 0) offsetY = 1; //arb top wall
+				if (front - back > 0) offsetZ = -1; //arb back wall
+				if (front - back < 0) offsetZ = 1; //arb front wall
+
+				if (x == 0) offsetX = 1; //left bound
+				if (x == width-1) offsetX = -1; //right bound
+				if (y == 0) offsetY = 1; //bottom bound
+				if (y == height-1) offsetY = -1; //top bound
+				if (z == 0) offsetZ = 1; //back bound
+				if (z == depth-1) offsetZ = -1; //front bound
+
+				float b = *mBoundaryField.Cell(x, y, z);
+
+				BoundaryCell bc;
+				bc.cell = x + width * (y + height * z);
+
+				if (offsetX != 0 || offsetY != 0 || offsetZ != 0)
+				{
+					bc.source = CPUField::Clamp(x + offsetX, width) +
+						width * (CPUField::Clamp(y + offsetY, height) + height * CPUField::Clamp(z + offsetZ, depth));
+
+					bc.scale = 1;
+					mPressureBoundaryCells.push_back(bc);
+
+					bc.scale = -(1 - b);
+					mVelocityBoundaryCells.push_back(bc);
+				}
+				else if (b != 0)
+				{
+					//solid cell - scaled down by the boundary value
+					bc.source = bc.cell;
+					bc.scale = 1 - b;
+					mVelocityBoundaryCells.push_back(bc);
+				}
+			}
+		}
+	}
+
+	mHasObstacles = false;
+	for (int i = 0; i < mBoundaryField.Size(); i++)
+	{
+		if (mBoundaryField.Data()[i] != 0)
+		{
+			mHasObstacles = true;
+			break;
+		}
+	}
+
+	//the pressure solvers leave out the solid cells, so are rebuilt with the offsets
+	if (mOptions.PressureSolver == PS_MULTIGRID || mOptions.PressureSolver == PS_FULL_MULTIGRID)
+	{
+		mMultigrid.Init(mBoundaryField);
+	}
+	else if (mOptions.PressureSolver == PS_CONJUGATE_GRADIENT ||
+		(mOptions.PressureSolver == PS_CHOLESKY && !mCholesky.Init(mBoundaryField, mOptions.DirectSolverMaxCells)))
+	{
+		mConjugateGradient.Init(mBoundaryField, mOptions.PressurePreconditioner);
+	}
+
+	if (mOptions.SpectralPressure && !mHasObstacles)
+	{
+		mSpectral.Init(mBoundaryField.Width(), mBoundaryField.Height(), mBoundaryField.Depth());
+	}
+
+	mOffsetsDirty = false;
+}
+
+void FluidCPU3D::SetColorDensities(float r, float g, float b)
+{
+	mDensities[0] = r;
+	mDensities[1] = g;
+	mDensities[2] = b;
+}
@@ -34,7 +34,12 @@ namespace Fluidic
 		RS_DIFFUSE_DATA = 8,
 		RS_VORTICITY_CONFINEMENT = 16,
 		RS_ZCULL = 32,
-		RS_DOUBLE_PRECISION = 64,
+		RS_DOUBLE_PRECISION = 64, ///< fp32 textures rather than fp16 on the GPU, for the fields left at FP_DEFAULT (see FieldPrecision)
+		RS_FUSED_ADVECTION = 128, ///< advect the velocity with the ink, after the projection, sharing the traces (needs the ink at the solver resolution)
+		RS_SPARSE_TILES = 256, ///< CPU only: skip the tiles where the fluid is still (see TileThreshold). RS_ZCULL is the GPU's version
+		RS_FUSED_PROJECTION = 512, ///< GPU only: set the boundaries inside the divergence, last jacobi and gradient passes instead of passes of their own. The CPU's boundary steps only visit the boundary cells, so it ignores this
+		RS_STAGGERED_VELOCITY = 1024, ///< CPU only: keep the velocity on the cell faces (a MAC grid), so the projection leaves no checkerboard modes
+		RS_BRICKED_PRESSURE = 2048, ///< CPU 3d only: run the PS_JACOBI pressure on 8x8x8 bricks in Morton order, when the resolution is a multiple of 8
 
 		RS_PERFECT = RS_ADVECT_VELOCITY | RS_ADVECT_DATA | RS_DIFFUSE_VELOCITY,
 		RS_ACCURATE = RS_ADVECT_VELOCITY | RS_ADVECT_DATA | RS_DIFFUSE_VELOCITY | RS_ZCULL,
@@ -53,6 +58,52 @@ namespace Fluidic
 		RR_ALL = ~0
 	};
 
+	/**
+	 * How the pressure is found each step. The GPU solvers support PS_JACOBI, PS_RED_BLACK_SOR and
+	 * PS_CHEBYSHEV_JACOBI, and use PS_JACOBI for the rest.
+	 */
+	enum PressureSolverType {
+		PS_JACOBI = 0, ///< DiffuseSteps jacobi iterations
+		PS_MULTIGRID, ///< up to MultigridCycles multigrid V-cycles, starting from the last step's pressure
+		PS_FULL_MULTIGRID, ///< a full multigrid cycle, then up to MultigridCycles V-cycles
+		PS_CONJUGATE_GRADIENT, ///< preconditioned conjugate gradient, until the residual drops by PressureTolerance
+		PS_RED_BLACK_SOR, ///< red-black gauss-seidel iterations, over-relaxed by RelaxationFactor
+		PS_CHEBYSHEV_JACOBI, ///< jacobi iterations with chebyshev weights (GPU only, the CPU solvers use PS_JACOBI)
+		PS_CHOLESKY, ///< direct solve with a sparse cholesky factor, kept until the obstacles change (up to DirectSolverMaxCells)
+	};
+
+	/// How the implicit viscosity is solved. The GPU solvers always use VS_JACOBI.
+	enum ViscositySolverType {
+		VS_JACOBI = 0, ///< up to ViscosityMaxIterations jacobi iterations
+		VS_CONJUGATE_GRADIENT, ///< diagonally preconditioned conjugate gradient - much faster for thick fluids
+	};
+
+	/// How the velocity and ink are carried along by the flow
+	enum AdvectionType {
+		AD_SEMI_LAGRANGIAN = 0, ///< trace each cell back and interpolate - cheap, but smears fine detail
+		AD_MACCORMACK, ///< trace back, then forward again to cancel most of the interpolation error (BFECC in two passes)
+	};
+
+	/// How the components of the CPU solvers' multi-component fields are stored
+	enum FieldLayout {
+		FL_INTERLEAVED = 0, ///< the components of each cell together, like the GPU's RGBA textures
+		FL_PLANAR, ///< each component in a plane of its own (structure of arrays)
+	};
+
+	/// How precisely a field is stored. The arithmetic is fp32 whatever the storage, bar FP_DOUBLE.
+	enum FieldPrecision {
+		FP_DEFAULT = 0, ///< fp32 textures with RS_DOUBLE_PRECISION and fp16 without on the GPU; fp32 on the CPU
+		FP_HALF, ///< fp16 - 16F textures on the GPU, converted to and from fp32 as the CPU kernels load and store it
+		FP_SINGLE, ///< fp32
+		FP_DOUBLE, ///< pressure only: the CPU solves it in fp64 (the GPU in fp32)
+	};
+
+	/// Preconditioner for PS_CONJUGATE_GRADIENT
+	enum PreconditionerType {
+		PC_INCOMPLETE_CHOLESKY = 0, ///< modified incomplete cholesky, MIC(0)
+		PC_MULTIGRID, ///< a multigrid V-cycle
+	};
+
 	const float ViscosityAir = 0.0000178f;
 	const float ViscosityWater = 0.0009f;
 	const float ViscosityOliveOil = 0.081f;
@@ -63,6 +114,8 @@ namespace Fluidic
 	 */
 	struct FluidOptions
 	{
+		FluidOptions();
+
 		/// The rate at which the fluid diffuses.
 		float Viscosity;
 
@@ -97,9 +150,111 @@ namespace Fluidic
 		 */
 		bool GetRenderOption(RenderOptionsFlags option) const;
 
+		/// PressureMaxIterations, or DiffuseSteps if it's 0
+		int GetPressureMaxIterations() const;
+
+		/// ViscosityMaxIterations, or DiffuseSteps if it's 0
+		int GetViscosityMaxIterations() const;
+
 		float FixedTimeInterval;
 		int DiffuseSteps;
 
+		/// Number of threads the CPU solvers use. 0 uses one per core
+		int SolverThreads;
+
+		/**
+		 * Method used to advect the velocity and ink. AD_MACCORMACK is clamped to the cells the step
+		 * back lands between, so it can't overshoot, and costs about twice AD_SEMI_LAGRANGIAN.
+		 */
+		AdvectionType Advection;
+
+		/**
+		 * With RS_SPARSE_TILES, a tile is solved while any cell's velocity, ink, divergence or scalar
+		 * channel is beyond this (or a neighbouring tile's is). The jacobi and red-black solvers
+		 * skip the other tiles, the rest of the pressure and viscosity solvers still cover the grid.
+		 */
+		float TileThreshold;
+
+		/// Method used to find the pressure
+		PressureSolverType PressureSolver;
+
+		/// Most V-cycles for PS_MULTIGRID and PS_FULL_MULTIGRID
+		int MultigridCycles;
+
+		/// Preconditioner for PS_CONJUGATE_GRADIENT
+		PreconditionerType PressurePreconditioner;
+
+		/// Over-relaxation factor for PS_RED_BLACK_SOR, between 1 (plain gauss-seidel) and 2
+		float RelaxationFactor;
+
+		/// Most fluid cells PS_CHOLESKY factorises. Bigger grids use PS_CONJUGATE_GRADIENT instead.
+		int DirectSolverMaxCells;
+
+		/**
+		 * When there are no obstacles, the CPU solvers find the pressure exactly with cosine transforms,
+		 * in place of PressureSolver.
+		 */
+		bool SpectralPressure;
+
+		/**
+		 * The CPU pressure solvers stop once the residual is this fraction of the (scaled) divergence.
+		 * 0 never stops early.
+		 */
+		float PressureTolerance;
+
+		/**
+		 * Iterative refinement of the CPU PS_JACOBI and PS_RED_BLACK_SOR pressure. The solution and
+		 * its residual are kept in fp64, and each refinement solves for a correction with the fp32
+		 * solver, so the residual carries on falling past where fp32 alone stalls. Stops once the
+		 * fp64 residual is within PressureTolerance. 0 is off.
+		 */
+		int PressureRefinements;
+
+		/// Most iterations for PS_JACOBI, PS_RED_BLACK_SOR and PS_CONJUGATE_GRADIENT (the GPU always runs this many). 0 uses DiffuseSteps
+		int PressureMaxIterations;
+
+		/**
+		 * Jacobi iterations the CPU solvers do in one pass over the grid, for PS_JACOBI and the scalar
+		 * channels' diffusion. Above 1, the iterations are pipelined down the grid through buffers
+		 * that stay in cache, rather than each streaming the whole grid from memory. The tolerance is
+		 * checked once per pass. Ignored with RS_SPARSE_TILES. 1 is off; 4 to 8 suits most grids.
+		 */
+		int JacobiBlockDepth;
+
+		/**
+		 * How the CPU solvers store the velocity. FL_PLANAR keeps 2 planes (3 in 3d) rather than RGBA
+		 * cells, so the divergence, gradient, buoyancy and jacobi diffusion passes only stream the
+		 * components they use, 4 cells at a time. The advection gathers each cell from the planes
+		 * instead, so costs a little more.
+		 */
+		FieldLayout VelocityLayout;
+
+		/**
+		 * How precisely each field is stored, in place of RS_DOUBLE_PRECISION's one setting for every
+		 * texture. The velocity covers the GPU's other RGBA solver textures (boundaries, offsets and
+		 * scratch), and the pressure its divergence and other 1 component textures. The 3d GPU fluid
+		 * shares the RGBA solver textures between the velocity and ink, so uses the finer of the two.
+		 *
+		 * The CPU solvers store the ink as fp16 with FP_HALF (its diffusion works on an fp32 copy),
+		 * and solve the PS_JACOBI pressure in fp64 with FP_DOUBLE. They keep the velocity and the
+		 * rest of the pressure solvers in fp32.
+		 */
+		FieldPrecision VelocityPrecision;
+		FieldPrecision PressurePrecision;
+		FieldPrecision InkPrecision;
+
+		/// A field's precision with FP_DEFAULT worked out, for the GPU or CPU solvers
+		FieldPrecision GetPrecision(FieldPrecision precision, bool gpu) const;
+
+		/// Method used for the velocity and ink diffusion
+		ViscositySolverType ViscositySolver;
+
+		/// The CPU viscosity solves stop once the residual is this fraction of the field. 0 never stops early.
+		float ViscosityTolerance;
+
+		/// Most iterations for a viscosity solve (the GPU always runs this many). 0 uses DiffuseSteps
+		int ViscosityMaxIterations;
+
 		// Note: The following cannot be relied on outside of the Fluid class
 		Vector RenderDelta;
 		Vector SolverDelta;
@@ -108,6 +263,17 @@ namespace Fluidic
 		Vector SolverToRenderScale; //2 means solver res is double render res, for example
 	};
 
+	inline FluidOptions::FluidOptions() :
+	Viscosity(0), SolverOptions(RS_NONE), RenderOptions(RR_NONE), FixedTimeInterval(0), DiffuseSteps(0),
+	SolverThreads(0), Advection(AD_SEMI_LAGRANGIAN), TileThreshold(1e-3f), PressureSolver(PS_JACOBI), MultigridCycles(2),
+	PressurePreconditioner(PC_INCOMPLETE_CHOLESKY), RelaxationFactor(1.7f), DirectSolverMaxCells(65536),
+	SpectralPressure(true),
+	PressureTolerance(1e-4f), PressureRefinements(0), PressureMaxIterations(0), JacobiBlockDepth(1), VelocityLayout(FL_INTERLEAVED),
+	VelocityPrecision(FP_DEFAULT), PressurePrecision(FP_DEFAULT), InkPrecision(FP_DEFAULT),
+	ViscositySolver(VS_JACOBI), ViscosityTolerance(1e-4f), ViscosityMaxIterations(0)
+	{
+	}
+
 	inline bool FluidOptions::GetOption(SolverOptionsFlags option) const
 	{ 
 		return ((SolverOptions & option) == option); 
@@ -118,4 +284,20 @@ namespace Fluidic
 		return ((RenderOptions & option) == option); 
 	}
 
+	inline int FluidOptions::GetPressureMaxIterations() const
+	{
+		return PressureMaxIterations > 0 ? PressureMaxIterations : DiffuseSteps;
+	}
+
+	inline int FluidOptions::GetViscosityMaxIterations() const
+	{
+		return ViscosityMaxIterations > 0 ? ViscosityMaxIterations : DiffuseSteps;
+	}
+
+	inline FieldPrecision FluidOptions::GetPrecision(FieldPrecision precision, bool gpu) const
+	{
+		if (precision != FP_DEFAULT) return precision;
+		return gpu && !GetOption(RS_DOUBLE_PRECISION) ? FP_HALF : FP_SINGLE;
+	}
+
 }
\ No newline at end of file
@@ -0,0 +1,274 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#pragma once
+
+#include <vector>
+
+#include "CPUField.h"
+
+namespace Fluidic
+{
+	/// The laplacian stencil in Dim dimensions. Enums, as the compilers we build with predate constexpr.
+	template <int Dim>
+	struct Stencil
+	{
+		enum
+		{
+			Neighbours = 2 * Dim, ///< cells around each cell, which is also beta for the pressure
+			RowNeighbours = 2 * (Dim - 1), ///< those of them in other rows
+		};
+	};
+
+	/// Sums column c of N rows, unrolled at compile time
+	template <int N, typename Scalar>
+	struct RowSum
+	{
+		static inline Scalar Add(const Scalar *const *rows, int c) { return RowSum<N - 1, Scalar>::Add(rows, c) + rows[N - 1][c]; }
+	};
+
+	template <typename Scalar>
+	struct RowSum<1, Scalar>
+	{
+		static inline Scalar Add(const Scalar *const *rows, int c) { return rows[0][c]; }
+	};
+
+	/**
+	 * \brief The CPU fluids' pressure core, on a grid of Dim dimensions stored as Scalar.
+	 *
+	 * Solves the same equation as the fluids' Jacobi1, x = (sum of the neighbours + alpha b) / beta,
+	 * with the cells outside the grid taking the value of the nearest edge cell. The dimension and
+	 * precision are template arguments, so each instantiation gets its own kernels with the
+	 * neighbour sums unrolled, and no checks of the dimension at run time. The fluids use it in
+	 * doubles, for a PressurePrecision of FP_DOUBLE and for iterative refinement
+	 * (FluidOptions::PressureRefinements), where their own fp32 solver finds each correction:
+	 * Load, then Residual and Correct in turn, then Store.
+	 *
+	 * The fields passed in stay floats, and are copied in and out around the iterations. 2d fields
+	 * have a depth of 1.
+	 */
+	template <int Dim, typename Scalar>
+	class FluidSolver
+	{
+	public:
+		FluidSolver() : mCells(0)
+		{
+			for (int a = 0; a < 3; a++) mSize[a] = 0;
+		}
+
+		/**
+		 * \brief Jacobi iterations for a 1 component field.
+		 *
+		 * @param x the field; its current value is the starting guess. Its ghost cells are filled after.
+		 * @param b the right hand side
+		 * @param maxIterations stop after this many iterations regardless
+		 * @param tolerance stop once the residual is this fraction of alpha*b
+		 * @return the number of iterations used
+		 */
+		int Solve(CPUField &x, const CPUField &b, float alpha, float beta, int maxIterations, float tolerance)
+		{
+			const double sumB = Load(x, b);
+
+			//as Jacobi1, the residual of an iteration is beta times the change it makes
+			const double target = (double)tolerance * tolerance * alpha * alpha * sumB / ((double)beta * beta);
+
+			int i = 0;
+			while (i < maxIterations)
+			{
+				const double change = Iterate((Scalar)alpha, (Scalar)1 / beta);
+				mX.swap(mOutput);
+				i++;
+
+				if (change <= target) break;
+			}
+
+			Store(x);
+			return i;
+		}
+
+		/// Copies x and b in, returning the sum of the squares of b
+		double Load(const CPUField &x, const CPUField &b)
+		{
+			Resize(x.Width(), x.Height(), x.Depth());
+
+			//a row at a time, as the fields can be padded
+			const int width = mSize[0];
+			const int rows = mCells / width;
+			double sumB = 0;
+			for (int r = 0; r < rows; r++)
+			{
+				const float *row = x.Cell(0, r % mSize[1], r / mSize[1]);
+				const float *rowB = b.Cell(0, r % mSize[1], r / mSize[1]);
+				for (int c = 0; c < width; c++)
+				{
+					mX[r * width + c] = row[c];
+					mB[r * width + c] = rowB[c];
+					sumB += (double)rowB[c] * rowB[c];
+				}
+			}
+			return sumB;
+		}
+
+		/**
+		 * \brief The residual of the solution, alpha b - (beta x - the sum of the neighbours).
+		 *
+		 * @param correction set to the residual divided by alpha, so that solving for the correction
+		 *		is the same equation with this as its b
+		 * @return the sum of the squares of the residual
+		 */
+		double Residual(CPUField &correction, float alpha, float beta) const
+		{
+			const int width = mSize[0];
+			const int rows = mCells / width;
+			const Scalar invAlpha = (Scalar)1 / alpha;
+
+			double sum = 0;
+
+			#pragma omp parallel for reduction(+:sum)
+			for (int r = 0; r < rows; r++)
+			{
+				const Scalar *row = &mX[r * width];
+				const Scalar *rowB = &mB[r * width];
+				const Scalar *neighbours[Stencil<Dim>::RowNeighbours];
+				RowNeighbours(r, row, neighbours);
+				float *out = correction.Cell(0, r % mSize[1], r / mSize[1]);
+
+				for (int c = 0; c < width; c++)
+				{
+					const Scalar around = Around(row, neighbours, c, c > 0 ? c-1 : c, c < width-1 ? c+1 : c);
+					const Scalar residual = alpha * rowB[c] - (beta * row[c] - around);
+					out[c] = (float)(residual * invAlpha);
+					sum += (double)residual * residual;
+				}
+			}
+
+			return sum;
+		}
+
+		/// Adds the solved correction to the solution
+		void Correct(const CPUField &correction)
+		{
+			const int width = mSize[0];
+			const int rows = mCells / width;
+
+			#pragma omp parallel for
+			for (int r = 0; r < rows; r++)
+			{
+				const float *row = correction.Cell(0, r % mSize[1], r / mSize[1]);
+				Scalar *x = &mX[r * width];
+				for (int c = 0; c < width; c++) x[c] += row[c];
+			}
+		}
+
+		/// Copies the solution back out to x, and fills its ghost cells
+		void Store(CPUField &x) const
+		{
+			const int width = mSize[0];
+			const int rows = mCells / width;
+			for (int r = 0; r < rows; r++)
+			{
+				float *row = x.Cell(0, r % mSize[1], r / mSize[1]);
+				for (int c = 0; c < width; c++) row[c] = (float)mX[r * width + c];
+			}
+			x.FillGhosts();
+		}
+
+	private:
+		FluidSolver(const FluidSolver &);
+		FluidSolver &operator=(const FluidSolver &);
+
+		void Resize(int width, int height, int depth)
+		{
+			if (width == mSize[0] && height == mSize[1] && depth == mSize[2]) return;
+
+			mSize[0] = width;
+			mSize[1] = height;
+			mSize[2] = depth;
+			mCells = width * height * depth;
+
+			mX.assign(mCells, 0);
+			mB.assign(mCells, 0);
+			mOutput.assign(mCells, 0);
+		}
+
+		/// The rows either side of row r along each axis after x, clamped at the edges
+		void RowNeighbours(int r, const Scalar *row, const Scalar **neighbours) const
+		{
+			int pitch = mSize[0];
+			for (int a = 1; a < Dim; a++)
+			{
+				const int coord = r % mSize[a];
+				r /= mSize[a];
+				neighbours[2*a - 2] = row - (coord > 0 ? pitch : 0);
+				neighbours[2*a - 1] = row + (coord < mSize[a]-1 ? pitch : 0);
+				pitch *= mSize[a];
+			}
+		}
+
+		/// Sum of the neighbours of column c
+		static inline Scalar Around(const Scalar *row, const Scalar *const *neighbours, int c, int left, int right)
+		{
+			return row[left] + row[right] + RowSum<Stencil<Dim>::RowNeighbours, Scalar>::Add(neighbours, c);
+		}
+
+		/// One iteration from mX into mOutput, returning the sum of the squared changes
+		double Iterate(Scalar alpha, Scalar invBeta)
+		{
+			const int width = mSize[0];
+			const int rows = mCells / width;
+
+			double change = 0;
+
+			#pragma omp parallel for reduction(+:change)
+			for (int r = 0; r < rows; r++)
+			{
+				const Scalar *row = &mX[r * width];
+				const Scalar *rowB = &mB[r * width];
+				const Scalar *neighbours[Stencil<Dim>::RowNeighbours];
+				RowNeighbours(r, row, neighbours);
+				Scalar *out = &mOutput[r * width];
+
+				//the ends of the row clamp, so the inside has no branches
+				out[0] = (Around(row, neighbours, 0, 0, width > 1 ? 1 : 0) + alpha * rowB[0]) * invBeta;
+				for (int c = 1; c < width-1; c++)
+				{
+					out[c] = (Around(row, neighbours, c, c-1, c+1) + alpha * rowB[c]) * invBeta;
+				}
+				if (width > 1) out[width-1] = (Around(row, neighbours, width-1, width-2, width-1) + alpha * rowB[width-1]) * invBeta;
+
+				for (int c = 0; c < width; c++)
+				{
+					const double diff = out[c] - row[c];
+					change += diff * diff;
+				}
+			}
+
+			return change;
+		}
+
+		int mSize[3]; ///< width, height and depth
+		int mCells;
+
+		std::vector<Scalar> mX;
+		std::vector<Scalar> mB;
+		std::vector<Scalar> mOutput;
+	};
+}
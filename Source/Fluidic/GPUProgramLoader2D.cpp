@@ -48,6 +48,39 @@ GPUProgram *GPUProgramLoader2D::Advect()
 	program->AddParam("scale");
 	return program;
 }
+GPUProgram *GPUProgramLoader2D::SimpleAdvect() 
+{
+	GPUProgram *program = new GPUProgram();
+	program->SetProgram(mCgContext, GetPathTo("Advect"), mCgFragmentProfile, "SimpleAdvect2D");
+	program->AddParam("velocity");
+	program->AddParam("data");
+	program->AddParam("d");
+	program->AddParam("boundary");
+	program->AddParam("scale");
+	return program;
+}
+GPUProgram *GPUProgramLoader2D::MacCormackAdvect() 
+{
+	GPUProgram *program = new GPUProgram();
+	program->SetProgram(mCgContext, GetPathTo("Advect"), mCgFragmentProfile, "MacCormackAdvect2D");
+	program->AddParam("velocity");
+	program->AddParam("data");
+	program->AddParam("advected");
+	program->AddParam("d");
+	program->AddParam("boundary");
+	program->AddParam("scale");
+	return program;
+}
+GPUProgram *GPUProgramLoader2D::FusedAdvect() 
+{
+	GPUProgram *program = new GPUProgram();
+	program->SetProgram(mCgContext, GetPathTo("Advect"), mCgFragmentProfile, "FusedAdvect2D");
+	program->AddParam("velocity");
+	program->AddParam("data");
+	program->AddParam("d");
+	program->AddParam("boundary");
+	return program;
+}
 GPUProgram *GPUProgramLoader2D::Vorticity() 
 {
 	GPUProgram *program = new GPUProgram();
@@ -113,6 +146,17 @@ GPUProgram *GPUProgramLoader2D::F1Jacobi()
 	program->AddParam("beta");
 	return program;
 }
+GPUProgram *GPUProgramLoader2D::F1JacobiBoundary() 
+{
+	GPUProgram *program = new GPUProgram();
+	program->SetProgram(mCgContext, GetPathTo("Jacobi"), mCgFragmentProfile, "F1JacobiBoundary2D");
+	program->AddParam("x");
+	program->AddParam("b");
+	program->AddParam("offset");
+	program->AddParam("alpha");
+	program->AddParam("beta");
+	return program;
+}
 GPUProgram *GPUProgramLoader2D::F4Jacobi() 
 {
 	GPUProgram *program = new GPUProgram();
@@ -123,6 +167,30 @@ GPUProgram *GPUProgramLoader2D::F4Jacobi()
 	program->AddParam("beta");
 	return program;
 }
+GPUProgram *GPUProgramLoader2D::F1RedBlack() 
+{
+	GPUProgram *program = new GPUProgram();
+	program->SetProgram(mCgContext, GetPathTo("Jacobi"), mCgFragmentProfile, "F1RedBlack2D");
+	program->AddParam("x");
+	program->AddParam("b");
+	program->AddParam("alpha");
+	program->AddParam("beta");
+	program->AddParam("omega");
+	program->AddParam("parity");
+	return program;
+}
+GPUProgram *GPUProgramLoader2D::F1ChebyshevJacobi() 
+{
+	GPUProgram *program = new GPUProgram();
+	program->SetProgram(mCgContext, GetPathTo("Jacobi"), mCgFragmentProfile, "F1ChebyshevJacobi2D");
+	program->AddParam("x");
+	program->AddParam("previous");
+	program->AddParam("b");
+	program->AddParam("alpha");
+	program->AddParam("beta");
+	program->AddParam("omega");
+	return program;
+}
 GPUProgram *GPUProgramLoader2D::DivField() 
 {
 	GPUProgram *program = new GPUProgram();
@@ -131,6 +199,16 @@ GPUProgram *GPUProgramLoader2D::DivField()
 	program->AddParam("d");
 	return program;
 }	
+GPUProgram *GPUProgramLoader2D::DivFieldBoundary() 
+{
+	GPUProgram *program = new GPUProgram();
+	program->SetProgram(mCgContext, GetPathTo("Pressure"), mCgFragmentProfile, "DivFieldBoundary2D");
+	program->AddParam("velocity");
+	program->AddParam("offset");
+	program->AddParam("boundaries");
+	program->AddParam("d");
+	return program;
+}
 GPUProgram *GPUProgramLoader2D::SubtractPressureGradient() 
 {
 	GPUProgram *program = new GPUProgram();
@@ -140,6 +218,17 @@ GPUProgram *GPUProgramLoader2D::SubtractPressureGradient()
 	program->AddParam("d");
 	return program;
 }
+GPUProgram *GPUProgramLoader2D::SubtractPressureGradientBoundary() 
+{
+	GPUProgram *program = new GPUProgram();
+	program->SetProgram(mCgContext, GetPathTo("Pressure"), mCgFragmentProfile, "SubtractPressureGradientBoundary2D");
+	program->AddParam("pressure");
+	program->AddParam("velocity");
+	program->AddParam("offset");
+	program->AddParam("boundaries");
+	program->AddParam("d");
+	return program;
+}
 GPUProgram *GPUProgramLoader2D::ZCull() 
 {
 	GPUProgram *program = new GPUProgram();
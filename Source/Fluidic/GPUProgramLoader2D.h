@@ -37,6 +37,9 @@ namespace Fluidic
 	public:
 		GPUProgramLoader2D(const std::string &cgHomeDir, CGcontext context, CGprofile profile);
 		GPUProgram *Advect();
+		GPUProgram *SimpleAdvect();
+		GPUProgram *MacCormackAdvect();
+		GPUProgram *FusedAdvect();
 		GPUProgram *Vorticity();
 		GPUProgram *Inject();
 		GPUProgram *Perturb();
@@ -44,9 +47,14 @@ namespace Fluidic
 		GPUProgram *F4Boundary();
 		GPUProgram *Offset();
 		GPUProgram *F1Jacobi();
+		GPUProgram *F1JacobiBoundary();
 		GPUProgram *F4Jacobi();
+		GPUProgram *F1RedBlack();
+		GPUProgram *F1ChebyshevJacobi();
 		GPUProgram *DivField();
+		GPUProgram *DivFieldBoundary();
 		GPUProgram *SubtractPressureGradient();
+		GPUProgram *SubtractPressureGradientBoundary();
 		GPUProgram *ZCull();
 		GPUProgram *Render(const FluidOptions &options);
 
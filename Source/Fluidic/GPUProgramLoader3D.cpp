@@ -50,6 +50,43 @@ GPUProgram *GPUProgramLoader3D::Advect()
 	program->AddParam("slabs");
 	return program;
 }
+GPUProgram *GPUProgramLoader3D::SimpleAdvect() 
+{
+	GPUProgram *program = new GPUProgram();
+	program->SetProgram(mCgContext, GetPathTo("Advect"), mCgFragmentProfile, "SimpleAdvect3D");
+	program->AddParam("velocity");
+	program->AddParam("data");
+	program->AddParam("d");
+	program->AddParam("boundary");
+	program->AddParam("res");
+	program->AddParam("slabs");
+	return program;
+}
+GPUProgram *GPUProgramLoader3D::MacCormackAdvect() 
+{
+	GPUProgram *program = new GPUProgram();
+	program->SetProgram(mCgContext, GetPathTo("Advect"), mCgFragmentProfile, "MacCormackAdvect3D");
+	program->AddParam("velocity");
+	program->AddParam("data");
+	program->AddParam("advected");
+	program->AddParam("d");
+	program->AddParam("boundary");
+	program->AddParam("res");
+	program->AddParam("slabs");
+	return program;
+}
+GPUProgram *GPUProgramLoader3D::FusedAdvect() 
+{
+	GPUProgram *program = new GPUProgram();
+	program->SetProgram(mCgContext, GetPathTo("Advect"), mCgFragmentProfile, "FusedAdvect3D");
+	program->AddParam("velocity");
+	program->AddParam("data");
+	program->AddParam("d");
+	program->AddParam("boundary");
+	program->AddParam("res");
+	program->AddParam("slabs");
+	return program;
+}
 GPUProgram *GPUProgramLoader3D::Vorticity() 
 {
 	GPUProgram *program = new GPUProgram();
@@ -127,6 +164,19 @@ GPUProgram *GPUProgramLoader3D::F1Jacobi()
 	program->AddParam("slabs");
 	return program;
 }
+GPUProgram *GPUProgramLoader3D::F1JacobiBoundary() 
+{
+	GPUProgram *program = new GPUProgram();
+	program->SetProgram(mCgContext, GetPathTo("Jacobi"), mCgFragmentProfile, "F1JacobiBoundary3D");
+	program->AddParam("x");
+	program->AddParam("b");
+	program->AddParam("offset");
+	program->AddParam("alpha");
+	program->AddParam("beta");
+	program->AddParam("res");
+	program->AddParam("slabs");
+	return program;
+}
 GPUProgram *GPUProgramLoader3D::F4Jacobi() 
 {
 	GPUProgram *program = new GPUProgram();
@@ -140,6 +190,34 @@ GPUProgram *GPUProgramLoader3D::F4Jacobi()
 	program->AddParam("slabs");
 	return program;
 }
+GPUProgram *GPUProgramLoader3D::F1RedBlack() 
+{
+	GPUProgram *program = new GPUProgram();
+	program->SetProgram(mCgContext, GetPathTo("Jacobi"), mCgFragmentProfile, "F1RedBlack3D");
+	program->AddParam("x");
+	program->AddParam("b");
+	program->AddParam("alpha");
+	program->AddParam("beta");
+	program->AddParam("omega");
+	program->AddParam("parity");
+	program->AddParam("res");
+	program->AddParam("slabs");
+	return program;
+}
+GPUProgram *GPUProgramLoader3D::F1ChebyshevJacobi() 
+{
+	GPUProgram *program = new GPUProgram();
+	program->SetProgram(mCgContext, GetPathTo("Jacobi"), mCgFragmentProfile, "F1ChebyshevJacobi3D");
+	program->AddParam("x");
+	program->AddParam("previous");
+	program->AddParam("b");
+	program->AddParam("alpha");
+	program->AddParam("beta");
+	program->AddParam("omega");
+	program->AddParam("res");
+	program->AddParam("slabs");
+	return program;
+}
 GPUProgram *GPUProgramLoader3D::DivField() 
 {
 	GPUProgram *program = new GPUProgram();
@@ -150,6 +228,17 @@ GPUProgram *GPUProgramLoader3D::DivField()
 	program->AddParam("slabs");
 	return program;
 }	
+GPUProgram *GPUProgramLoader3D::DivFieldBoundary() 
+{
+	GPUProgram *program = new GPUProgram();
+	program->SetProgram(mCgContext, GetPathTo("Pressure"), mCgFragmentProfile, "DivFieldBoundary3D");
+	program->AddParam("velocity");
+	program->AddParam("offset");
+	program->AddParam("d");
+	program->AddParam("res");
+	program->AddParam("slabs");
+	return program;
+}
 GPUProgram *GPUProgramLoader3D::SubtractPressureGradient() 
 {
 	GPUProgram *program = new GPUProgram();
@@ -161,6 +250,18 @@ GPUProgram *GPUProgramLoader3D::SubtractPressureGradient()
 	program->AddParam("slabs");
 	return program;
 }
+GPUProgram *GPUProgramLoader3D::SubtractPressureGradientBoundary() 
+{
+	GPUProgram *program = new GPUProgram();
+	program->SetProgram(mCgContext, GetPathTo("Pressure"), mCgFragmentProfile, "SubtractPressureGradientBoundary3D");
+	program->AddParam("pressure");
+	program->AddParam("velocity");
+	program->AddParam("offset");
+	program->AddParam("d");
+	program->AddParam("res");
+	program->AddParam("slabs");
+	return program;
+}
 GPUProgram *GPUProgramLoader3D::ZCull() 
 {
 	GPUProgram *program = new GPUProgram();
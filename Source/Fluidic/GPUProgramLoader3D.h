@@ -36,6 +36,9 @@ namespace Fluidic
 	public:
 		GPUProgramLoader3D(const std::string &cgHomeDir, CGcontext context, CGprofile vertexProfile, CGprofile fragmentProfile);
 		GPUProgram *Advect();
+		GPUProgram *SimpleAdvect();
+		GPUProgram *MacCormackAdvect();
+		GPUProgram *FusedAdvect();
 		GPUProgram *Vorticity();
 		GPUProgram *Inject();
 		GPUProgram *Perturb();
@@ -43,9 +46,14 @@ namespace Fluidic
 		GPUProgram *F4Boundary();
 		GPUProgram *Offset();
 		GPUProgram *F1Jacobi();
+		GPUProgram *F1JacobiBoundary();
 		GPUProgram *F4Jacobi();
+		GPUProgram *F1RedBlack();
+		GPUProgram *F1ChebyshevJacobi();
 		GPUProgram *DivField();
+		GPUProgram *DivFieldBoundary();
 		GPUProgram *SubtractPressureGradient();
+		GPUProgram *SubtractPressureGradientBoundary();
 		GPUProgram *ZCull();
 		GPUProgram *Render();
 
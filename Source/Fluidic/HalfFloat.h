@@ -0,0 +1,134 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+#if defined(__F16C__) || defined(__AVX2__)
+	#include <immintrin.h>
+	#define FLUIDIC_F16C
+#endif
+
+namespace Fluidic
+{
+	/**
+	 * \brief Converts 4 floats to halves (rounding to nearest even), in the low 64 bits of the result.
+	 *
+	 * With F16C this is one instruction. Without it's done with SSE2 integer arithmetic on the bit
+	 * patterns: normal results rebias the exponent and round the mantissa, tiny ones are rounded
+	 * by adding a magic number, and anything too big becomes infinity (NaNs stay NaNs).
+	 */
+	inline __m128i F4ToHalf(__m128 f)
+	{
+#ifdef FLUIDIC_F16C
+		return _mm_cvtps_ph(f, 0);
+#else
+		const __m128i f16Max = _mm_set1_epi32((127 + 16) << 23); //floats from here up are infinite as halves
+		const __m128i minNormal = _mm_set1_epi32((127 - 14) << 23); //the smallest float that's a normal half
+		const __m128i subnormalMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+		const __m128i normalBias = _mm_set1_epi32(0xfff - ((127 - 15) << 23)); //rebias, and round half way up
+
+		__m128 sign = _mm_and_ps(f, _mm_castsi128_ps(_mm_set1_epi32(0x80000000)));
+		__m128 absF = _mm_xor_ps(f, sign);
+		__m128i bits = _mm_castps_si128(absF);
+
+		__m128i isRegular = _mm_cmpgt_epi32(f16Max, bits);
+		__m128i nanBit = _mm_and_si128(_mm_castps_si128(_mm_cmpunord_ps(absF, absF)), _mm_set1_epi32(0x200));
+		__m128i infOrNan = _mm_or_si128(nanBit, _mm_set1_epi32(0x7c00));
+
+		//the subnormal halves
+		__m128i isSubnormal = _mm_cmpgt_epi32(minNormal, bits);
+		__m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absF, _mm_castsi128_ps(subnormalMagic))), subnormalMagic);
+
+		//the normal ones, with ties going to the even mantissa
+		__m128i oddMantissa = _mm_srai_epi32(_mm_slli_epi32(bits, 31 - 13), 31);
+		__m128i normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(bits, normalBias), oddMantissa), 13);
+
+		__m128i result = _mm_or_si128(_mm_and_si128(isSubnormal, subnormal), _mm_andnot_si128(isSubnormal, normal));
+		result = _mm_or_si128(_mm_and_si128(isRegular, result), _mm_andnot_si128(isRegular, infOrNan));
+		result = _mm_or_si128(result, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+
+		//the sign shift leaves each lane in range for a signed pack
+		return _mm_packs_epi32(result, result);
+#endif
+	}
+
+	/// Converts the 4 halves in the low 64 bits of h to floats
+	inline __m128 F4FromHalf(__m128i h)
+	{
+#ifdef FLUIDIC_F16C
+		return _mm_cvtph_ps(h);
+#else
+		h = _mm_unpacklo_epi16(h, _mm_setzero_si128());
+
+		//shift the exponent and mantissa into place, and let a multiply rebias the exponent (which
+		//also normalises the subnormals). Infinities and NaNs need their exponent filling in.
+		__m128i expMantissa = _mm_and_si128(h, _mm_set1_epi32(0x7fff));
+		__m128i sign = _mm_slli_epi32(_mm_xor_si128(h, expMantissa), 16);
+		__m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(expMantissa, 13)),
+								   _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23)));
+		__m128i wasInfNan = _mm_cmpgt_epi32(expMantissa, _mm_set1_epi32(0x7bff));
+		__m128i infNanExp = _mm_and_si128(wasInfNan, _mm_set1_epi32(255 << 23));
+		return _mm_or_ps(scaled, _mm_castsi128_ps(_mm_or_si128(sign, infNanExp)));
+#endif
+	}
+
+	/// Loads 4 halves and converts them to floats
+	inline __m128 F4LoadHalf(const unsigned short *h)
+	{
+		return F4FromHalf(_mm_loadl_epi64((const __m128i*)h));
+	}
+
+	/// Converts 4 floats to halves and stores them
+	inline void F4StoreHalf(unsigned short *h, __m128 f)
+	{
+		_mm_storel_epi64((__m128i*)h, F4ToHalf(f));
+	}
+
+	inline unsigned short FloatToHalf(float f)
+	{
+		return (unsigned short)_mm_cvtsi128_si32(F4ToHalf(_mm_set_ss(f)));
+	}
+
+	inline float HalfToFloat(unsigned short h)
+	{
+		return _mm_cvtss_f32(F4FromHalf(_mm_cvtsi32_si128(h)));
+	}
+
+	/// Converts count halves to floats
+	inline void HalfToFloats(const unsigned short *from, float *to, int count)
+	{
+		int i = 0;
+		for (; i + 4 <= count; i += 4) _mm_storeu_ps(to + i, F4LoadHalf(from + i));
+		for (; i < count; i++) to[i] = HalfToFloat(from[i]);
+	}
+
+	/// Converts count floats to halves
+	inline void FloatsToHalves(const float *from, unsigned short *to, int count)
+	{
+		int i = 0;
+		for (; i + 4 <= count; i += 4) F4StoreHalf(to + i, _mm_loadu_ps(from + i));
+		for (; i < count; i++) to[i] = FloatToHalf(from[i]);
+	}
+}
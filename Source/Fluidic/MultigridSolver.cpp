@@ -0,0 +1,243 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include "MultigridSolver.h"
+
+using namespace std;
+using namespace Fluidic;
+
+namespace
+{
+	/// Smoothing sweeps before and after visiting the coarser level
+	const int PreSweeps = 2;
+	const int PostSweeps = 2;
+
+	/// A level is the coarsest once a side (other than a depth of 1) is this small
+	const int MinLevelSize = 4;
+}
+
+MultigridSolver::MultigridSolver()
+{
+}
+
+MultigridSolver::~MultigridSolver()
+{
+	Clear();
+}
+
+void MultigridSolver::Clear()
+{
+	for (size_t i = 0; i < mLevels.size(); i++) delete mLevels[i];
+	mLevels.clear();
+}
+
+void MultigridSolver::Init(const CPUField &boundaries)
+{
+	Clear();
+
+	Level *level = new Level();
+	level->grid.Init(boundaries);
+	mLevels.push_back(level);
+
+	while (true)
+	{
+		const PoissonGrid &fine = mLevels.back()->grid;
+
+		int smallest = min(fine.Width(), fine.Height());
+		if (fine.Depth() > 1) smallest = min(smallest, fine.Depth());
+		if (smallest < MinLevelSize) break;
+
+		level = new Level();
+		level->grid.Coarsen(fine);
+		mLevels.push_back(level);
+	}
+
+	//the finest level solves straight into the caller's field, so doesn't need its own x
+	for (size_t i = 0; i < mLevels.size(); i++)
+	{
+		Level &l = *mLevels[i];
+		const int w = l.grid.Width(), h = l.grid.Height(), d = l.grid.Depth();
+
+		if (i > 0) l.x.Resize(w, h, d, 1);
+		l.b.Resize(w, h, d, 1);
+		l.r.Resize(w, h, d, 1);
+	}
+}
+
+int MultigridSolver::Solve(CPUField &x, const CPUField &div, float cellArea, int cycles, bool full, float tolerance)
+{
+	if (mLevels.empty()) return 0;
+
+	Level &finest = *mLevels[0];
+
+	//A x = dx*dy*div, and the fluid has to come out as much as goes in for there to be a solution
+	const int count = finest.b.Size();
+	#pragma omp parallel for
+	for (int i = 0; i < count; i++)
+	{
+		finest.b.Data()[i] = cellArea * div.Data()[i];
+	}
+	finest.grid.RemoveMean(finest.b);
+
+	finest.x.Swap(x);
+
+	if (full)
+	{
+		//solve on the coarsest level first, then use each solution as the guess for the next level up
+		for (size_t i = 1; i < mLevels.size(); i++)
+		{
+			Restrict(mLevels[i-1]->b, mLevels[i]->b);
+		}
+
+		mLevels.back()->x.Zero();
+		VCycle((int)mLevels.size()-1);
+
+		for (int i = (int)mLevels.size()-2; i >= 0; i--)
+		{
+			mLevels[i]->x.Zero();
+			Prolong(mLevels[i+1]->x, mLevels[i]->x, mLevels[i]->grid);
+			VCycle(i);
+		}
+	}
+
+	const double target = tolerance > 0 ? (double)tolerance * tolerance * finest.grid.Dot(finest.b, finest.b) : -1;
+
+	int i = 0;
+	while (i < cycles)
+	{
+		VCycle(0);
+		i++;
+
+		if (target >= 0)
+		{
+			finest.grid.Residual(finest.x, finest.b, finest.r);
+			if (finest.grid.Dot(finest.r, finest.r) <= target) break;
+		}
+	}
+
+	//the pressure is only known up to a constant, so keep it from drifting away from the solid cells
+	finest.grid.RemoveMean(finest.x);
+
+	finest.x.Swap(x);
+	return i;
+}
+
+void MultigridSolver::Precondition(const CPUField &r, CPUField &z)
+{
+	if (mLevels.empty()) return;
+
+	Level &finest = *mLevels[0];
+
+	//z approximately solves -A z = r
+	const int count = finest.b.Size();
+	#pragma omp parallel for
+	for (int i = 0; i < count; i++)
+	{
+		finest.b.Data()[i] = -r.Data()[i];
+	}
+
+	finest.x.Swap(z);
+	finest.x.Zero();
+	VCycle(0);
+	finest.x.Swap(z);
+}
+
+void MultigridSolver::VCycle(int level)
+{
+	Level &l = *mLevels[level];
+
+	if (level == (int)mLevels.size()-1)
+	{
+		//coarsest level - enough sweeps to carry information across it
+		l.grid.Sweep(l.x, l.b, 1.f, 2 * (l.grid.Width() + l.grid.Height() + l.grid.Depth()));
+		return;
+	}
+
+	Level &coarse = *mLevels[level+1];
+
+	l.grid.Sweep(l.x, l.b, 1.f, PreSweeps);
+
+	l.grid.Residual(l.x, l.b, l.r);
+	Restrict(l.r, coarse.b);
+
+	coarse.x.Zero();
+	VCycle(level+1);
+	Prolong(coarse.x, l.x, l.grid);
+
+	//reversed, so the cycle is symmetric and can precondition conjugate gradient
+	l.grid.Sweep(l.x, l.b, 1.f, PostSweeps, true);
+}
+
+void MultigridSolver::Restrict(const CPUField &fine, CPUField &coarse)
+{
+	const int width = coarse.Width();
+	const int height = coarse.Height();
+	const int rowCount = height * coarse.Depth();
+
+	#pragma omp parallel for
+	for (int r = 0; r < rowCount; r++)
+	{
+		const int y = r % height, z = r / height;
+
+		for (int x = 0; x < width; x++)
+		{
+			float sum = 0;
+			int cells = 0;
+
+			for (int k = 2*z; k < min(2*z+2, fine.Depth()); k++)
+			{
+				for (int j = 2*y; j < min(2*y+2, fine.Height()); j++)
+				{
+					for (int i = 2*x; i < min(2*x+2, fine.Width()); i++)
+					{
+						sum += *fine.Cell(i, j, k);
+						cells++;
+					}
+				}
+			}
+
+			//the equation is scaled by the cell area, which is 4 times bigger on the coarse level
+			*coarse.Cell(x, y, z) = 4.f * sum / cells;
+		}
+	}
+}
+
+void MultigridSolver::Prolong(const CPUField &coarse, CPUField &fine, const PoissonGrid &fineGrid)
+{
+	const int width = fine.Width();
+	const int height = fine.Height();
+	const int rowCount = height * fine.Depth();
+	const CPUField &fluid = fineGrid.Fluid();
+
+	#pragma omp parallel for
+	for (int r = 0; r < rowCount; r++)
+	{
+		const int y = r % height, z = r / height;
+		const float *c = coarse.Cell(0, y/2, z/2);
+		const float *f = fluid.Cell(0, y, z);
+		float *row = fine.Cell(0, y, z);
+
+		for (int x = 0; x < width; x++)
+		{
+			row[x] += f[x] * c[x/2];
+		}
+	}
+}
@@ -0,0 +1,97 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#pragma once
+
+#include <vector>
+
+#include "CPUField.h"
+#include "PoissonGrid.h"
+
+namespace Fluidic
+{
+	/**
+	 * \brief Geometric multigrid solver for the pressure on the CPU.
+	 *
+	 * Each level halves the resolution, down to a grid a few cells across. A V-cycle smooths with
+	 * red-black Gauss-Seidel, restricts the residual to the next level, solves for the error there and
+	 * adds it back, so a few cycles give about the same residual whatever the resolution. Solid cells
+	 * are left out of every level (see PoissonGrid).
+	 */
+	class MultigridSolver
+	{
+	public:
+		MultigridSolver();
+		~MultigridSolver();
+
+		/// Builds the levels for a boundary field. Needs calling again when the boundaries change.
+		void Init(const CPUField &boundaries);
+
+		/**
+		 * \brief Solves for the pressure, the same equation as the pressure jacobi iterations.
+		 *
+		 * @param x the pressure; its current value is the starting guess for the V-cycles
+		 * @param div the divergence of the velocity
+		 * @param cellArea dx*dy of a solver cell
+		 * @param cycles most V-cycles to run
+		 * @param full start with a full multigrid cycle, which ignores the starting guess
+		 * @param tolerance stop once the residual is this fraction of the right hand side (0 never stops early)
+		 * @return the number of V-cycles used
+		 */
+		int Solve(CPUField &x, const CPUField &div, float cellArea, int cycles, bool full, float tolerance);
+
+		/**
+		 * \brief One V-cycle from zero, as a preconditioner for ConjugateGradientSolver.
+		 *
+		 * @param r residual of the (positive definite) equation -A z = r, see PoissonGrid
+		 * @param z approximate solution
+		 */
+		void Precondition(const CPUField &r, CPUField &z);
+
+		/// True once Init has been called
+		bool IsReady() const { return !mLevels.empty(); }
+
+	private:
+		MultigridSolver(const MultigridSolver &);
+		MultigridSolver &operator=(const MultigridSolver &);
+
+		/// A grid in the hierarchy, with its solution, right hand side and residual
+		struct Level
+		{
+			PoissonGrid grid;
+			CPUField x;
+			CPUField b;
+			CPUField r;
+		};
+
+		void Clear();
+
+		void VCycle(int level);
+
+		/// coarse = the sum of the fine cells under each coarse cell, scaled for the coarse cell area
+		void Restrict(const CPUField &fine, CPUField &coarse);
+
+		/// fine += coarse, for the fluid cells under each coarse cell
+		void Prolong(const CPUField &coarse, CPUField &fine, const PoissonGrid &fineGrid);
+
+		std::vector<Level*> mLevels;
+	};
+}
@@ -0,0 +1,247 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include "PoissonGrid.h"
+
+using namespace std;
+using namespace Fluidic;
+
+namespace
+{
+	/// Sum of the fluid neighbours of cell i, given the row, its mask and the rows around it
+	inline float NeighbourSum(const float *x, const float *f, const float **rows, const float **masks, int i, int width)
+	{
+		float sum = masks[0][i]*rows[0][i] + masks[1][i]*rows[1][i] + masks[2][i]*rows[2][i] + masks[3][i]*rows[3][i];
+		if (i > 0) sum += f[i-1]*x[i-1];
+		if (i < width-1) sum += f[i+1]*x[i+1];
+		return sum;
+	}
+}
+
+void PoissonGrid::Resize(int width, int height, int depth)
+{
+	mFluid.Resize(width, height, depth, 1);
+	mCount.Resize(width, height, depth, 1);
+	mInvCount.Resize(width, height, depth, 1);
+	mSolidRow.assign(width, 0.f);
+}
+
+void PoissonGrid::Init(const CPUField &boundaries)
+{
+	Resize(boundaries.Width(), boundaries.Height(), boundaries.Depth());
+
+	const int count = mFluid.Size();
+	for (int i = 0; i < count; i++)
+	{
+		mFluid.Data()[i] = boundaries.Data()[i] == 0 ? 1.f : 0.f;
+	}
+
+	UpdateCounts();
+}
+
+void PoissonGrid::Coarsen(const PoissonGrid &fine)
+{
+	Resize((fine.Width()+1)/2, (fine.Height()+1)/2, (fine.Depth()+1)/2);
+
+	for (int z = 0; z < fine.Depth(); z++)
+	{
+		for (int y = 0; y < fine.Height(); y++)
+		{
+			for (int x = 0; x < fine.Width(); x++)
+			{
+				if (*fine.mFluid.Cell(x, y, z) != 0) *mFluid.Cell(x/2, y/2, z/2) = 1;
+			}
+		}
+	}
+
+	UpdateCounts();
+}
+
+void PoissonGrid::UpdateCounts()
+{
+	const int width = Width();
+	const int height = Height();
+	const int depth = Depth();
+
+	for (int z = 0; z < depth; z++)
+	{
+		for (int y = 0; y < height; y++)
+		{
+			const float *rows[4], *masks[4];
+			NeighbourRows(mFluid, y, z, rows, masks);
+			const float *f = mFluid.Cell(0, y, z);
+			float *count = mCount.Cell(0, y, z);
+			float *invCount = mInvCount.Cell(0, y, z);
+
+			for (int x = 0; x < width; x++)
+			{
+				count[x] = f[x] * NeighbourSum(f, f, rows, masks, x, width);
+				invCount[x] = count[x] > 0 ? 1.f / count[x] : 0.f;
+			}
+		}
+	}
+}
+
+void PoissonGrid::NeighbourRows(const CPUField &field, int y, int z, const float **rows, const float **masks) const
+{
+	const float *solid = &mSolidRow[0];
+	const float *row = field.Cell(0, y, z);
+
+	rows[0] = y < Height()-1 ? field.Cell(0, y+1, z) : row;
+	masks[0] = y < Height()-1 ? mFluid.Cell(0, y+1, z) : solid;
+	rows[1] = y > 0 ? field.Cell(0, y-1, z) : row;
+	masks[1] = y > 0 ? mFluid.Cell(0, y-1, z) : solid;
+	rows[2] = z < Depth()-1 ? field.Cell(0, y, z+1) : row;
+	masks[2] = z < Depth()-1 ? mFluid.Cell(0, y, z+1) : solid;
+	rows[3] = z > 0 ? field.Cell(0, y, z-1) : row;
+	masks[3] = z > 0 ? mFluid.Cell(0, y, z-1) : solid;
+}
+
+void PoissonGrid::Apply(const CPUField &x, CPUField &out) const
+{
+	const int width = Width();
+	const int height = Height();
+	const int rowCount = height * Depth();
+
+	#pragma omp parallel for
+	for (int r = 0; r < rowCount; r++)
+	{
+		const int y = r % height, z = r / height;
+		const float *rows[4], *masks[4];
+		NeighbourRows(x, y, z, rows, masks);
+
+		const float *row = x.Cell(0, y, z);
+		const float *f = mFluid.Cell(0, y, z);
+		const float *count = mCount.Cell(0, y, z);
+		float *o = out.Cell(0, y, z);
+
+		for (int i = 0; i < width; i++)
+		{
+			o[i] = f[i] * NeighbourSum(row, f, rows, masks, i, width) - count[i] * row[i];
+		}
+	}
+}
+
+void PoissonGrid::Residual(const CPUField &x, const CPUField &b, CPUField &r) const
+{
+	const int width = Width();
+	const int height = Height();
+	const int rowCount = height * Depth();
+
+	#pragma omp parallel for
+	for (int j = 0; j < rowCount; j++)
+	{
+		const int y = j % height, z = j / height;
+		const float *rows[4], *masks[4];
+		NeighbourRows(x, y, z, rows, masks);
+
+		const float *row = x.Cell(0, y, z);
+		const float *rowB = b.Cell(0, y, z);
+		const float *f = mFluid.Cell(0, y, z);
+		const float *count = mCount.Cell(0, y, z);
+		float *res = r.Cell(0, y, z);
+
+		for (int i = 0; i < width; i++)
+		{
+			res[i] = f[i] * (rowB[i] - NeighbourSum(row, f, rows, masks, i, width)) + count[i] * row[i];
+		}
+	}
+}
+
+void PoissonGrid::Sweep(CPUField &x, const CPUField &b, float omega, int sweeps, bool reverse) const
+{
+	const int width = Width();
+	const int height = Height();
+	const int rowCount = height * Depth();
+
+	for (int s = 0; s < sweeps; s++)
+	{
+		//red cells then black cells, each only depends on the other colour
+		for (int pass = 0; pass < 2; pass++)
+		{
+			const int colour = reverse ? 1 - pass : pass;
+
+			#pragma omp parallel for
+			for (int r = 0; r < rowCount; r++)
+			{
+				const int y = r % height, z = r / height;
+				const float *rows[4], *masks[4];
+				NeighbourRows(x, y, z, rows, masks);
+
+				float *row = x.Cell(0, y, z);
+				const float *rowB = b.Cell(0, y, z);
+				const float *f = mFluid.Cell(0, y, z);
+				const float *invCount = mInvCount.Cell(0, y, z);
+
+				for (int i = (colour + y + z) & 1; i < width; i += 2)
+				{
+					if (invCount[i] == 0) continue;
+
+					float next = (NeighbourSum(row, f, rows, masks, i, width) - rowB[i]) * invCount[i];
+					row[i] += omega * (next - row[i]);
+				}
+			}
+		}
+	}
+}
+
+void PoissonGrid::RemoveMean(CPUField &b) const
+{
+	const int count = mFluid.Size();
+	const float *f = mFluid.Data();
+	float *data = b.Data();
+
+	double sum = 0, cells = 0;
+
+	#pragma omp parallel for reduction(+:sum,cells)
+	for (int i = 0; i < count; i++)
+	{
+		sum += f[i] * data[i];
+		cells += f[i];
+	}
+
+	if (cells == 0) return;
+	const float mean = (float)(sum / cells);
+
+	#pragma omp parallel for
+	for (int i = 0; i < count; i++)
+	{
+		data[i] = f[i] * (data[i] - mean);
+	}
+}
+
+double PoissonGrid::Dot(const CPUField &a, const CPUField &b) const
+{
+	const int count = mFluid.Size();
+	const float *f = mFluid.Data();
+	const float *dataA = a.Data();
+	const float *dataB = b.Data();
+
+	double sum = 0;
+
+	#pragma omp parallel for reduction(+:sum)
+	for (int i = 0; i < count; i++)
+	{
+		sum += f[i] * dataA[i] * dataB[i];
+	}
+
+	return sum;
+}
@@ -0,0 +1,98 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#pragma once
+
+#include <vector>
+
+#include "CPUField.h"
+
+namespace Fluidic
+{
+	/**
+	 * \brief The pressure equation on a CPU grid, with the solid cells left out.
+	 *
+	 * A x = sum over the fluid neighbours n of (x[n] - x), which is the 5 point (7 point in 3d)
+	 * laplacian multiplied by the cell area. Solid cells and cells outside the grid drop out of the
+	 * stencil, giving the same zero gradient at walls and obstacles as BoundaryPressureStep. Fields
+	 * passed in are 1 component with the grid's dimensions; 2d grids have a depth of 1.
+	 */
+	class PoissonGrid
+	{
+	public:
+		PoissonGrid() {}
+
+		/// Sets up the grid from a boundary field - cells with a boundary value of 0 are fluid
+		void Init(const CPUField &boundaries);
+
+		/// Sets up the grid as the next coarser level of a multigrid: half the resolution, and a cell
+		/// is fluid if any of the 2x2(x2) fine cells it covers are.
+		void Coarsen(const PoissonGrid &fine);
+
+		/// out = A x
+		void Apply(const CPUField &x, CPUField &out) const;
+
+		/// r = b - A x (0 in solid cells)
+		void Residual(const CPUField &x, const CPUField &b, CPUField &r) const;
+
+		/**
+		 * \brief Red-black Gauss-Seidel sweeps, updating x in place.
+		 *
+		 * @param omega over-relaxation factor: 1 is Gauss-Seidel, between 1 and 2 is SOR
+		 * @param reverse update the black cells first. A sweep followed by a reversed sweep is symmetric.
+		 */
+		void Sweep(CPUField &x, const CPUField &b, float omega, int sweeps, bool reverse=false) const;
+
+		/// Removes the mean over the fluid cells, so A x = b has a solution when b is the right hand side
+		void RemoveMean(CPUField &b) const;
+
+		/// Dot product over the fluid cells
+		double Dot(const CPUField &a, const CPUField &b) const;
+
+		inline int Width() const { return mFluid.Width(); }
+		inline int Height() const { return mFluid.Height(); }
+		inline int Depth() const { return mFluid.Depth(); }
+
+		/// 1 for fluid cells, 0 for solid cells
+		inline const CPUField &Fluid() const { return mFluid; }
+
+		/// Number of fluid neighbours of each cell - the diagonal of -A
+		inline const CPUField &Count() const { return mCount; }
+
+	private:
+		PoissonGrid(const PoissonGrid &);
+		PoissonGrid &operator=(const PoissonGrid &);
+
+		void Resize(int width, int height, int depth);
+		void UpdateCounts();
+
+		/**
+		 * Gets the rows above/below (y) and in front/behind (z) of a row of a field, and their fluid
+		 * masks. Rows outside the grid get a mask of 0s, so they drop out of the stencil.
+		 */
+		void NeighbourRows(const CPUField &field, int y, int z, const float **rows, const float **masks) const;
+
+		CPUField mFluid;
+		CPUField mCount; ///< number of fluid neighbours (0 for solid cells)
+		CPUField mInvCount; ///< 1/mCount, or 0
+		std::vector<float> mSolidRow;
+	};
+}
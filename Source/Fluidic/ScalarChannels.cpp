@@ -0,0 +1,76 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include "ScalarChannels.h"
+
+using namespace std;
+using namespace Fluidic;
+
+ScalarChannels::~ScalarChannels()
+{
+	for (size_t i = 0; i < mChannels.size(); i++)
+	{
+		delete mChannels[i];
+	}
+}
+
+int ScalarChannels::Add(float diffusion, float density)
+{
+	ScalarChannel *channel = new ScalarChannel();
+	channel->diffusion = diffusion;
+	channel->density = density;
+	if (mWidth > 0)
+	{
+		channel->field.Resize(mWidth, mHeight, mDepth, 1);
+		channel->output.Resize(mWidth, mHeight, mDepth, 1);
+	}
+
+	mChannels.push_back(channel);
+	return (int)mChannels.size() - 1;
+}
+
+void ScalarChannels::Resize(int width, int height, int depth)
+{
+	mWidth = width;
+	mHeight = height;
+	mDepth = depth;
+
+	for (size_t i = 0; i < mChannels.size(); i++)
+	{
+		mChannels[i]->field.Resize(width, height, depth, 1);
+		mChannels[i]->output.Resize(width, height, depth, 1);
+	}
+	mSource.Resize(width, height, depth, 1);
+	mInjections.clear();
+}
+
+void ScalarChannels::Inject(int channel, const Vector &position, float amount, float size, bool overwrite)
+{
+	if (channel < 0 || channel >= Count()) return;
+
+	Injection injection;
+	injection.channel = channel;
+	injection.position = position;
+	injection.amount = amount;
+	injection.size = size;
+	injection.overwrite = overwrite;
+	mInjections.push_back(injection);
+}
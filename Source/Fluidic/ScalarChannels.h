@@ -0,0 +1,101 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#pragma once
+
+#include <list>
+#include <vector>
+
+#include "CPUField.h"
+#include "Vector.h"
+
+namespace Fluidic
+{
+	/// One extra scalar carried by a CPU fluid
+	struct ScalarChannel
+	{
+		CPUField field; ///< the value, 1 component per cell at the solver resolution
+		CPUField output; ///< the other buffer for the advection and diffusion passes
+		float diffusion; ///< viscosity of the channel, 0 for none
+		float density; ///< how strongly the channel pushes the fluid up, as SetColorDensities
+	};
+
+	/**
+	 * \brief The scalars a CPU fluid carries alongside its ink: temperature, fuel, tags and so on.
+	 *
+	 * Each channel has its own 1 component field (structure of arrays), so any number can be added
+	 * and each is contiguous for its own diffusion. The fluids advect every channel in one pass,
+	 * tracing each cell back once and interpolating all the channels from the same corners.
+	 */
+	class ScalarChannels
+	{
+	public:
+		/// A queued Inject into one channel
+		struct Injection
+		{
+			int channel;
+			Vector position;
+			float amount;
+			float size;
+			bool overwrite;
+		};
+		typedef std::list<Injection> InjectionList;
+
+		ScalarChannels() : mWidth(0), mHeight(0), mDepth(0) {}
+		~ScalarChannels();
+
+		/**
+		 * \brief Adds a channel, sized like the others and set to 0
+		 *
+		 * @param diffusion the channel's viscosity, 0 for none
+		 * @param density how strongly the channel pushes the fluid up
+		 * @return the index of the new channel
+		 */
+		int Add(float diffusion, float density);
+
+		/// Resizes every channel (and any added later), setting them to 0
+		void Resize(int width, int height, int depth);
+
+		int Count() const { return (int)mChannels.size(); }
+
+		ScalarChannel &operator[](int channel) { return *mChannels[channel]; }
+		const ScalarChannel &operator[](int channel) const { return *mChannels[channel]; }
+
+		/// Queues an injection, for the fluid to apply in its next step
+		void Inject(int channel, const Vector &position, float amount, float size, bool overwrite);
+
+		/// Injections queued since the last ClearInjections
+		const InjectionList &Injections() const { return mInjections; }
+		void ClearInjections() { mInjections.clear(); }
+
+		/// A 1 component field sized like the channels, for the right hand side of the diffusion
+		CPUField &Source() { return mSource; }
+
+	private:
+		ScalarChannels(const ScalarChannels &);
+		ScalarChannels &operator=(const ScalarChannels &);
+
+		std::vector<ScalarChannel*> mChannels;
+		InjectionList mInjections;
+		CPUField mSource;
+		int mWidth, mHeight, mDepth;
+	};
+}
@@ -0,0 +1,128 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include <math.h>
+
+#include "SpectralSolver.h"
+
+using namespace std;
+using namespace Fluidic;
+
+namespace
+{
+	const double Pi = 3.14159265358979323846;
+}
+
+void SpectralSolver::Init(int width, int height, int depth)
+{
+	mWidth = width;
+	mHeight = height;
+	mDepth = depth;
+
+	const int sizes[3] = { width, height, depth };
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const int n = sizes[axis];
+		mTransforms[axis].Init(n);
+
+		//x[i-1] - 2x[i] + x[i+1] with the end cells repeated, for the k'th cosine
+		mEigenvalues[axis].resize(n);
+		for (int k = 0; k < n; k++)
+		{
+			mEigenvalues[axis][k] = 2 * cos(Pi * k / n) - 2;
+		}
+	}
+
+	mCoefficients.assign(width * height * depth, 0.0);
+}
+
+void SpectralSolver::Solve(CPUField &x, const CPUField &div, float cellArea)
+{
+	if (!IsReady()) return;
+
+	const int count = (int)mCoefficients.size();
+	const int width = mWidth;
+	const int height = mHeight;
+
+	#pragma omp parallel for
+	for (int i = 0; i < count; i++)
+	{
+		mCoefficients[i] = cellArea * div.Data()[i];
+	}
+
+	for (int axis = 0; axis < 3; axis++) Transform(axis, false);
+
+	//divide by the eigenvalue of each cosine. The constant term is left at 0, as the pressure is
+	//only known up to a constant.
+	#pragma omp parallel for
+	for (int i = 0; i < count; i++)
+	{
+		const int ix = i % width;
+		const int iy = (i / width) % height;
+		const int iz = i / (width * height);
+		const double lambda = mEigenvalues[0][ix] + mEigenvalues[1][iy] + mEigenvalues[2][iz];
+
+		mCoefficients[i] = lambda != 0 ? mCoefficients[i] / lambda : 0.0;
+	}
+
+	for (int axis = 0; axis < 3; axis++) Transform(axis, true);
+
+	#pragma omp parallel for
+	for (int i = 0; i < count; i++)
+	{
+		x.Data()[i] = (float)mCoefficients[i];
+	}
+}
+
+void SpectralSolver::Transform(int axis, bool inverse)
+{
+	const int sizes[3] = { mWidth, mHeight, mDepth };
+	const int strides[3] = { 1, mWidth, mWidth * mHeight };
+
+	const int n = sizes[axis];
+	if (n == 1) return;
+
+	const int stride = strides[axis];
+	const int lines = (int)mCoefficients.size() / n;
+	const CosineTransform &transform = mTransforms[axis];
+
+	#pragma omp parallel
+	{
+		CosineTransform::Scratch scratch;
+		vector<double> line(n);
+
+		#pragma omp for
+		for (int l = 0; l < lines; l++)
+		{
+			//the start of line l: lines are indexed by the cells of the grid with this axis removed
+			const int below = l % stride;
+			const int start = below + (l / stride) * stride * n;
+			double *data = &mCoefficients[start];
+
+			for (int i = 0; i < n; i++) line[i] = data[i * stride];
+
+			if (inverse) transform.Inverse(&line[0], scratch);
+			else transform.Forward(&line[0], scratch);
+
+			for (int i = 0; i < n; i++) data[i * stride] = line[i];
+		}
+	}
+}
@@ -0,0 +1,71 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#pragma once
+
+#include <vector>
+
+#include "CPUField.h"
+#include "FFT.h"
+
+namespace Fluidic
+{
+	/**
+	 * \brief Direct pressure solver for fluids with no obstacles, using cosine transforms.
+	 *
+	 * With only the walls at the edges of the grid, the pressure equation (see PoissonGrid) is
+	 * diagonal in the cosine basis, so the exact solution is a transform along each axis, a divide
+	 * and the transforms back - O(N log N), with no iterations. The lines along each axis are
+	 * transformed in parallel.
+	 */
+	class SpectralSolver
+	{
+	public:
+		SpectralSolver() {}
+
+		/// Sets up the transforms for a grid size. 2d grids have a depth of 1.
+		void Init(int width, int height, int depth);
+
+		/**
+		 * \brief Solves for the pressure, the same equation as the pressure jacobi iterations.
+		 *
+		 * @param x the pressure
+		 * @param div the divergence of the velocity
+		 * @param cellArea dx*dy of a solver cell
+		 */
+		void Solve(CPUField &x, const CPUField &div, float cellArea);
+
+		/// True once Init has been called
+		bool IsReady() const { return !mCoefficients.empty(); }
+
+	private:
+		SpectralSolver(const SpectralSolver &);
+		SpectralSolver &operator=(const SpectralSolver &);
+
+		/// Transforms every line of mCoefficients along an axis (0 x, 1 y, 2 z)
+		void Transform(int axis, bool inverse);
+
+		int mWidth, mHeight, mDepth;
+		CosineTransform mTransforms[3];
+		std::vector<double> mEigenvalues[3]; ///< of the 1d second difference, per axis
+		std::vector<double> mCoefficients;
+	};
+}
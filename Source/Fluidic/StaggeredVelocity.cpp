@@ -0,0 +1,282 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#include "StaggeredVelocity.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+using namespace std;
+using namespace Fluidic;
+
+namespace
+{
+	/// Trilinear interpolation of a 1 component field at (x, y, z), where cell (i, j, k) is at (i, j, k). Clamped to the edge.
+	float F1Lerp(const CPUField &field, float x, float y, float z)
+	{
+		const float fx = floorf(x), fy = floorf(y), fz = floorf(z);
+		const float tx = x - fx, ty = y - fy, tz = z - fz;
+
+		const int x0 = CPUField::Clamp((int)fx, field.Width()), x1 = CPUField::Clamp((int)fx + 1, field.Width());
+		const int y0 = CPUField::Clamp((int)fy, field.Height()), y1 = CPUField::Clamp((int)fy + 1, field.Height());
+		const int z0 = CPUField::Clamp((int)fz, field.Depth()), z1 = CPUField::Clamp((int)fz + 1, field.Depth());
+
+		float c00 = *field.Cell(x0, y0, z0) + (*field.Cell(x1, y0, z0) - *field.Cell(x0, y0, z0)) * tx;
+		float c10 = *field.Cell(x0, y1, z0) + (*field.Cell(x1, y1, z0) - *field.Cell(x0, y1, z0)) * tx;
+		float c01 = *field.Cell(x0, y0, z1) + (*field.Cell(x1, y0, z1) - *field.Cell(x0, y0, z1)) * tx;
+		float c11 = *field.Cell(x0, y1, z1) + (*field.Cell(x1, y1, z1) - *field.Cell(x0, y1, z1)) * tx;
+
+		float c0 = c00 + (c10 - c00) * ty;
+		float c1 = c01 + (c11 - c01) * ty;
+		return c0 + (c1 - c0) * tz;
+	}
+}
+
+void StaggeredVelocity::Resize(int width, int height, int depth)
+{
+	mWidth = width;
+	mHeight = height;
+	mDepth = depth;
+
+	for (int a = 0; a < Axes(); a++)
+	{
+		mFaces[a].Resize(width + (a == 0), height + (a == 1), depth + (a == 2), 1);
+		mOutputs[a].Resize(width + (a == 0), height + (a == 1), depth + (a == 2), 1);
+	}
+	mCentred.Resize(width, height, depth, 4);
+}
+
+CPUField &StaggeredVelocity::Source(int axis)
+{
+	const CPUField &face = mFaces[axis];
+	CPUField &source = mSources[axis];
+	if (source.Width() != face.Width() || source.Height() != face.Height() || source.Depth() != face.Depth())
+	{
+		source.Resize(face.Width(), face.Height(), face.Depth(), 1);
+	}
+	return source;
+}
+
+void StaggeredVelocity::Stagger(const CPUField &velocity)
+{
+	if (!mCentred.SameShape(velocity)) mCentred.ResizeLike(velocity);
+	const int pitch = velocity.ComponentPitch();
+
+	for (int a = 0; a < Axes(); a++)
+	{
+		CPUField &face = mFaces[a];
+		const int width = face.Width();
+		const int height = face.Height();
+		const int rows = height * face.Depth();
+
+		#pragma omp parallel for
+		for (int r = 0; r < rows; r++)
+		{
+			const int y = r % height, z = r / height;
+			float *row = face.Cell(0, y, z);
+
+			//the cells either side of the face, clamped at the edges
+			const int y0 = CPUField::Clamp(y - (a == 1), mHeight), y1 = CPUField::Clamp(y, mHeight);
+			const int z0 = CPUField::Clamp(z - (a == 2), mDepth), z1 = CPUField::Clamp(z, mDepth);
+
+			for (int x = 0; x < width; x++)
+			{
+				const int x0 = CPUField::Clamp(x - (a == 0), mWidth), x1 = CPUField::Clamp(x, mWidth);
+
+				float added = velocity.Cell(x0, y0, z0)[a*pitch] - mCentred.Cell(x0, y0, z0)[a*pitch] +
+					velocity.Cell(x1, y1, z1)[a*pitch] - mCentred.Cell(x1, y1, z1)[a*pitch];
+				row[x] += 0.5f * added;
+			}
+		}
+	}
+}
+
+void StaggeredVelocity::Centre(CPUField &velocity)
+{
+	const int rows = mHeight * mDepth;
+	const int pitch = velocity.ComponentPitch();
+
+	#pragma omp parallel for
+	for (int r = 0; r < rows; r++)
+	{
+		const int y = r % mHeight, z = r / mHeight;
+		for (int x = 0; x < mWidth; x++)
+		{
+			float *vel = velocity.Cell(x, y, z);
+			vel[0] = 0.5f * (*mFaces[0].Cell(x, y, z) + *mFaces[0].Cell(x+1, y, z));
+			vel[pitch] = 0.5f * (*mFaces[1].Cell(x, y, z) + *mFaces[1].Cell(x, y+1, z));
+			if (Axes() == 3) vel[2*pitch] = 0.5f * (*mFaces[2].Cell(x, y, z) + *mFaces[2].Cell(x, y, z+1));
+		}
+	}
+
+	mCentred.CopyFrom(velocity);
+}
+
+float StaggeredVelocity::Sample(int axis, float x, float y, float z) const
+{
+	//the faces across an axis are half a cell back along it from the cell centres
+	return F1Lerp(mFaces[axis], x - 0.5f * (axis != 0), y - 0.5f * (axis != 1), z - 0.5f * (axis != 2));
+}
+
+void StaggeredVelocity::Advect(const CPUField &boundaries, const float alpha[3])
+{
+	const int axes = Axes();
+
+	for (int a = 0; a < axes; a++)
+	{
+		const CPUField &face = mFaces[a];
+		CPUField &output = mOutputs[a];
+		const int width = face.Width();
+		const int height = face.Height();
+		const int rows = height * face.Depth();
+
+		#pragma omp parallel for
+		for (int r = 0; r < rows; r++)
+		{
+			const int y = r % height, z = r / height;
+			const float *row = face.Cell(0, y, z);
+			float *out = output.Cell(0, y, z);
+
+			for (int x = 0; x < width; x++)
+			{
+				float p[3] = { x + 0.5f, y + 0.5f, z + 0.5f };
+				p[a] -= 0.5f;
+
+				//step back along the velocity at the face, then correct by the velocity there (as Advect2D)
+				float back[3] = { p[0], p[1], axes == 3 ? p[2] : 0.5f };
+				for (int b = 0; b < axes; b++)
+				{
+					back[b] -= alpha[b] * (b == a ? row[x] : Sample(b, p[0], p[1], p[2]));
+				}
+
+				if (*boundaries.ClampedCell((int)floorf(back[0]), (int)floorf(back[1]), (int)floorf(back[2])) > 0)
+				{
+					out[x] = row[x];
+					continue;
+				}
+
+				float next[3];
+				for (int b = 0; b < axes; b++) next[b] = Sample(b, back[0], back[1], back[2]);
+				for (int b = 0; b < axes; b++) back[b] -= 0.5f * alpha[b] * next[b];
+
+				out[x] = Sample(a, back[0], back[1], back[2]);
+			}
+		}
+	}
+
+	for (int a = 0; a < axes; a++) mFaces[a].Swap(mOutputs[a]);
+}
+
+void StaggeredVelocity::Divergence(CPUField &divergence, const float invDelta[3]) const
+{
+	const int rows = mHeight * mDepth;
+	const bool deep = Axes() == 3;
+
+	#pragma omp parallel for
+	for (int r = 0; r < rows; r++)
+	{
+		const int y = r % mHeight, z = r / mHeight;
+		const float *u = mFaces[0].Cell(0, y, z);
+		const float *v = mFaces[1].Cell(0, y, z);
+		const float *vUp = mFaces[1].Cell(0, y+1, z);
+		const float *w = deep ? mFaces[2].Cell(0, y, z) : 0;
+		const float *wFront = deep ? mFaces[2].Cell(0, y, z+1) : 0;
+		float *out = divergence.Cell(0, y, z);
+
+		for (int x = 0; x < mWidth; x++)
+		{
+			float div = (u[x+1] - u[x]) * invDelta[0] + (vUp[x] - v[x]) * invDelta[1];
+			if (deep) div += (wFront[x] - w[x]) * invDelta[2];
+			out[x] = div;
+		}
+	}
+}
+
+void StaggeredVelocity::SubtractGradient(const CPUField &pressure, const float invDelta[3])
+{
+	for (int a = 0; a < Axes(); a++)
+	{
+		CPUField &face = mFaces[a];
+		const int width = face.Width();
+		const int height = face.Height();
+		const int depth = face.Depth();
+		const int rows = height * depth;
+
+		#pragma omp parallel for
+		for (int r = 0; r < rows; r++)
+		{
+			const int y = r % height, z = r / height;
+
+			//the outside faces are left to SetBoundaries
+			if ((a == 1 && (y == 0 || y == height-1)) || (a == 2 && (z == 0 || z == depth-1))) continue;
+
+			float *row = face.Cell(0, y, z);
+			const float *p = pressure.Cell(0, y, z);
+			const float *before = pressure.Cell(0, y - (a == 1), z - (a == 2));
+
+			if (a == 0)
+			{
+				for (int x = 1; x < width-1; x++) row[x] -= (p[x] - p[x-1]) * invDelta[0];
+			}
+			else
+			{
+				for (int x = 0; x < width; x++) row[x] -= (p[x] - before[x]) * invDelta[a];
+			}
+		}
+	}
+}
+
+void StaggeredVelocity::SetBoundaries(const CPUField &boundaries, bool obstacles)
+{
+	for (int a = 0; a < Axes(); a++)
+	{
+		CPUField &face = mFaces[a];
+		const int width = face.Width();
+		const int height = face.Height();
+		const int depth = face.Depth();
+		const int rows = height * depth;
+
+		#pragma omp parallel for
+		for (int r = 0; r < rows; r++)
+		{
+			const int y = r % height, z = r / height;
+			float *row = face.Cell(0, y, z);
+
+			if ((a == 1 && (y == 0 || y == height-1)) || (a == 2 && (z == 0 || z == depth-1)))
+			{
+				memset(row, 0, sizeof(float) * width);
+				continue;
+			}
+			if (a == 0) row[0] = row[width-1] = 0;
+			if (!obstacles) continue;
+
+			//scaled by the more solid of the cells either side
+			const int y0 = CPUField::Clamp(y - (a == 1), mHeight), y1 = CPUField::Clamp(y, mHeight);
+			const int z0 = CPUField::Clamp(z - (a == 2), mDepth), z1 = CPUField::Clamp(z, mDepth);
+			for (int x = 0; x < width; x++)
+			{
+				const int x0 = CPUField::Clamp(x - (a == 0), mWidth), x1 = CPUField::Clamp(x, mWidth);
+				row[x] *= 1 - max(*boundaries.Cell(x0, y0, z0), *boundaries.Cell(x1, y1, z1));
+			}
+		}
+	}
+}
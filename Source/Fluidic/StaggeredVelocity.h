@@ -0,0 +1,101 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#pragma once
+
+#include "CPUField.h"
+
+namespace Fluidic
+{
+	/**
+	 * \brief The velocity of a CPU fluid kept on the cell faces - a staggered (MAC) grid.
+	 *
+	 * Each component is its own 1 component field, one face longer along its own axis than the grid
+	 * is: the x velocity of face (i, j, k) sits on the face between cells i-1 and i. The divergence
+	 * of a cell and the pressure gradient across a face are then differences of direct neighbours,
+	 * which is the 5 point (7 in 3d) laplacian the pressure solvers use, so the projection leaves no
+	 * checkerboard modes behind.
+	 *
+	 * The fluid's other steps still push the cell velocity. Stagger moves only what they've added
+	 * since the last Centre onto the faces, so the faces aren't smoothed by averaging them back and
+	 * forth every step. 2d fluids have a depth of 1 and no z faces.
+	 */
+	class StaggeredVelocity
+	{
+	public:
+		StaggeredVelocity() : mWidth(0), mHeight(0), mDepth(0) {}
+
+		/// Resizes the faces for a grid of cells, setting them to 0
+		void Resize(int width, int height, int depth);
+
+		/// 2 or 3
+		int Axes() const { return mDepth > 1 ? 3 : 2; }
+
+		/// The faces across an axis, with the velocity component along it
+		CPUField &Face(int axis) { return mFaces[axis]; }
+		const CPUField &Face(int axis) const { return mFaces[axis]; }
+		/// The other buffer for passes over Face(axis)
+		CPUField &Output(int axis) { return mOutputs[axis]; }
+		/// A field sized like Face(axis), for the right hand side of the diffusion
+		CPUField &Source(int axis);
+
+		/// Adds what has been added to the cell velocity since the last Centre onto the faces
+		void Stagger(const CPUField &velocity);
+
+		/// Sets the cell velocity to the average of the faces either side of each cell
+		void Centre(CPUField &velocity);
+
+		/**
+		 * \brief Semi-lagrangian advection of the faces, as Advect2D/3D but tracing from the faces.
+		 *
+		 * Each component is interpolated on its own staggered grid. Faces traced back into a solid
+		 * cell keep their value, as the cells do in Advect2D.
+		 * @param alpha the time step over the cell size in each axis
+		 */
+		void Advect(const CPUField &boundaries, const float alpha[3]);
+
+		/// The divergence of each cell, from the faces around it
+		void Divergence(CPUField &divergence, const float invDelta[3]) const;
+
+		/// Subtracts the pressure gradient across each inside face
+		void SubtractGradient(const CPUField &pressure, const float invDelta[3]);
+
+		/**
+		 * \brief Nothing flows through the edges of the grid, and faces of solid cells are scaled down
+		 * by the boundary value, as F4Boundary does for the cells.
+		 * @param obstacles whether there are any solid cells (the edges alone only touch the outside faces)
+		 */
+		void SetBoundaries(const CPUField &boundaries, bool obstacles);
+
+		/// The velocity component along axis at a position in cells (cell centres at +0.5)
+		float Sample(int axis, float x, float y, float z) const;
+
+	private:
+		StaggeredVelocity(const StaggeredVelocity &);
+		StaggeredVelocity &operator=(const StaggeredVelocity &);
+
+		CPUField mFaces[3];
+		CPUField mOutputs[3];
+		CPUField mSources[3];
+		CPUField mCentred; ///< the cell velocity Centre last gave
+		int mWidth, mHeight, mDepth;
+	};
+}
@@ -0,0 +1,155 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "TileMask.h"
+
+#include <math.h>
+
+using namespace std;
+using namespace Fluidic;
+
+TileMask::TileMask() :
+mWidth(0), mHeight(0), mDepth(0), mTilesX(0), mTilesY(0), mTilesZ(0), mShift(4), mActiveTiles(0), mEnabled(false)
+{
+}
+
+void TileMask::Resize(int width, int height, int depth)
+{
+	mWidth = width;
+	mHeight = height;
+	mDepth = depth;
+	mShift = depth > 1 ? 3 : 4;
+
+	const int size = 1 << mShift;
+	mTilesX = (width + size - 1) / size;
+	mTilesY = (height + size - 1) / size;
+	mTilesZ = (depth + size - 1) / size;
+
+	mTiles.assign(TileCount(), 1);
+	mMarked.assign(TileCount(), 0);
+	mEnabled = false;
+}
+
+void TileMask::Disable()
+{
+	mEnabled = false;
+}
+
+void TileMask::Begin()
+{
+	mMarked.assign(TileCount(), 0);
+}
+
+void TileMask::Mark(const CPUField &field, float threshold)
+{
+	const int count = TileCount();
+	const int cellFloats = field.CellPitch();
+	const float scaleX = (float)field.Width() / mWidth;
+	const float scaleY = (float)field.Height() / mHeight;
+	const float scaleZ = (float)field.Depth() / mDepth;
+
+	//halves order like their magnitudes once the sign is masked off, so they needn't be converted
+	const unsigned short halfThreshold = FloatToHalf(threshold) & 0x7fff;
+
+	//a tile at a time, so each thread writes its own tiles and can stop at the first busy cell
+	#pragma omp parallel for schedule(dynamic, 8)
+	for (int t = 0; t < count; t++)
+	{
+		if (mMarked[t]) continue;
+
+		const int tx = t % mTilesX;
+		const int ty = (t / mTilesX) % mTilesY;
+		const int tz = t / (mTilesX * mTilesY);
+
+		//the field cells covering the tile's solver cells
+		int startX = (int)(scaleX * (tx << mShift));
+		int endX = min(field.Width(), (int)ceilf(scaleX * min(mWidth, (tx + 1) << mShift)));
+		int startY = (int)(scaleY * (ty << mShift));
+		int endY = min(field.Height(), (int)ceilf(scaleY * min(mHeight, (ty + 1) << mShift)));
+		int startZ = (int)(scaleZ * (tz << mShift));
+		int endZ = min(field.Depth(), (int)ceilf(scaleZ * min(mDepth, (tz + 1) << mShift)));
+
+		bool busy = false;
+		for (int z = startZ; z < endZ && !busy; z++)
+		{
+			for (int y = startY; y < endY && !busy; y++)
+			{
+				//a plane at a time for planar fields
+				for (int p = 0; p < field.Planes() && !busy; p++)
+				{
+					const int row = field.Index(startX, y, z) + p * field.ComponentPitch();
+					const int floats = cellFloats * (endX - startX);
+					if (field.Half())
+					{
+						const unsigned short *halves = field.HalfData() + row;
+						for (int i = 0; i < floats && !busy; i++) busy = (halves[i] & 0x7fff) > halfThreshold;
+						continue;
+					}
+
+					const float *values = field.Data() + row;
+					for (int i = 0; i < floats; i++)
+					{
+						if (fabsf(values[i]) > threshold)
+						{
+							busy = true;
+							break;
+						}
+					}
+				}
+			}
+		}
+
+		if (busy) mMarked[t] = 1;
+	}
+}
+
+void TileMask::Finish()
+{
+	//a tile is active if it or any of its neighbours (diagonals included) was marked
+	int active = 0;
+	for (int tz = 0; tz < mTilesZ; tz++)
+	{
+		for (int ty = 0; ty < mTilesY; ty++)
+		{
+			for (int tx = 0; tx < mTilesX; tx++)
+			{
+				unsigned char on = 0;
+				for (int z = max(0, tz-1); z <= min(mTilesZ-1, tz+1) && !on; z++)
+				{
+					for (int y = max(0, ty-1); y <= min(mTilesY-1, ty+1) && !on; y++)
+					{
+						for (int x = max(0, tx-1); x <= min(mTilesX-1, tx+1) && !on; x++)
+						{
+							on = mMarked[x + mTilesX * (y + mTilesY * z)];
+						}
+					}
+				}
+
+				mTiles[tx + mTilesX * (ty + mTilesY * tz)] = on;
+				active += on;
+			}
+		}
+	}
+
+	mActiveTiles = active;
+	mEnabled = true;
+}
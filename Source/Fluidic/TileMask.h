@@ -0,0 +1,122 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "CPUField.h"
+
+namespace Fluidic
+{
+	/**
+	 * \brief Which tiles of a CPU fluid are doing anything, so the steps can skip the rest.
+	 *
+	 * Tiles are 16x16 cells in 2d and 8x8x8 in 3d. Each step the fluid marks the tiles where its
+	 * fields pass a threshold, and the tiles next to those so the flow can spread, then the kernels
+	 * leave the cells of the other tiles as they are. Until Finish is called, or after Disable,
+	 * every cell counts as active.
+	 */
+	class TileMask
+	{
+	public:
+		TileMask();
+
+		/// Sizes the mask for a solver grid (depth 1 for 2d), and disables it
+		void Resize(int width, int height, int depth);
+
+		/// Makes every cell active
+		void Disable();
+
+		/// Starts building the mask, with every tile inactive
+		void Begin();
+
+		/**
+		 * \brief Marks the tiles where any component of any cell is beyond +-threshold
+		 *
+		 * The field can be at another resolution to the solver (like the 2d ink), and is scaled to fit.
+		 */
+		void Mark(const CPUField &field, float threshold);
+
+		/// Marks the tiles next to the marked ones, counts them and turns the mask on
+		void Finish();
+
+		bool Enabled() const { return mEnabled; }
+
+		/// True if the kernels can skip cells of this field - the mask is on and it's at the solver resolution
+		bool Covers(const CPUField &field) const
+		{
+			return mEnabled && field.Width() == mWidth && field.Height() == mHeight && field.Depth() == mDepth;
+		}
+
+		/// Whether the tile holding a solver cell is active (coordinates needn't be inside the grid)
+		inline bool Active(int x, int y) const
+		{
+			return !mEnabled || mTiles[Tile(x, mWidth) + mTilesX * Tile(y, mHeight)] != 0;
+		}
+		inline bool Active(int x, int y, int z) const
+		{
+			return !mEnabled || mTiles[Tile(x, mWidth) + mTilesX * (Tile(y, mHeight) + mTilesY * Tile(z, mDepth))] != 0;
+		}
+
+		/// Active for a cell given by its index in a 1 component solver field
+		inline bool ActiveIndex(int cell) const
+		{
+			if (!mEnabled) return true;
+			int x = cell % mWidth;
+			int y = (cell / mWidth) % mHeight;
+			return Active(x, y, cell / (mWidth * mHeight));
+		}
+
+		/**
+		 * \brief The flags of the tiles along a row of solver cells, for the inner loops
+		 *
+		 * Cell x's tile is TileRow(y, z)[x >> TileShift()]. Only valid while Enabled.
+		 */
+		const unsigned char *TileRow(int y, int z) const
+		{
+			return &mTiles[mTilesX * ((y >> mShift) + mTilesY * (z >> mShift))];
+		}
+
+		/// log2 of the tile size
+		int TileShift() const { return mShift; }
+
+		/// Tiles active in the last Finish (all of them when disabled)
+		int ActiveTiles() const { return mEnabled ? mActiveTiles : TileCount(); }
+
+		int TileCount() const { return mTilesX * mTilesY * mTilesZ; }
+
+	private:
+		inline int Tile(int v, int res) const
+		{
+			return CPUField::Clamp(v, res) >> mShift;
+		}
+
+		std::vector<unsigned char> mTiles;
+		std::vector<unsigned char> mMarked; ///< tiles marked before Finish spreads them
+		int mWidth, mHeight, mDepth;
+		int mTilesX, mTilesY, mTilesZ;
+		int mShift; ///< log2 of the tile size
+		int mActiveTiles;
+		bool mEnabled;
+	};
+}
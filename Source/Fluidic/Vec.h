@@ -0,0 +1,162 @@
+/*
+Copyright (c) 2010 Steven Leigh
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#pragma once
+
+#include <math.h>
+#include <vector>
+#include <xmmintrin.h>
+
+#include "Vector.h"
+
+namespace Fluidic
+{
+	/**
+	 * \brief 2 dimensional float vector. Unlike Vector, the dimension is in the type rather than
+	 * carried at run time, so the operators have no branches.
+	 */
+	struct Vec2f
+	{
+		float x, y;
+
+		Vec2f() : x(0), y(0) {}
+		Vec2f(float _x, float _y) : x(_x), y(_y) {}
+		explicit Vec2f(const Vector &v) : x(v.x), y(v.y) {}
+
+		/// As a 2d Vector
+		Vector ToVector() const { return Vector(x, y); }
+
+		Vec2f operator+(const Vec2f &v) const { return Vec2f(x + v.x, y + v.y); }
+		Vec2f operator-(const Vec2f &v) const { return Vec2f(x - v.x, y - v.y); }
+		Vec2f operator*(const Vec2f &v) const { return Vec2f(x * v.x, y * v.y); }
+		Vec2f operator*(float f) const { return Vec2f(x * f, y * f); }
+		Vec2f operator-() const { return Vec2f(-x, -y); }
+		Vec2f &operator+=(const Vec2f &v) { x += v.x; y += v.y; return *this; }
+		Vec2f &operator-=(const Vec2f &v) { x -= v.x; y -= v.y; return *this; }
+		Vec2f &operator*=(float f) { x *= f; y *= f; return *this; }
+
+		float Dot(const Vec2f &v) const { return x * v.x + y * v.y; }
+		float Length() const { return sqrtf(Dot(*this)); }
+		/// Unit length, or unchanged if zero
+		Vec2f Normalized() const { float len = Length(); return len == 0 ? *this : *this * (1.f / len); }
+	};
+
+	/// 3 dimensional float vector, as Vec2f
+	struct Vec3f
+	{
+		float x, y, z;
+
+		Vec3f() : x(0), y(0), z(0) {}
+		Vec3f(float _x, float _y, float _z) : x(_x), y(_y), z(_z) {}
+		explicit Vec3f(const Vector &v) : x(v.x), y(v.y), z(v.z) {}
+
+		/// As a 3d Vector
+		Vector ToVector() const { return Vector(x, y, z); }
+
+		Vec3f operator+(const Vec3f &v) const { return Vec3f(x + v.x, y + v.y, z + v.z); }
+		Vec3f operator-(const Vec3f &v) const { return Vec3f(x - v.x, y - v.y, z - v.z); }
+		Vec3f operator*(const Vec3f &v) const { return Vec3f(x * v.x, y * v.y, z * v.z); }
+		Vec3f operator*(float f) const { return Vec3f(x * f, y * f, z * f); }
+		Vec3f operator-() const { return Vec3f(-x, -y, -z); }
+		Vec3f &operator+=(const Vec3f &v) { x += v.x; y += v.y; z += v.z; return *this; }
+		Vec3f &operator-=(const Vec3f &v) { x -= v.x; y -= v.y; z -= v.z; return *this; }
+		Vec3f &operator*=(float f) { x *= f; y *= f; z *= f; return *this; }
+
+		float Dot(const Vec3f &v) const { return x * v.x + y * v.y + z * v.z; }
+		float Length() const { return sqrtf(Dot(*this)); }
+		/// Unit length, or unchanged if zero
+		Vec3f Normalized() const { float len = Length(); return len == 0 ? *this : *this * (1.f / len); }
+	};
+
+	/// 4 dimensional float vector (an RGBA colour, say), loaded and stored as one SSE register
+	struct Vec4f
+	{
+		float x, y, z, w;
+
+		Vec4f() : x(0), y(0), z(0), w(0) {}
+		Vec4f(float _x, float _y, float _z, float _w) : x(_x), y(_y), z(_z), w(_w) {}
+		explicit Vec4f(__m128 v) { _mm_storeu_ps(&x, v); }
+
+		__m128 Load() const { return _mm_loadu_ps(&x); }
+
+		Vec4f operator+(const Vec4f &v) const { return Vec4f(_mm_add_ps(Load(), v.Load())); }
+		Vec4f operator-(const Vec4f &v) const { return Vec4f(_mm_sub_ps(Load(), v.Load())); }
+		Vec4f operator*(const Vec4f &v) const { return Vec4f(_mm_mul_ps(Load(), v.Load())); }
+		Vec4f operator*(float f) const { return Vec4f(_mm_mul_ps(Load(), _mm_set1_ps(f))); }
+
+		float Dot(const Vec4f &v) const { return x * v.x + y * v.y + z * v.z + w * v.w; }
+	};
+
+	/**
+	 * \brief Many Vec3fs stored as a structure of arrays - the xs together, then the ys, then the zs -
+	 * so that bulk work (perturbers, poller positions) can go 4 at a time in SSE registers.
+	 *
+	 * The arrays are padded with zeroes to a multiple of 4, so the SSE loops need no tail.
+	 * 2d users leave z at 0.
+	 */
+	class Vec3Array
+	{
+	public:
+		Vec3Array() : mSize(0) {}
+		explicit Vec3Array(int size) : mSize(0) { Resize(size); }
+
+		int Size() const { return mSize; }
+		/// Size rounded up to a multiple of 4, the length of each of X(), Y() and Z()
+		int PaddedSize() const { return (int)mX.size(); }
+
+		/// Resizes, zeroing any new vectors
+		void Resize(int size)
+		{
+			//the padding past the end stays zero
+			for (int i = size; i < mSize; i++) mX[i] = mY[i] = mZ[i] = 0;
+
+			const int padded = (size + 3) & ~3;
+			mX.resize(padded, 0);
+			mY.resize(padded, 0);
+			mZ.resize(padded, 0);
+			mSize = size;
+		}
+
+		void Clear() { Resize(0); }
+
+		void PushBack(const Vec3f &v)
+		{
+			Resize(mSize + 1);
+			Set(mSize - 1, v);
+		}
+
+		Vec3f operator[](int i) const { return Vec3f(mX[i], mY[i], mZ[i]); }
+		void Set(int i, const Vec3f &v) { mX[i] = v.x; mY[i] = v.y; mZ[i] = v.z; }
+
+		float *X() { return mX.empty() ? 0 : &mX[0]; }
+		float *Y() { return mY.empty() ? 0 : &mY[0]; }
+		float *Z() { return mZ.empty() ? 0 : &mZ[0]; }
+		const float *X() const { return mX.empty() ? 0 : &mX[0]; }
+		const float *Y() const { return mY.empty() ? 0 : &mY[0]; }
+		const float *Z() const { return mZ.empty() ? 0 : &mZ[0]; }
+
+	private:
+		int mSize;
+		std::vector<float> mX;
+		std::vector<float> mY;
+		std::vector<float> mZ;
+	};
+}
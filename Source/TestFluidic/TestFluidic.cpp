@@ -21,6 +21,7 @@ THE SOFTWARE.
 */
 #include <iostream>
 #include <fstream>
+#include <string.h>
 
 #include "TestScene.h"
 #include "TestScene2D.h"
@@ -52,11 +53,19 @@ inline void ResetTime();
 
 void InitGLUT(int argc, char **argv);
 void InitGLEW(void);
+void Benchmark(void);
 
 TestScene *scene;
 
 int main(int argc, char **argv)
 {
+	//headless timing of the CPU solvers, instead of the test scenes
+	if (argc > 1 && strcmp(argv[1], "-benchmark") == 0)
+	{
+		Benchmark();
+		return 0;
+	}
+
 	//perform initialisation
 	InitGLUT(argc, argv);
 	InitGLEW();
@@ -90,6 +99,44 @@ void InitGLUT(int argc, char **argv)
 
 }
 
+void Benchmark()
+{
+	const int steps = 100;
+	const char *names[] = { "semi-lagrangian", "maccormack" };
+
+	for (int advection = AD_SEMI_LAGRANGIAN; advection <= AD_MACCORMACK; advection++)
+	{
+		FluidOptions options = FluidCPU2D::DefaultOptions();
+		options.Advection = (AdvectionType)advection;
+		FluidCPU2D fluid2d;
+		fluid2d.Init(options);
+		fluid2d.GenerateCircularVortex();
+		fluid2d.InjectCheckeredData();
+		cout << "2d " << names[advection] << " advection: " << fluid2d.BenchmarkAdvection(steps) / 1e6 << " Mcells/s" << endl;
+
+		options = FluidCPU3D::DefaultOptions();
+		options.Advection = (AdvectionType)advection;
+		FluidCPU3D fluid3d;
+		fluid3d.Init(options);
+		fluid3d.GenerateCircularVortex();
+		fluid3d.InjectCheckeredData();
+		cout << "3d " << names[advection] << " advection: " << fluid3d.BenchmarkAdvection(steps) / 1e6 << " Mcells/s" << endl;
+	}
+
+	//the 3d field layouts, for the 7 point stencil and the advection's lookups
+	const char *layouts[] = { "linear", "slab atlas", "bricked" };
+	for (int resolution = 64; resolution <= 256; resolution *= 2)
+	{
+		double jacobi[3], sampling[3];
+		BrickedField::BenchmarkLayouts(resolution, 10, jacobi, sampling);
+		for (int layout = 0; layout < 3; layout++)
+		{
+			cout << resolution << "^3 " << layouts[layout] << " layout: jacobi " << jacobi[layout] / 1e6 << " Mcells/s, trilinear sampling "
+				 << sampling[layout] / 1e6 << " Mcells/s" << endl;
+		}
+	}
+}
+
 void InitGLEW()
 {
 	int err = glewInit();